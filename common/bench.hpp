@@ -0,0 +1,445 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       bench.hpp
+ *
+ * Purpose:    Time the solutions the same way, so results can be compared
+ *             from run to run and kept as a baseline.
+ *
+ *             A util::Benchmark times named regions of a solution. Each
+ *             region is run a number of times after some warm-up runs, and
+ *             samples further than a few median absolute deviations from
+ *             the median are set aside as outliers before the statistics
+ *             are taken. time() reads the host clock and timeEvents() the
+ *             profiling info of the events the region returns.
+ *
+ *             The environment controls a run, so every solution's options
+ *             stay as they are:
+ *               OPENCL_BENCH_WARMUP    warm-up runs (default 0)
+ *               OPENCL_BENCH_REPEATS   timed runs (default 1)
+ *               OPENCL_BENCH_OUTLIERS  MADs beyond which a sample is an
+ *                                      outlier (default 3, 0 keeps all)
+ *               OPENCL_BENCH_JSON      file to write the results to
+ *
+ *             The JSON records the device and the solution's parameters
+ *             with the results, one result per line. readBenchResults() and
+ *             compareBench() read it back to compare against a baseline;
+ *             see the BenchCompare solution and `make bench`.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the NBody solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <util.hpp>
+#include <device_cache.hpp>
+#include <json.hpp>
+
+namespace util {
+
+struct BenchConfig
+{
+  unsigned    warmup;
+  unsigned    repeats;
+  double      outlierMads;
+  std::string output;      // No JSON if empty
+};
+
+inline BenchConfig benchConfig()
+{
+  BenchConfig config;
+  const char *warmup   = getenv("OPENCL_BENCH_WARMUP");
+  const char *repeats  = getenv("OPENCL_BENCH_REPEATS");
+  const char *outliers = getenv("OPENCL_BENCH_OUTLIERS");
+  const char *output   = getenv("OPENCL_BENCH_JSON");
+  config.warmup      = warmup   ? atoi(warmup) : 0;
+  config.repeats     = repeats  ? std::max(1, atoi(repeats)) : 1;
+  config.outlierMads = outliers ? atof(outliers) : 3.0;
+  config.output      = output   ? output : "";
+  return config;
+}
+
+struct BenchResult
+{
+  std::string name;
+  std::string clock;       // "host" or "device"
+  double      median;      // Milliseconds, over the samples kept
+  double      mean;
+  double      min;
+  double      max;
+  double      stddev;
+  unsigned    samples;     // Kept
+  unsigned    rejected;    // Outliers
+  double      rate;        // Work per second at the median, if work was given
+  std::string rateUnit;
+};
+
+namespace detail {
+
+inline double median(std::vector<double> values)
+{
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n/2] : 0.5 * (values[n/2 - 1] + values[n/2]);
+}
+
+inline BenchResult benchStatistics(const std::string& name, const std::string& clock,
+                                   const std::vector<double>& samples, double outlierMads)
+{
+  BenchResult r;
+  r.name  = name;
+  r.clock = clock;
+  r.rate  = 0;
+
+  // Median absolute deviation, scaled to estimate a standard deviation
+  std::vector<double> kept = samples;
+  double mid = median(samples);
+  if (outlierMads > 0 && samples.size() >= 5)
+  {
+    std::vector<double> deviations;
+    for (size_t i = 0; i < samples.size(); i++)
+      deviations.push_back(std::fabs(samples[i] - mid));
+    double mad = 1.4826 * median(deviations);
+    if (mad > 0)
+    {
+      kept.clear();
+      for (size_t i = 0; i < samples.size(); i++)
+        if (std::fabs(samples[i] - mid) <= outlierMads * mad)
+          kept.push_back(samples[i]);
+    }
+  }
+
+  r.rejected = (unsigned)(samples.size() - kept.size());
+  if (kept.empty())
+    kept.push_back(0);
+  r.samples  = (unsigned)kept.size();
+  r.median   = median(kept);
+  r.min      = *std::min_element(kept.begin(), kept.end());
+  r.max      = *std::max_element(kept.begin(), kept.end());
+  double sum = 0, squares = 0;
+  for (size_t i = 0; i < kept.size(); i++)
+    sum += kept[i];
+  r.mean = sum / kept.size();
+  for (size_t i = 0; i < kept.size(); i++)
+    squares += (kept[i] - r.mean) * (kept[i] - r.mean);
+  r.stddev = kept.size() > 1 ? std::sqrt(squares / (kept.size() - 1)) : 0;
+  return r;
+}
+
+// Milliseconds from the start of the first event to the end of the last
+inline double eventMilliseconds(const std::vector<cl::Event>& events)
+{
+  if (events.empty())
+    return 0;
+  cl::Event::waitForEvents(events);
+  cl_ulong start = events.front().getProfilingInfo<CL_PROFILING_COMMAND_START>();
+  cl_ulong end   = events.back().getProfilingInfo<CL_PROFILING_COMMAND_END>();
+  return (end - start) * 1e-6;
+}
+
+inline double eventMilliseconds(const cl::Event& event)
+{
+  return eventMilliseconds(std::vector<cl::Event>(1, event));
+}
+
+} // namespace detail
+
+class Benchmark
+{
+public:
+  Benchmark(const std::string& name, const cl::Device& device)
+    : name_(name), config_(benchConfig())
+  {
+    deviceKey_    = deviceCacheKey(device);
+    deviceName_   = device.getInfo<CL_DEVICE_NAME>();
+    deviceDriver_ = device.getInfo<CL_DRIVER_VERSION>();
+  }
+
+  //! Record a parameter of the run, such as a problem size
+  template <typename T>
+  void param(const std::string& key, const T& value)
+  {
+    std::ostringstream text;
+    text << value;
+    params_.push_back(std::make_pair(key, text.str()));
+  }
+
+  /*!
+   * \brief Time fn on the host clock.
+   *
+   * fn must wait for any device work it starts. If work is given, the
+   * result's rate is work per second at the median, in rateUnit.
+   */
+  template <typename F>
+  BenchResult time(const std::string& name, F fn,
+                          double work = 0, const std::string& rateUnit = "")
+  {
+    for (unsigned i = 0; i < config_.warmup; i++)
+      fn();
+
+    Timer timer;
+    std::vector<double> samples;
+    for (unsigned i = 0; i < config_.repeats; i++)
+    {
+      uint64_t start = timer.getTimeNanoseconds();
+      fn();
+      samples.push_back((timer.getTimeNanoseconds() - start) * 1e-6);
+    }
+    return record(name, samples, work, rateUnit);
+  }
+
+  /*!
+   * \brief Time fn by the events it returns: a cl::Event, or a
+   * std::vector<cl::Event> timed from the first to start to the last to end.
+   *
+   * The events must come from a queue with profiling enabled.
+   */
+  template <typename F>
+  BenchResult timeEvents(const std::string& name, F fn,
+                                double work = 0, const std::string& rateUnit = "")
+  {
+    for (unsigned i = 0; i < config_.warmup; i++)
+      detail::eventMilliseconds(fn());
+
+    std::vector<double> samples;
+    for (unsigned i = 0; i < config_.repeats; i++)
+      samples.push_back(detail::eventMilliseconds(fn()));
+    return record(name, samples, work, rateUnit, "device");
+  }
+
+  /*!
+   * \brief Add samples, in milliseconds, that were timed some other way.
+   *
+   * For regions timed from inside a loop the solution already runs.
+   */
+  BenchResult record(const std::string& name, const std::vector<double>& samples,
+                            double work = 0, const std::string& rateUnit = "",
+                            const std::string& clock = "host")
+  {
+    BenchResult r = detail::benchStatistics(name, clock, samples, config_.outlierMads);
+    if (work > 0 && r.median > 0)
+    {
+      r.rate     = work / (r.median * 1e-3);
+      r.rateUnit = rateUnit;
+    }
+    results_.push_back(r);
+    return r;
+  }
+
+  const std::vector<BenchResult>& results() const { return results_; }
+
+  //! Write the results if OPENCL_BENCH_JSON is set
+  bool write() const
+  {
+    if (config_.output.empty())
+      return true;
+
+    std::ofstream out(config_.output.c_str());
+    if (!out.is_open())
+    {
+      std::cout << "Cannot write benchmark results to " << config_.output << std::endl;
+      return false;
+    }
+
+    using detail::jsonString;
+    out << "{\n"
+        << "  \"benchmark\": " << jsonString(name_) << ",\n"
+        << "  \"device_key\": " << jsonString(deviceKey_) << ",\n"
+        << "  \"device_name\": " << jsonString(deviceName_) << ",\n"
+        << "  \"device_driver\": " << jsonString(deviceDriver_) << ",\n"
+        << "  \"warmup\": " << config_.warmup << ",\n"
+        << "  \"repeats\": " << config_.repeats << ",\n"
+        << "  \"params\": {";
+    for (size_t i = 0; i < params_.size(); i++)
+      out << (i ? ", " : "") << jsonString(params_[i].first) << ": "
+          << jsonString(params_[i].second);
+    out << "},\n"
+        << "  \"results\": [\n";
+
+    out << std::setprecision(6);
+    for (size_t i = 0; i < results_.size(); i++)
+    {
+      const BenchResult& r = results_[i];
+      out << "    {\"name\": " << jsonString(r.name)
+          << ", \"clock\": " << jsonString(r.clock)
+          << ", \"median_ms\": " << r.median
+          << ", \"mean_ms\": " << r.mean
+          << ", \"min_ms\": " << r.min
+          << ", \"max_ms\": " << r.max
+          << ", \"stddev_ms\": " << r.stddev
+          << ", \"samples\": " << r.samples
+          << ", \"rejected\": " << r.rejected
+          << ", \"rate\": " << r.rate
+          << ", \"rate_unit\": " << jsonString(r.rateUnit) << "}"
+          << (i + 1 < results_.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return out.good();
+  }
+
+private:
+  std::string name_;
+  BenchConfig config_;
+  std::string deviceKey_, deviceName_, deviceDriver_;
+  std::vector<std::pair<std::string, std::string> > params_;
+  std::vector<BenchResult> results_;
+};
+
+struct BenchFile
+{
+  std::string              benchmark;
+  std::string              deviceKey;
+  std::string              deviceName;
+  std::vector<BenchResult> results;
+};
+
+//! Read results written by Benchmark::write()
+inline bool readBenchResults(const std::string& path, BenchFile& file)
+{
+  using detail::jsonField;
+  std::ifstream in(path.c_str());
+  if (!in.is_open())
+    return false;
+
+  file = BenchFile();
+  std::string line;
+  while (std::getline(in, line))
+  {
+    if (line.find("\"median_ms\"") != std::string::npos)
+    {
+      BenchResult r;
+      r.name     = jsonField(line, "name");
+      r.clock    = jsonField(line, "clock");
+      r.median   = atof(jsonField(line, "median_ms").c_str());
+      r.mean     = atof(jsonField(line, "mean_ms").c_str());
+      r.min      = atof(jsonField(line, "min_ms").c_str());
+      r.max      = atof(jsonField(line, "max_ms").c_str());
+      r.stddev   = atof(jsonField(line, "stddev_ms").c_str());
+      r.samples  = atoi(jsonField(line, "samples").c_str());
+      r.rejected = atoi(jsonField(line, "rejected").c_str());
+      r.rate     = atof(jsonField(line, "rate").c_str());
+      r.rateUnit = jsonField(line, "rate_unit");
+      file.results.push_back(r);
+    }
+    else if (line.find("\"benchmark\"") != std::string::npos)
+      file.benchmark = jsonField(line, "benchmark");
+    else if (line.find("\"device_key\"") != std::string::npos)
+      file.deviceKey = jsonField(line, "device_key");
+    else if (line.find("\"device_name\"") != std::string::npos)
+      file.deviceName = jsonField(line, "device_name");
+  }
+  return !file.benchmark.empty();
+}
+
+struct BenchComparison
+{
+  unsigned regressions;     // Medians slower than the threshold
+  unsigned missing;         // In the baseline but not in the current run
+  bool     deviceMismatch;  // Baseline from another device; nothing compared
+
+  BenchComparison() : regressions(0), missing(0), deviceMismatch(false) {}
+
+  unsigned failures() const
+  {
+    return regressions + missing + (deviceMismatch ? 1 : 0);
+  }
+};
+
+/*!
+ * \brief Print each result of current against baseline.
+ *
+ * A median more than threshold (a fraction) slower than the baseline is a
+ * regression, and a baseline result the current run did not produce is a
+ * failure too. Timings from another device say nothing about this one, so a
+ * baseline from another device is not compared unless \p allowDeviceMismatch.
+ */
+inline BenchComparison compareBench(const BenchFile& baseline, const BenchFile& current,
+                                    double threshold, bool allowDeviceMismatch = false,
+                                    std::ostream& out = std::cout)
+{
+  BenchComparison result;
+
+  if (!baseline.deviceKey.empty() && baseline.deviceKey != current.deviceKey)
+  {
+    if (!allowDeviceMismatch)
+    {
+      out << "  DEVICE MISMATCH: baseline is from " << baseline.deviceName
+          << ", results are from " << current.deviceName << std::endl;
+      result.deviceMismatch = true;
+      return result;
+    }
+    out << "  (baseline is from " << baseline.deviceName << ")" << std::endl;
+  }
+
+  std::map<std::string, const BenchResult*> before, after;
+  for (size_t i = 0; i < baseline.results.size(); i++)
+    before[baseline.results[i].name] = &baseline.results[i];
+  for (size_t i = 0; i < current.results.size(); i++)
+    after[current.results[i].name] = &current.results[i];
+
+  std::ios::fmtflags flags = out.flags();
+  out << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < current.results.size(); i++)
+  {
+    const BenchResult& r = current.results[i];
+    out << "  " << std::left << std::setw(28) << r.name << std::right;
+    if (!before.count(r.name))
+    {
+      out << std::setw(12) << "-" << std::setw(12) << r.median << "       new" << std::endl;
+      continue;
+    }
+
+    const BenchResult& b = *before[r.name];
+    double change = b.median > 0 ? (r.median - b.median) / b.median : 0;
+    const char *status = "";
+    if (change > threshold)
+    {
+      status = "  REGRESSION";
+      result.regressions++;
+    }
+    else if (change < -threshold)
+      status = "  improved";
+
+    out << std::setw(12) << b.median << std::setw(12) << r.median
+        << std::setw(9) << std::setprecision(1) << 100 * change << "%"
+        << std::setprecision(3) << status << std::endl;
+  }
+
+  // A variant that now fails or is no longer run must not pass silently
+  for (size_t i = 0; i < baseline.results.size(); i++)
+  {
+    const BenchResult& b = baseline.results[i];
+    if (after.count(b.name))
+      continue;
+    out << "  " << std::left << std::setw(28) << b.name << std::right
+        << std::setw(12) << b.median << std::setw(12) << "-" << "  MISSING" << std::endl;
+    result.missing++;
+  }
+  out.flags(flags);
+  return result;
+}
+
+} // namespace util
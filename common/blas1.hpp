@@ -0,0 +1,463 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       blas1.hpp
+ *
+ * Purpose:    Device-resident single precision BLAS level 1 routines:
+ *             axpy, scal, copy, swap, dot, nrm2, asum and iamax.
+ *
+ *             The kernels are specialised at build time for a vector width
+ *             (taken from CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT by default)
+ *             and an unroll factor. Reductions are completed on the device,
+ *             so results stay in device buffers until the caller reads them.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the Blas1 solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace util {
+
+static const char *blas1_source = R"CLC(
+#define CAT_(a, b) a##b
+#define CAT(a, b)  CAT_(a, b)
+
+#if VW == 1
+typedef float vfloat;
+#define VLOAD(i, p)     ((p)[i])
+#define VSTORE(v, i, p) ((p)[i] = (v))
+#define HSUM(v)         (v)
+#else
+typedef CAT(float, VW) vfloat;
+#define VLOAD(i, p)     CAT(vload, VW)(i, p)
+#define VSTORE(v, i, p) CAT(vstore, VW)(v, i, p)
+#define HSUM(v)         CAT(hsum, VW)(v)
+#endif
+
+float hsum2(float2 v)   { return v.s0 + v.s1; }
+float hsum4(float4 v)   { return hsum2(v.lo) + hsum2(v.hi); }
+float hsum8(float8 v)   { return hsum4(v.lo) + hsum4(v.hi); }
+float hsum16(float16 v) { return hsum8(v.lo) + hsum8(v.hi); }
+
+// Visit every element of an n element vector, VW elements at a time and
+// UNROLL vectors per loop iteration, then mop up the scalar remainder.
+// The indices are ulong so that stepping past the end of a vector close to
+// UINT_MAX elements long cannot wrap back into it.
+#define FOREACH(n, VBODY, SBODY)                                   \
+  {                                                                \
+    const ulong nv     = (n) / VW;                                 \
+    const ulong stride = get_global_size(0);                       \
+    ulong i = get_global_id(0);                                    \
+    for (; i + (UNROLL-1)*stride < nv; i += UNROLL*stride)         \
+    {                                                              \
+      for (uint u = 0; u < UNROLL; u++)                            \
+      {                                                            \
+        const ulong v = i + u*stride;                              \
+        VBODY                                                      \
+      }                                                            \
+    }                                                              \
+    for (; i < nv; i += stride)                                    \
+    {                                                              \
+      const ulong v = i;                                           \
+      VBODY                                                        \
+    }                                                              \
+    for (ulong s = nv*VW + get_global_id(0); s < (n); s += stride) \
+    {                                                              \
+      SBODY                                                        \
+    }                                                              \
+  }
+
+kernel void axpy(const uint n, const float alpha,
+                 global const float *x, global float *y)
+{
+  FOREACH(n,
+    VSTORE(alpha*VLOAD(v, x) + VLOAD(v, y), v, y);,
+    y[s] = alpha*x[s] + y[s];)
+}
+
+kernel void scal(const uint n, const float alpha, global float *x)
+{
+  FOREACH(n,
+    VSTORE(alpha*VLOAD(v, x), v, x);,
+    x[s] = alpha*x[s];)
+}
+
+kernel void copy(const uint n, global const float *x, global float *y)
+{
+  FOREACH(n,
+    VSTORE(VLOAD(v, x), v, y);,
+    y[s] = x[s];)
+}
+
+kernel void swap(const uint n, global float *x, global float *y)
+{
+  FOREACH(n,
+    vfloat t = VLOAD(v, x); VSTORE(VLOAD(v, y), v, x); VSTORE(t, v, y);,
+    float t = x[s]; x[s] = y[s]; y[s] = t;)
+}
+
+// Tree reduction of one value per work-item in local memory
+float reduce_local(float value, local float *scratch)
+{
+  const uint lid = get_local_id(0);
+  scratch[lid] = value;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint offset = get_local_size(0)/2; offset > 0; offset /= 2)
+  {
+    if (lid < offset)
+      scratch[lid] += scratch[lid + offset];
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  return scratch[0];
+}
+
+// First stage of dot, nrm2 and asum: one partial sum per work-group
+kernel void dot_partial(const uint n, global const float *x, global const float *y,
+                        global float *partial, local float *scratch)
+{
+  vfloat acc  = 0.0f;
+  float  tail = 0.0f;
+  FOREACH(n,
+    acc += VLOAD(v, x) * VLOAD(v, y);,
+    tail += x[s] * y[s];)
+  float sum = reduce_local(HSUM(acc) + tail, scratch);
+  if (get_local_id(0) == 0)
+    partial[get_group_id(0)] = sum;
+}
+
+kernel void sumsq_partial(const uint n, global const float *x,
+                          global float *partial, local float *scratch)
+{
+  vfloat acc  = 0.0f;
+  float  tail = 0.0f;
+  FOREACH(n,
+    vfloat t = VLOAD(v, x); acc += t*t;,
+    tail += x[s] * x[s];)
+  float sum = reduce_local(HSUM(acc) + tail, scratch);
+  if (get_local_id(0) == 0)
+    partial[get_group_id(0)] = sum;
+}
+
+kernel void asum_partial(const uint n, global const float *x,
+                         global float *partial, local float *scratch)
+{
+  vfloat acc  = 0.0f;
+  float  tail = 0.0f;
+  FOREACH(n,
+    acc += fabs(VLOAD(v, x));,
+    tail += fabs(x[s]);)
+  float sum = reduce_local(HSUM(acc) + tail, scratch);
+  if (get_local_id(0) == 0)
+    partial[get_group_id(0)] = sum;
+}
+
+// Second stage: a single work-group sums the partials, taking the square
+// root for nrm2
+kernel void sum_final(const uint count, const uint root,
+                      global const float *partial, global float *result,
+                      local float *scratch)
+{
+  float acc = 0.0f;
+  for (uint i = get_local_id(0); i < count; i += get_local_size(0))
+    acc += partial[i];
+  float sum = reduce_local(acc, scratch);
+  if (get_local_id(0) == 0)
+    result[0] = root ? sqrt(sum) : sum;
+}
+
+// Keep the larger |x|, or the lower index if they are equal (as BLAS does)
+#define BETTER(va, ia, vb, ib) ((va) > (vb) || ((va) == (vb) && (ia) < (ib)))
+
+void reduce_local_max(float value, uint index,
+                      local float *values, local uint *indices)
+{
+  const uint lid = get_local_id(0);
+  values[lid]  = value;
+  indices[lid] = index;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for (uint offset = get_local_size(0)/2; offset > 0; offset /= 2)
+  {
+    if (lid < offset &&
+        BETTER(values[lid+offset], indices[lid+offset], values[lid], indices[lid]))
+    {
+      values[lid]  = values[lid+offset];
+      indices[lid] = indices[lid+offset];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
+
+kernel void iamax_partial(const uint n, global const float *x,
+                          global float *partialValues, global uint *partialIndices,
+                          local float *values, local uint *indices)
+{
+  float best  = -1.0f;
+  uint  index = UINT_MAX;
+  FOREACH(n,
+    for (uint k = 0; k < VW; k++)
+    {
+      float a = fabs(x[v*VW + k]);
+      if (BETTER(a, v*VW + k, best, index)) { best = a; index = (uint)(v*VW + k); }
+    },
+    float a = fabs(x[s]);
+    if (BETTER(a, s, best, index)) { best = a; index = (uint)s; })
+  reduce_local_max(best, index, values, indices);
+  if (get_local_id(0) == 0)
+  {
+    partialValues[get_group_id(0)]  = values[0];
+    partialIndices[get_group_id(0)] = indices[0];
+  }
+}
+
+kernel void iamax_final(const uint count,
+                        global const float *partialValues,
+                        global const uint *partialIndices,
+                        global uint *result,
+                        local float *values, local uint *indices)
+{
+  float best  = -1.0f;
+  uint  index = UINT_MAX;
+  for (uint i = get_local_id(0); i < count; i += get_local_size(0))
+  {
+    if (BETTER(partialValues[i], partialIndices[i], best, index))
+    {
+      best  = partialValues[i];
+      index = partialIndices[i];
+    }
+  }
+  reduce_local_max(best, index, values, indices);
+  if (get_local_id(0) == 0)
+    result[0] = indices[0];
+}
+)CLC";
+
+class Blas1
+{
+public:
+  /*!
+   * \brief Builds the kernels for \p device.
+   *
+   * A \p vectorWidth of 0 uses CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, and an
+   * \p unroll of 0 unrolls until each work-item handles 8 floats per
+   * iteration.
+   */
+  Blas1(const cl::Context& context, const cl::Device& device,
+        unsigned vectorWidth = 0, unsigned unroll = 0)
+  {
+    vectorWidth_ = vectorWidth;
+    if (!vectorWidth_)
+      vectorWidth_ = device.getInfo<CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT>();
+    // vloadn only exists for these widths
+    if (vectorWidth_ != 2 && vectorWidth_ != 4 &&
+        vectorWidth_ != 8 && vectorWidth_ != 16)
+      vectorWidth_ = 1;
+
+    unroll_ = unroll ? unroll : std::max(1u, 8 / vectorWidth_);
+
+    std::ostringstream options;
+    options << "-DVW=" << vectorWidth_ << " -DUNROLL=" << unroll_;
+    program_ = cl::Program(context, blas1_source);
+    program_.build(std::vector<cl::Device>(1, device), options.str().c_str());
+
+    axpy_         = cl::Kernel(program_, "axpy");
+    scal_         = cl::Kernel(program_, "scal");
+    copy_         = cl::Kernel(program_, "copy");
+    swap_         = cl::Kernel(program_, "swap");
+    dotPartial_   = cl::Kernel(program_, "dot_partial");
+    sumsqPartial_ = cl::Kernel(program_, "sumsq_partial");
+    asumPartial_  = cl::Kernel(program_, "asum_partial");
+    sumFinal_     = cl::Kernel(program_, "sum_final");
+    iamaxPartial_ = cl::Kernel(program_, "iamax_partial");
+    iamaxFinal_   = cl::Kernel(program_, "iamax_final");
+
+    // Every kernel is launched with wgsize_, and the tree reductions need
+    // it to be a power of two
+    const cl::Kernel *kernels[] = { &axpy_, &scal_, &copy_, &swap_, &dotPartial_,
+                                    &sumsqPartial_, &asumPartial_, &sumFinal_,
+                                    &iamaxPartial_, &iamaxFinal_ };
+    size_t maxWG = 256;
+    for (size_t k = 0; k < sizeof(kernels)/sizeof(kernels[0]); k++)
+      maxWG = std::min(maxWG,
+        kernels[k]->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+    wgsize_ = 1;
+    while (wgsize_*2 <= maxWG)
+      wgsize_ *= 2;
+
+    maxGroups_ = 8 * device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+    partialValues_  = cl::Buffer(context, CL_MEM_READ_WRITE, maxGroups_*sizeof(cl_float));
+    partialIndices_ = cl::Buffer(context, CL_MEM_READ_WRITE, maxGroups_*sizeof(cl_uint));
+  }
+
+  unsigned getVectorWidth() const { return vectorWidth_; }
+  unsigned getUnroll() const      { return unroll_; }
+
+  //! y = alpha*x + y
+  cl::Event axpy(cl::CommandQueue& queue, cl_uint n, cl_float alpha,
+                 const cl::Buffer& x, cl::Buffer& y,
+                 const std::vector<cl::Event> *wait = NULL)
+  {
+    axpy_.setArg(0, n);
+    axpy_.setArg(1, alpha);
+    axpy_.setArg(2, x);
+    axpy_.setArg(3, y);
+    return enqueue(queue, axpy_, elementwiseRange(n), wait);
+  }
+
+  //! x = alpha*x
+  cl::Event scal(cl::CommandQueue& queue, cl_uint n, cl_float alpha,
+                 cl::Buffer& x, const std::vector<cl::Event> *wait = NULL)
+  {
+    scal_.setArg(0, n);
+    scal_.setArg(1, alpha);
+    scal_.setArg(2, x);
+    return enqueue(queue, scal_, elementwiseRange(n), wait);
+  }
+
+  //! y = x
+  cl::Event copy(cl::CommandQueue& queue, cl_uint n,
+                 const cl::Buffer& x, cl::Buffer& y,
+                 const std::vector<cl::Event> *wait = NULL)
+  {
+    copy_.setArg(0, n);
+    copy_.setArg(1, x);
+    copy_.setArg(2, y);
+    return enqueue(queue, copy_, elementwiseRange(n), wait);
+  }
+
+  //! x <-> y
+  cl::Event swap(cl::CommandQueue& queue, cl_uint n,
+                 cl::Buffer& x, cl::Buffer& y,
+                 const std::vector<cl::Event> *wait = NULL)
+  {
+    swap_.setArg(0, n);
+    swap_.setArg(1, x);
+    swap_.setArg(2, y);
+    return enqueue(queue, swap_, elementwiseRange(n), wait);
+  }
+
+  //! result[0] = x.y
+  cl::Event dot(cl::CommandQueue& queue, cl_uint n,
+                const cl::Buffer& x, const cl::Buffer& y, cl::Buffer& result,
+                const std::vector<cl::Event> *wait = NULL)
+  {
+    dotPartial_.setArg(0, n);
+    dotPartial_.setArg(1, x);
+    dotPartial_.setArg(2, y);
+    dotPartial_.setArg(3, partialValues_);
+    dotPartial_.setArg(4, cl::Local(wgsize_*sizeof(cl_float)));
+    return sum(queue, dotPartial_, n, false, result, wait);
+  }
+
+  //! result[0] = ||x||_2
+  cl::Event nrm2(cl::CommandQueue& queue, cl_uint n,
+                 const cl::Buffer& x, cl::Buffer& result,
+                 const std::vector<cl::Event> *wait = NULL)
+  {
+    sumsqPartial_.setArg(0, n);
+    sumsqPartial_.setArg(1, x);
+    sumsqPartial_.setArg(2, partialValues_);
+    sumsqPartial_.setArg(3, cl::Local(wgsize_*sizeof(cl_float)));
+    return sum(queue, sumsqPartial_, n, true, result, wait);
+  }
+
+  //! result[0] = sum(|x|)
+  cl::Event asum(cl::CommandQueue& queue, cl_uint n,
+                 const cl::Buffer& x, cl::Buffer& result,
+                 const std::vector<cl::Event> *wait = NULL)
+  {
+    asumPartial_.setArg(0, n);
+    asumPartial_.setArg(1, x);
+    asumPartial_.setArg(2, partialValues_);
+    asumPartial_.setArg(3, cl::Local(wgsize_*sizeof(cl_float)));
+    return sum(queue, asumPartial_, n, false, result, wait);
+  }
+
+  //! result[0] = first (zero-based) index of max(|x|), as a cl_uint
+  cl::Event iamax(cl::CommandQueue& queue, cl_uint n,
+                  const cl::Buffer& x, cl::Buffer& result,
+                  const std::vector<cl::Event> *wait = NULL)
+  {
+    cl_uint groups = reductionGroups(n);
+    iamaxPartial_.setArg(0, n);
+    iamaxPartial_.setArg(1, x);
+    iamaxPartial_.setArg(2, partialValues_);
+    iamaxPartial_.setArg(3, partialIndices_);
+    iamaxPartial_.setArg(4, cl::Local(wgsize_*sizeof(cl_float)));
+    iamaxPartial_.setArg(5, cl::Local(wgsize_*sizeof(cl_uint)));
+    enqueue(queue, iamaxPartial_, cl::NDRange(groups*wgsize_), wait);
+
+    iamaxFinal_.setArg(0, groups);
+    iamaxFinal_.setArg(1, partialValues_);
+    iamaxFinal_.setArg(2, partialIndices_);
+    iamaxFinal_.setArg(3, result);
+    iamaxFinal_.setArg(4, cl::Local(wgsize_*sizeof(cl_float)));
+    iamaxFinal_.setArg(5, cl::Local(wgsize_*sizeof(cl_uint)));
+    return enqueue(queue, iamaxFinal_, cl::NDRange(wgsize_), NULL);
+  }
+
+private:
+  // Enough work-items to cover the vector once, each doing UNROLL vectors
+  cl::NDRange elementwiseRange(cl_uint n) const
+  {
+    size_t items = (n / vectorWidth_ + unroll_ - 1) / unroll_;
+    items = std::max(items, (size_t)1);
+    return cl::NDRange(((items + wgsize_ - 1) / wgsize_) * wgsize_);
+  }
+
+  cl_uint reductionGroups(cl_uint n) const
+  {
+    size_t perGroup = wgsize_ * vectorWidth_ * unroll_;
+    size_t groups   = (n + perGroup - 1) / perGroup;
+    return (cl_uint)std::max((size_t)1, std::min(groups, maxGroups_));
+  }
+
+  cl::Event sum(cl::CommandQueue& queue, cl::Kernel& partial, cl_uint n,
+                bool root, cl::Buffer& result, const std::vector<cl::Event> *wait)
+  {
+    cl_uint groups = reductionGroups(n);
+    enqueue(queue, partial, cl::NDRange(groups*wgsize_), wait);
+
+    sumFinal_.setArg(0, groups);
+    sumFinal_.setArg(1, (cl_uint)root);
+    sumFinal_.setArg(2, partialValues_);
+    sumFinal_.setArg(3, result);
+    sumFinal_.setArg(4, cl::Local(wgsize_*sizeof(cl_float)));
+    return enqueue(queue, sumFinal_, cl::NDRange(wgsize_), NULL);
+  }
+
+  cl::Event enqueue(cl::CommandQueue& queue, cl::Kernel& kernel,
+                    const cl::NDRange& global, const std::vector<cl::Event> *wait)
+  {
+    cl::Event event;
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, global,
+                               cl::NDRange(wgsize_), wait, &event);
+    return event;
+  }
+
+  cl::Program program_;
+  cl::Kernel  axpy_, scal_, copy_, swap_;
+  cl::Kernel  dotPartial_, sumsqPartial_, asumPartial_, sumFinal_;
+  cl::Kernel  iamaxPartial_, iamaxFinal_;
+  cl::Buffer  partialValues_, partialIndices_;
+  unsigned    vectorWidth_;
+  unsigned    unroll_;
+  size_t      wgsize_;
+  size_t      maxGroups_;
+};
+
+} // namespace util
@@ -0,0 +1,184 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       buffer_pool.hpp
+ *
+ * Purpose:    Device buffers without a driver allocation per buffer.
+ *
+ *             A BufferPool reserves a few large arena buffers in a context
+ *             and hands out sub-buffers of them (clCreateSubBuffer), with
+ *             origins aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN. Requests are
+ *             rounded up to a power-of-two size class. A released sub-buffer
+ *             goes on the free list of its class and is handed out again as
+ *             it is, so a steady cycle of acquire and release makes no
+ *             driver calls at all once every class in use has been carved.
+ *             Requests too large for an arena get a buffer of their own,
+ *             which is pooled in the same way.
+ *
+ *             A buffer may be released as soon as the last command using it
+ *             has been enqueued, provided every queue using the pool is the
+ *             same in-order queue; otherwise wait for those commands first.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the MatMul solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace util {
+
+struct BufferPoolStats
+{
+  size_t acquires;      // Calls to acquire()
+  size_t reuses;        // Served from a free list, with no driver call
+  size_t subBuffers;    // Sub-buffers created in the arenas
+  size_t dedicated;     // Buffers too large for an arena
+  size_t arenas;        // Arena buffers reserved
+  size_t arenaBytes;    // Bytes reserved in arenas
+  size_t bytesInUse;    // Size-class bytes currently acquired
+  size_t peakBytesInUse;
+
+  //! Allocations that reached the driver
+  size_t driverAllocations() const { return subBuffers + dedicated + arenas; }
+};
+
+class BufferPool
+{
+public:
+  BufferPool(const cl::Context& context, const cl::Device& device,
+             size_t arenaBytes = 64*1024*1024,
+             cl_mem_flags flags = CL_MEM_READ_WRITE)
+    : context_(context), arenaBytes_(arenaBytes), flags_(flags)
+  {
+    // Sub-buffer origins must be aligned to the base address alignment
+    size_t align = device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8;
+    minClassBytes_ = std::max<size_t>(align, 256);
+
+    size_t maxAlloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    arenaBytes_ = std::min(arenaBytes_, maxAlloc);
+
+    stats_.acquires       = 0;
+    stats_.reuses         = 0;
+    stats_.subBuffers     = 0;
+    stats_.dedicated      = 0;
+    stats_.arenas         = 0;
+    stats_.arenaBytes     = 0;
+    stats_.bytesInUse     = 0;
+    stats_.peakBytesInUse = 0;
+  }
+
+  //! A buffer of at least bytes bytes
+  cl::Buffer acquire(size_t bytes)
+  {
+    stats_.acquires++;
+    size_t classBytes = sizeClass(bytes);
+    std::vector<cl::Buffer>& free = free_[classBytes];
+
+    cl::Buffer buffer;
+    if (!free.empty())
+    {
+      buffer = free.back();
+      free.pop_back();
+      stats_.reuses++;
+    }
+    else if (classBytes > arenaBytes_ / 2)
+    {
+      buffer = cl::Buffer(context_, flags_, classBytes);
+      stats_.dedicated++;
+    }
+    else
+    {
+      buffer = carve(classBytes);
+    }
+
+    sizes_[buffer()] = classBytes;
+    stats_.bytesInUse += classBytes;
+    stats_.peakBytesInUse = std::max(stats_.peakBytesInUse, stats_.bytesInUse);
+    return buffer;
+  }
+
+  //! Return a buffer from acquire() to the pool
+  void release(const cl::Buffer& buffer)
+  {
+    std::map<cl_mem, size_t>::iterator it = sizes_.find(buffer());
+    if (it == sizes_.end())
+      throw cl::Error(CL_INVALID_MEM_OBJECT, "BufferPool: buffer not from this pool");
+
+    free_[it->second].push_back(buffer);
+    stats_.bytesInUse -= it->second;
+    sizes_.erase(it);
+  }
+
+  //! Size of the buffer acquire(bytes) would return
+  size_t sizeClass(size_t bytes) const
+  {
+    size_t classBytes = minClassBytes_;
+    while (classBytes < bytes)
+      classBytes *= 2;
+    return classBytes;
+  }
+
+  const BufferPoolStats& getStats() const { return stats_; }
+
+private:
+  struct Arena
+  {
+    cl::Buffer buffer;
+    size_t     used;
+  };
+
+  // A new sub-buffer from the first arena with room, reserving one if needed
+  cl::Buffer carve(size_t classBytes)
+  {
+    Arena *arena = NULL;
+    for (size_t a = 0; a < arenas_.size() && !arena; a++)
+      if (arenaBytes_ - arenas_[a].used >= classBytes)
+        arena = &arenas_[a];
+
+    if (!arena)
+    {
+      Arena fresh = { cl::Buffer(context_, flags_, arenaBytes_), 0 };
+      arenas_.push_back(fresh);
+      arena = &arenas_.back();
+      stats_.arenas++;
+      stats_.arenaBytes += arenaBytes_;
+    }
+
+    // Class sizes are multiples of the alignment, so every origin is aligned
+    cl_buffer_region region = { arena->used, classBytes };
+    cl_mem_flags access = flags_ & (CL_MEM_READ_WRITE | CL_MEM_READ_ONLY | CL_MEM_WRITE_ONLY);
+    cl::Buffer buffer = arena->buffer.createSubBuffer(access, CL_BUFFER_CREATE_TYPE_REGION,
+                                                      &region);
+    arena->used += classBytes;
+    stats_.subBuffers++;
+    return buffer;
+  }
+
+  // A copy would share the arenas but not know what the other handed out
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+
+  cl::Context                                context_;
+  size_t                                     arenaBytes_;
+  size_t                                     minClassBytes_;
+  cl_mem_flags                               flags_;
+  std::vector<Arena>                         arenas_;
+  std::map<size_t, std::vector<cl::Buffer> > free_;     // By size class
+  std::map<cl_mem, size_t>                   sizes_;    // Acquired, by handle
+  BufferPoolStats                            stats_;
+};
+
+} // namespace util
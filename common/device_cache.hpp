@@ -0,0 +1,203 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       device_cache.hpp
+ *
+ * Purpose:    Somewhere to keep results that are expensive to measure and
+ *             only change when the device or driver does.
+ *
+ *             cacheDirectory() is $OPENCL_CACHE_DIR if set, otherwise a
+ *             directory under the user's cache directory. deviceCacheKey()
+ *             names a device by its platform, name and driver version, so a
+ *             driver update invalidates anything cached for the old one.
+ *             Cache files are plain "key value" lines.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the TransferStrategy header for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+
+inline bool makeDirectory(const std::string& path)
+{
+#if defined(_WIN32)
+  return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+//! Directory for cached results, created if needed. Empty if there is none.
+inline std::string cacheDirectory()
+{
+  const char *dir = getenv("OPENCL_CACHE_DIR");
+  if (dir && *dir)
+    return makeDirectory(dir) ? dir : "";
+
+#if defined(_WIN32)
+  const char *base = getenv("LOCALAPPDATA");
+  if (!base)
+    return "";
+  std::string path = std::string(base) + "\\opencl-exercises";
+#else
+  std::string path;
+  const char *xdg  = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && *xdg)
+    path = xdg;
+  else if (home && *home)
+  {
+    path = std::string(home) + "/.cache";
+    makeDirectory(path);
+  }
+  else
+    return "";
+  path += "/opencl-exercises";
+#endif
+
+  return makeDirectory(path) ? path : "";
+}
+
+//! Name of this machine, for results that differ between hosts sharing a cache
+inline std::string hostName()
+{
+  std::string name;
+#if defined(_WIN32)
+  const char *computer = getenv("COMPUTERNAME");
+  if (computer)
+    name = computer;
+#else
+  char buffer[256];
+  if (gethostname(buffer, sizeof(buffer)) == 0)
+  {
+    buffer[sizeof(buffer) - 1] = '\0';
+    name = buffer;
+  }
+#endif
+
+  std::string safe;
+  for (size_t i = 0; i < name.size(); i++)
+    safe += (isalnum((unsigned char)name[i]) || name[i] == '-') ? name[i] : '_';
+  return safe.empty() ? "localhost" : safe;
+}
+
+//! File name safe key for a device and the driver it runs on
+inline std::string deviceCacheKey(const cl::Device& device)
+{
+  cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+  std::string id = platform.getInfo<CL_PLATFORM_NAME>() + "|" +
+                   platform.getInfo<CL_PLATFORM_VERSION>() + "|" +
+                   device.getInfo<CL_DEVICE_NAME>() + "|" +
+                   device.getInfo<CL_DEVICE_VERSION>() + "|" +
+                   device.getInfo<CL_DRIVER_VERSION>();
+
+  // FNV-1a
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < id.size(); i++)
+  {
+    hash ^= (unsigned char)id[i];
+    hash *= 1099511628211ULL;
+  }
+
+  // Readable prefix from the device name
+  std::string name;
+  std::string deviceName = device.getInfo<CL_DEVICE_NAME>();
+  for (size_t i = 0; i < deviceName.size() && name.size() < 24; i++)
+  {
+    char c = deviceName[i];
+    if (isalnum((unsigned char)c))
+      name += c;
+    else if (!name.empty() && name[name.size()-1] != '-')
+      name += '-';
+  }
+
+  std::ostringstream key;
+  key << name << (name.empty() ? "" : "-") << std::hex << hash;
+  return key.str();
+}
+
+//! Full path of a cache file, or empty if there is no cache directory
+inline std::string cacheFile(const std::string& name)
+{
+  std::string dir = cacheDirectory();
+  if (dir.empty())
+    return "";
+#if defined(_WIN32)
+  return dir + "\\" + name;
+#else
+  return dir + "/" + name;
+#endif
+}
+
+//! Read "key value" lines; the value is the rest of the line
+inline bool readCacheEntries(const std::string& path,
+                             std::map<std::string, std::string>& entries)
+{
+  std::ifstream file(path.c_str());
+  if (!file.is_open())
+    return false;
+
+  std::string line;
+  while (std::getline(file, line))
+  {
+    size_t space = line.find(' ');
+    if (space == std::string::npos)
+      continue;
+    entries[line.substr(0, space)] = line.substr(space + 1);
+  }
+  return true;
+}
+
+inline bool writeCacheEntries(const std::string& path,
+                              const std::map<std::string, std::string>& entries)
+{
+  if (path.empty())
+    return false;
+
+  // Write then rename, so a concurrent reader never sees half a file
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream file(tmp.c_str());
+    if (!file.is_open())
+      return false;
+    std::map<std::string, std::string>::const_iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it)
+      file << it->first << " " << it->second << "\n";
+    if (!file.good())
+      return false;
+  }
+#if defined(_WIN32)
+  remove(path.c_str());
+#endif
+  return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+} // namespace util
@@ -4,6 +4,12 @@
  *
  * Purpose:    Provide a simple CLI to specify an OpenCL device at runtime
  *
+ *             As in device_picker.hpp, a device is given by its index or as
+ *             "auto", which scores every device with short compute and
+ *             bandwidth probes and takes the best for the workload. The
+ *             scores are cached per host in the same file the C++ picker
+ *             uses, so C and C++ programs share them.
+ *
  * Note:       Must be included AFTER the relevant OpenCL header
  *             See one of the Matrix Multiply exercises for usage
  *
@@ -24,10 +30,22 @@
 #pragma once
 
 #include <err_code.h>
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <device_probe_source.h>
+
 #ifndef CL_DEVICE_BOARD_NAME_AMD
 #define CL_DEVICE_BOARD_NAME_AMD 0x4038
 #endif
@@ -35,6 +53,23 @@
 #define MAX_PLATFORMS     8
 #define MAX_DEVICES      16
 #define MAX_INFO_STRING 256
+#define MAX_PATH_STRING 1024
+
+// Device index for "--device all"
+#define DEVICE_ALL ((cl_uint)-1)
+
+// What "--device auto" ranks devices by
+typedef enum
+{
+  WORKLOAD_COMPUTE,   // FP32 FLOP/s
+  WORKLOAD_MEMORY     // Global memory bandwidth
+} DeviceWorkload;
+
+typedef struct
+{
+  double gflops;
+  double bandwidthGBs;
+} DeviceScore;
 
 
 unsigned getDeviceList(cl_device_id devices[MAX_DEVICES])
@@ -82,6 +117,358 @@ int parseUInt(const char *str, cl_uint *output)
   return !strlen(next);
 }
 
+int makeCacheDirectory(const char *path)
+{
+#if defined(_WIN32)
+  return _mkdir(path) == 0 || errno == EEXIST;
+#else
+  return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// The scores file of device_picker.hpp: in cacheDirectory() of
+// device_cache.hpp, named after the host. Returns 0 if there is no cache.
+int deviceScoresPath(char path[MAX_PATH_STRING])
+{
+  char dir[MAX_PATH_STRING];
+  const char *env = getenv("OPENCL_CACHE_DIR");
+  if (env && *env)
+  {
+    snprintf(dir, sizeof(dir), "%s", env);
+  }
+  else
+  {
+#if defined(_WIN32)
+    const char *base = getenv("LOCALAPPDATA");
+    if (!base)
+      return 0;
+    snprintf(dir, sizeof(dir), "%s\\opencl-exercises", base);
+#else
+    const char *xdg  = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && *xdg)
+    {
+      snprintf(dir, sizeof(dir), "%s/opencl-exercises", xdg);
+    }
+    else if (home && *home)
+    {
+      snprintf(dir, sizeof(dir), "%s/.cache", home);
+      makeCacheDirectory(dir);
+      snprintf(dir, sizeof(dir), "%s/.cache/opencl-exercises", home);
+    }
+    else
+    {
+      return 0;
+    }
+#endif
+  }
+  if (!makeCacheDirectory(dir))
+    return 0;
+
+  // As util::hostName()
+  char host[256] = "";
+#if defined(_WIN32)
+  const char *computer = getenv("COMPUTERNAME");
+  if (computer)
+    snprintf(host, sizeof(host), "%s", computer);
+#else
+  if (gethostname(host, sizeof(host)) != 0)
+    host[0] = '\0';
+  host[sizeof(host) - 1] = '\0';
+#endif
+  for (char *c = host; *c; c++)
+  {
+    if (!isalnum((unsigned char)*c) && *c != '-')
+      *c = '_';
+  }
+  if (!*host)
+    snprintf(host, sizeof(host), "localhost");
+
+#if defined(_WIN32)
+  snprintf(path, MAX_PATH_STRING, "%s\\device-scores-%s.txt", dir, host);
+#else
+  snprintf(path, MAX_PATH_STRING, "%s/device-scores-%s.txt", dir, host);
+#endif
+  return 1;
+}
+
+// Same key as util::deviceCacheKey(): a readable prefix of the device name
+// and an FNV-1a hash of the platform, device and driver versions
+void deviceCacheKey(cl_device_id device, char key[MAX_INFO_STRING])
+{
+  cl_platform_id platform;
+  clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+
+  char parts[5][MAX_PATH_STRING] = { "", "", "", "", "" };
+  clGetPlatformInfo(platform, CL_PLATFORM_NAME, MAX_PATH_STRING, parts[0], NULL);
+  clGetPlatformInfo(platform, CL_PLATFORM_VERSION, MAX_PATH_STRING, parts[1], NULL);
+  clGetDeviceInfo(device, CL_DEVICE_NAME, MAX_PATH_STRING, parts[2], NULL);
+  clGetDeviceInfo(device, CL_DEVICE_VERSION, MAX_PATH_STRING, parts[3], NULL);
+  clGetDeviceInfo(device, CL_DRIVER_VERSION, MAX_PATH_STRING, parts[4], NULL);
+
+  unsigned long long hash = 14695981039346656037ULL;
+  for (int p = 0; p < 5; p++)
+  {
+    if (p > 0)
+    {
+      hash ^= (unsigned char)'|';
+      hash *= 1099511628211ULL;
+    }
+    for (const char *c = parts[p]; *c; c++)
+    {
+      hash ^= (unsigned char)*c;
+      hash *= 1099511628211ULL;
+    }
+  }
+
+  char name[32];
+  size_t length = 0;
+  for (const char *c = parts[2]; *c && length < 24; c++)
+  {
+    if (isalnum((unsigned char)*c))
+      name[length++] = *c;
+    else if (length > 0 && name[length-1] != '-')
+      name[length++] = '-';
+  }
+  name[length] = '\0';
+
+  snprintf(key, MAX_INFO_STRING, "%s%s%llx", name, length ? "-" : "", hash);
+}
+
+size_t powerOfTwoBelow(size_t n)
+{
+  size_t p = 1;
+  while (p*2 <= n)
+    p *= 2;
+  return p;
+}
+
+// Best device time of a few runs after a warm-up, in seconds; 0 on failure
+double bestKernelSeconds(cl_command_queue queue, cl_kernel kernel,
+                         size_t global, const size_t *local)
+{
+  double best = 0.0;
+  for (int r = 0; r <= DEVICE_PROBE_REPS; r++)
+  {
+    cl_event event;
+    cl_ulong start = 0, end = 0;
+    if (clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, local,
+                               0, NULL, &event) != CL_SUCCESS)
+      return 0.0;
+    clWaitForEvents(1, &event);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    clReleaseEvent(event);
+
+    double t = (end - start) * 1e-9;
+    if (r > 0 && (best == 0.0 || t < best))
+      best = t;
+  }
+  return best;
+}
+
+// The FP32 and global bandwidth probes of util::probeThroughput(), with the
+// same kernels and sizes. Returns 0 if the device cannot run them.
+int probeThroughput(cl_device_id device, DeviceScore *score)
+{
+  cl_int           err;
+  int              ok       = 0;
+  cl_context       context  = NULL;
+  cl_command_queue queue    = NULL;
+  cl_program       flops    = NULL, bandwidth = NULL;
+  cl_kernel        fma      = NULL, copy = NULL;
+  cl_mem           out      = NULL, a = NULL, b = NULL;
+  cl_uint          computeUnits = 0;
+  cl_ulong         maxAlloc = 0;
+  size_t           maxWG = 1, wg = 1, localSize, global, bytes;
+  float            fa = 0.999f, fb = 0.001f, zero = 0.0f;
+  double           seconds;
+  char             options[128];
+
+  clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxWG), &maxWG, NULL);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+
+  context = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+
+  // FP32 FLOP/s from independent FMA chains
+  snprintf(options, sizeof(options), "-DREAL=float -DFMA_ITERATIONS=%d",
+           DEVICE_PROBE_FMA_ITERATIONS);
+  flops = clCreateProgramWithSource(context, 1, &device_probe_source, NULL, &err);
+  if (err != CL_SUCCESS || clBuildProgram(flops, 1, &device, options, NULL, NULL) != CL_SUCCESS)
+    goto done;
+  fma = clCreateKernel(flops, "fma_chains", &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  clGetKernelWorkGroupInfo(fma, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(wg), &wg, NULL);
+  wg     = powerOfTwoBelow(wg < 256 ? wg : 256);
+  global = computeUnits * wg * 16;
+  out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, global * sizeof(cl_double), NULL, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  clSetKernelArg(fma, 0, sizeof(cl_mem), &out);
+  clSetKernelArg(fma, 1, sizeof(float), &fa);
+  clSetKernelArg(fma, 2, sizeof(float), &fb);
+  seconds = bestKernelSeconds(queue, fma, global, &wg);
+  if (seconds <= 0.0)
+    goto done;
+  score->gflops = (double)global * DEVICE_PROBE_FMA_ITERATIONS * 8 * 2 / seconds * 1e-9;
+
+  // Global bandwidth: read plus write of a buffer well beyond any cache
+  localSize = powerOfTwoBelow(maxWG < 256 ? maxWG : 256);
+  snprintf(options, sizeof(options), "-DLOCAL_SIZE=%u -DLOCAL_ITERATIONS=%d",
+           (unsigned)localSize, DEVICE_PROBE_LOCAL_ITERATIONS);
+  bandwidth = clCreateProgramWithSource(context, 1, &device_probe_source, NULL, &err);
+  if (err != CL_SUCCESS ||
+      clBuildProgram(bandwidth, 1, &device, options, NULL, NULL) != CL_SUCCESS)
+    goto done;
+  copy = clCreateKernel(bandwidth, "copy", &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  bytes = 64*1024*1024;
+  if (maxAlloc / 2 < bytes)
+    bytes = (size_t)(maxAlloc / 2);
+  bytes -= bytes % (16 * localSize);
+  a = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  b = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+  if (err != CL_SUCCESS)
+    goto done;
+  clEnqueueFillBuffer(queue, a, &zero, sizeof(zero), 0, bytes, 0, NULL, NULL);
+  clSetKernelArg(copy, 0, sizeof(cl_mem), &a);
+  clSetKernelArg(copy, 1, sizeof(cl_mem), &b);
+  seconds = bestKernelSeconds(queue, copy, bytes / 16, NULL);
+  if (seconds <= 0.0)
+    goto done;
+  score->bandwidthGBs = 2.0 * bytes / seconds * 1e-9;
+  ok = 1;
+
+done:
+  if (b)         clReleaseMemObject(b);
+  if (a)         clReleaseMemObject(a);
+  if (out)       clReleaseMemObject(out);
+  if (copy)      clReleaseKernel(copy);
+  if (fma)       clReleaseKernel(fma);
+  if (bandwidth) clReleaseProgram(bandwidth);
+  if (flops)     clReleaseProgram(flops);
+  if (queue)     clReleaseCommandQueue(queue);
+  if (context)   clReleaseContext(context);
+  return ok;
+}
+
+// Measured throughput of device, probing it (and caching the result) if needed
+DeviceScore getDeviceScore(cl_device_id device)
+{
+  DeviceScore score = { 0.0, 0.0 };
+  char key[MAX_INFO_STRING], path[MAX_PATH_STRING], line[MAX_PATH_STRING];
+  int cache = deviceScoresPath(path);
+  deviceCacheKey(device, key);
+  size_t keyLength = strlen(key);
+
+  FILE *file = cache ? fopen(path, "r") : NULL;
+  if (file)
+  {
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), file))
+    {
+      found = !strncmp(line, key, keyLength) && line[keyLength] == ' ' &&
+              sscanf(line + keyLength + 1, "%lf %lf",
+                     &score.gflops, &score.bandwidthGBs) == 2;
+    }
+    fclose(file);
+    if (found)
+      return score;
+  }
+
+  // A device that cannot run the probes scores zero, and is tried again
+  // next time rather than cached
+  if (!probeThroughput(device, &score))
+  {
+    score.gflops = score.bandwidthGBs = 0.0;
+    return score;
+  }
+
+  // The C++ picker reads the file into a map, so a line added at the end
+  // is enough
+  file = cache ? fopen(path, "a") : NULL;
+  if (file)
+  {
+    fprintf(file, "%s %g %g\n", key, score.gflops, score.bandwidthGBs);
+    fclose(file);
+  }
+  return score;
+}
+
+// Index of the device best suited to workload, printing how each one scored
+cl_uint pickDevice(cl_device_id devices[], unsigned numDevices, DeviceWorkload workload)
+{
+  printf("\nScoring devices for a %s-bound workload:\n",
+         workload == WORKLOAD_MEMORY ? "memory" : "compute");
+
+  cl_uint best = 0;
+  double bestValue = -1;
+  for (unsigned i = 0; i < numDevices; i++)
+  {
+    DeviceScore score = getDeviceScore(devices[i]);
+    double value = workload == WORKLOAD_MEMORY ? score.bandwidthGBs : score.gflops;
+    if (value > bestValue)
+    {
+      best = i;
+      bestValue = value;
+    }
+
+    char name[MAX_INFO_STRING];
+    getDeviceName(devices[i], name);
+    printf("  %u: %10.1f GFLOP/s %8.1f GB/s  %s\n",
+           i, score.gflops, score.bandwidthGBs, name);
+  }
+
+  printf("Picked device %u\n\n", best);
+  return best;
+}
+
+// Parse a device given as an index, "all" (DEVICE_ALL) or "auto". The
+// workload for "auto" is "auto:compute" or "auto:memory" if given, then
+// $OPENCL_WORKLOAD, then the program's own hint.
+int parseDeviceIndex(const char *str, cl_uint *deviceIndex, DeviceWorkload workload)
+{
+  if (!strcmp(str, "all"))
+  {
+    *deviceIndex = DEVICE_ALL;
+    return 1;
+  }
+  if (strncmp(str, "auto", 4))
+    return parseUInt(str, deviceIndex);
+
+  const char *hint = str + 4;
+  if (*hint == ':')
+    hint++;
+  else if (*hint)
+    return 0;
+  else if (getenv("OPENCL_WORKLOAD"))
+    hint = getenv("OPENCL_WORKLOAD");
+
+  if (!strcmp(hint, "compute"))
+    workload = WORKLOAD_COMPUTE;
+  else if (!strcmp(hint, "memory"))
+    workload = WORKLOAD_MEMORY;
+  else if (str[4] == ':')
+    return 0;
+
+  cl_device_id devices[MAX_DEVICES];
+  unsigned numDevices = getDeviceList(devices);
+  if (numDevices == 0)
+    return 0;
+  *deviceIndex = pickDevice(devices, numDevices, workload);
+  return 1;
+}
+
 void parseArgumentsGeneric(int argc, char *argv[], cl_uint *deviceIndex)
 {
   for (int i = 1; i < argc; i++)
@@ -112,7 +499,9 @@ void parseArgumentsGeneric(int argc, char *argv[], cl_uint *deviceIndex)
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], deviceIndex))
+      // These programs use a single device, so "all" is not accepted
+      if (++i >= argc || !parseDeviceIndex(argv[i], deviceIndex, WORKLOAD_COMPUTE) ||
+          *deviceIndex == DEVICE_ALL)
       {
         printf("Invalid device index\n");
         exit(1);
@@ -125,7 +514,9 @@ void parseArgumentsGeneric(int argc, char *argv[], cl_uint *deviceIndex)
       printf("Options:\n");
       printf("  -h  --help               Print this message\n");
       printf("      --list               List available devices\n");
-      printf("      --device     INDEX   Select device at INDEX\n");
+      printf("      --device     INDEX   Select device at INDEX, or 'auto' to\n");
+      printf("                           pick the fastest ('auto:memory' for\n");
+      printf("                           bandwidth-bound programs)\n");
       printf("\n");
       exit(0);
     }
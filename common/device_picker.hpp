@@ -4,6 +4,13 @@
  *
  * Purpose:    Provide a simple CLI to specify an OpenCL device at runtime
  *
+ *             A device is given by its index in the enumeration order, which
+ *             differs between machines, or as "auto", which scores every
+ *             device with short compute and bandwidth probes and takes the
+ *             best for the workload. Scores are cached per host, so only the
+ *             first run on a machine pays for the probes. "all" selects every
+ *             device, for programs that can use several.
+ *
  * Note:       Must be included AFTER the relevant OpenCL header
  *             See one of the Matrix Multiply exercises for usage
  *
@@ -23,16 +30,40 @@
 
 #pragma once
 
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <err_code.h>
 #include <iostream>
 
+#include <device_probe.hpp>
+
 #ifndef CL_DEVICE_BOARD_NAME_AMD
 #define CL_DEVICE_BOARD_NAME_AMD 0x4038
 #endif
 
 #define MAX_INFO_STRING 256
 
+// Device index for "--device all"
+#define DEVICE_ALL ((cl_uint)-1)
+
+// What "--device auto" ranks devices by
+enum DeviceWorkload
+{
+  WORKLOAD_COMPUTE,   // FP32 FLOP/s
+  WORKLOAD_MEMORY     // Global memory bandwidth
+};
+
+struct DeviceScore
+{
+  double gflops;
+  double bandwidthGBs;
+};
+
 
 unsigned getDeviceList(std::vector<cl::Device>& devices)
 {
@@ -75,6 +106,127 @@ int parseUInt(const char *str, cl_uint *output)
   return !strlen(next);
 }
 
+// Scores are kept per host: machines sharing a home directory may have the
+// same devices in different slots, clocks or thermal conditions
+std::string deviceScoresPath()
+{
+  return util::cacheFile("device-scores-" + util::hostName() + ".txt");
+}
+
+// Measured throughput of device, probing it (and caching the result) if needed
+DeviceScore getDeviceScore(const cl::Device& device)
+{
+  DeviceScore score = { 0, 0 };
+  std::string key = util::deviceCacheKey(device);
+  std::string path = deviceScoresPath();
+
+  std::map<std::string, std::string> scores;
+  util::readCacheEntries(path, scores);
+  std::map<std::string, std::string>::iterator it = scores.find(key);
+  if (it != scores.end())
+  {
+    std::istringstream in(it->second);
+    if (in >> score.gflops >> score.bandwidthGBs)
+      return score;
+  }
+
+  // A device that cannot run the probes scores zero, and is tried again
+  // next time rather than cached
+  try
+  {
+    cl::Context context(device);
+    util::probeThroughput(context, device, &score.gflops, &score.bandwidthGBs);
+  }
+  catch (cl::Error&)
+  {
+    score.gflops = score.bandwidthGBs = 0;
+    return score;
+  }
+
+  std::ostringstream value;
+  value << score.gflops << " " << score.bandwidthGBs;
+  scores[key] = value.str();
+  util::writeCacheEntries(path, scores);
+  return score;
+}
+
+// Index of the device best suited to workload, printing how each one scored
+cl_uint pickDevice(const std::vector<cl::Device>& devices, DeviceWorkload workload)
+{
+  std::cout << "\nScoring devices for a "
+            << (workload == WORKLOAD_MEMORY ? "memory" : "compute") << "-bound workload:\n";
+
+  cl_uint best = 0;
+  double bestValue = -1;
+  for (unsigned int i = 0; i < devices.size(); i++)
+  {
+    DeviceScore score = getDeviceScore(devices[i]);
+    double value = workload == WORKLOAD_MEMORY ? score.bandwidthGBs : score.gflops;
+    if (value > bestValue)
+    {
+      best = i;
+      bestValue = value;
+    }
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1)
+         << std::setw(10) << score.gflops << " GFLOP/s "
+         << std::setw(8) << score.bandwidthGBs << " GB/s";
+    std::cout << "  " << i << ": " << line.str() << "  " << getDeviceName(devices[i]) << "\n";
+  }
+
+  std::cout << "Picked device " << best << "\n\n";
+  return best;
+}
+
+// Parse a device given as an index, "all" (DEVICE_ALL) or "auto". The
+// workload for "auto" is "auto:compute" or "auto:memory" if given, then
+// $OPENCL_WORKLOAD, then the program's own hint.
+int parseDeviceIndex(const char *str, cl_uint *deviceIndex,
+                     DeviceWorkload workload = WORKLOAD_COMPUTE)
+{
+  if (!strcmp(str, "all"))
+  {
+    *deviceIndex = DEVICE_ALL;
+    return 1;
+  }
+  if (strncmp(str, "auto", 4))
+    return parseUInt(str, deviceIndex);
+
+  const char *hint = str + 4;
+  if (*hint == ':')
+    hint++;
+  else if (*hint)
+    return 0;
+  else if (getenv("OPENCL_WORKLOAD"))
+    hint = getenv("OPENCL_WORKLOAD");
+
+  if (!strcmp(hint, "compute"))
+    workload = WORKLOAD_COMPUTE;
+  else if (!strcmp(hint, "memory"))
+    workload = WORKLOAD_MEMORY;
+  else if (str[4] == ':')
+    return 0;
+
+  std::vector<cl::Device> devices;
+  if (getDeviceList(devices) == 0)
+    return 0;
+  *deviceIndex = pickDevice(devices, workload);
+  return 1;
+}
+
+// The devices deviceIndex selects: one, or every device for DEVICE_ALL.
+// Empty if the index is out of range.
+std::vector<cl::Device> getSelectedDevices(const std::vector<cl::Device>& devices,
+                                           cl_uint deviceIndex)
+{
+  if (deviceIndex == DEVICE_ALL)
+    return devices;
+  if (deviceIndex >= devices.size())
+    return std::vector<cl::Device>();
+  return std::vector<cl::Device>(1, devices[deviceIndex]);
+}
+
 void parseArguments(int argc, char *argv[], cl_uint *deviceIndex)
 {
   for (int i = 1; i < argc; i++)
@@ -103,7 +255,9 @@ void parseArguments(int argc, char *argv[], cl_uint *deviceIndex)
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], deviceIndex))
+      // These programs use a single device, so "all" is not accepted
+      if (++i >= argc || !parseDeviceIndex(argv[i], deviceIndex) ||
+          *deviceIndex == DEVICE_ALL)
       {
         std::cout << "Invalid device index\n";
         exit(1);
@@ -116,7 +270,9 @@ void parseArguments(int argc, char *argv[], cl_uint *deviceIndex)
       std::cout << "Options:\n";
       std::cout << "  -h  --help               Print the message\n";
       std::cout << "      --list               List available devices\n";
-      std::cout << "      --device     INDEX   Select device at INDEX\n";
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto' to\n";
+      std::cout << "                           pick the fastest ('auto:memory' for\n";
+      std::cout << "                           bandwidth-bound programs)\n";
       std::cout << "\n";
       exit(0);
     }
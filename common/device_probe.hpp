@@ -0,0 +1,405 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       device_probe.hpp
+ *
+ * Purpose:    Measure what a device can actually do, as opposed to what it
+ *             reports about itself, and keep the result as a JSON profile.
+ *
+ *             probeDevice() runs a set of micro-benchmarks:
+ *               - FP32, FP64 and FP16 FLOP/s from independent FMA chains
+ *                 (FP64/FP16 only where the extension is supported)
+ *               - global memory bandwidth from a float4 copy
+ *               - local memory bandwidth from repeated local reads
+ *               - contended and uncontended global atomic throughput
+ *               - launch latency of an empty kernel
+ *             probeThroughput() runs just the FP32 and global bandwidth
+ *             probes, for comparing devices quickly (see device_picker.hpp).
+ *
+ *             Profiles are saved in the device cache (see device_cache.hpp)
+ *             so that other tools can use them as ceilings without running
+ *             the probes again.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the DeviceInfo exercise for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <util.hpp>
+#include <device_cache.hpp>
+#include <json.hpp>
+#include <device_probe_source.h>
+
+namespace util {
+
+struct DeviceProfile
+{
+  std::string key;            // deviceCacheKey()
+  std::string name;
+  std::string platform;
+  std::string driver;
+  std::string type;           // "GPU", "CPU", "ACCELERATOR" or "OTHER"
+  unsigned    computeUnits;
+  unsigned    clockMHz;
+  double      globalMemBytes;
+  double      localMemBytes;
+  bool        hostUnifiedMemory;
+
+  // Measured; zero where unsupported
+  double      fp32Gflops;
+  double      fp64Gflops;
+  double      fp16Gflops;
+  double      globalBandwidthGBs;
+  double      localBandwidthGBs;
+  double      atomicContendedGops;
+  double      atomicDistributedGops;
+  double      launchLatencyUs;
+
+  DeviceProfile()
+    : computeUnits(0), clockMHz(0), globalMemBytes(0), localMemBytes(0),
+      hostUnifiedMemory(false), fp32Gflops(0), fp64Gflops(0), fp16Gflops(0),
+      globalBandwidthGBs(0), localBandwidthGBs(0), atomicContendedGops(0),
+      atomicDistributedGops(0), launchLatencyUs(0)
+  {
+  }
+};
+
+namespace detail {
+
+const unsigned PROBE_REPS        = DEVICE_PROBE_REPS;
+const unsigned FMA_ITERATIONS    = DEVICE_PROBE_FMA_ITERATIONS;
+const unsigned LOCAL_ITERATIONS  = DEVICE_PROBE_LOCAL_ITERATIONS;
+
+inline bool hasExtension(const cl::Device& device, const char *name)
+{
+  return device.getInfo<CL_DEVICE_EXTENSIONS>().find(name) != std::string::npos;
+}
+
+// Best device time of a few runs, in seconds, from profiling events
+inline double bestKernelTime(cl::CommandQueue& queue, cl::Kernel& kernel,
+                             const cl::NDRange& global, const cl::NDRange& local)
+{
+  double best = 1e30;
+  for (unsigned r = 0; r <= PROBE_REPS; r++)
+  {
+    cl::Event event;
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, NULL, &event);
+    event.wait();
+    double t = (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-9;
+    // The first run is a warm-up
+    if (r > 0)
+      best = std::min(best, t);
+  }
+  return best;
+}
+
+inline size_t powerOfTwoBelow(size_t n)
+{
+  size_t p = 1;
+  while (p*2 <= n)
+    p *= 2;
+  return p;
+}
+
+inline double probeFlops(const cl::Context& context, const cl::Device& device,
+                         cl::CommandQueue& queue, const char *real,
+                         const char *define)
+{
+  std::ostringstream options;
+  options << "-DREAL=" << real << " -DFMA_ITERATIONS=" << FMA_ITERATIONS;
+  if (define)
+    options << " -D" << define;
+
+  cl::Program program(context, device_probe_source);
+  program.build(std::vector<cl::Device>(1, device), options.str().c_str());
+  cl::Kernel kernel(program, "fma_chains");
+
+  size_t wg = std::min((size_t)256,
+    kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+  wg = powerOfTwoBelow(wg);
+  size_t global = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * wg * 16;
+
+  cl::Buffer out(context, CL_MEM_WRITE_ONLY, global * sizeof(cl_double));
+  kernel.setArg(0, out);
+  kernel.setArg(1, 0.999f);
+  kernel.setArg(2, 0.001f);
+
+  double seconds = bestKernelTime(queue, kernel, cl::NDRange(global), cl::NDRange(wg));
+  return (double)global * FMA_ITERATIONS * 8 * 2 / seconds * 1e-9;
+}
+
+// Global bandwidth: read plus write of a buffer well beyond any cache
+inline double probeBandwidth(const cl::Context& context, const cl::Device& device,
+                             cl::CommandQueue& queue, const cl::Program& program,
+                             size_t localSize)
+{
+  size_t bytes = std::min((size_t)64*1024*1024,
+                          (size_t)device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / 2);
+  bytes -= bytes % (16 * localSize);
+  cl::Buffer a(context, CL_MEM_READ_WRITE, bytes);
+  cl::Buffer b(context, CL_MEM_READ_WRITE, bytes);
+  queue.enqueueFillBuffer(a, 0.0f, 0, bytes);
+  cl::Kernel copy(program, "copy");
+  copy.setArg(0, a);
+  copy.setArg(1, b);
+  double seconds = bestKernelTime(queue, copy, cl::NDRange(bytes / 16), cl::NullRange);
+  return 2.0 * bytes / seconds * 1e-9;
+}
+
+inline cl::Program buildProbeProgram(const cl::Context& context, const cl::Device& device,
+                                     size_t localSize)
+{
+  std::ostringstream options;
+  options << "-DLOCAL_SIZE=" << localSize << " -DLOCAL_ITERATIONS=" << LOCAL_ITERATIONS;
+  cl::Program program(context, device_probe_source);
+  program.build(std::vector<cl::Device>(1, device), options.str().c_str());
+  return program;
+}
+
+} // namespace detail
+
+//! Only the FP32 and global bandwidth probes; well under a second
+inline void probeThroughput(const cl::Context& context, const cl::Device& device,
+                            double *fp32Gflops, double *globalBandwidthGBs)
+{
+  using namespace detail;
+
+  cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+  *fp32Gflops = probeFlops(context, device, queue, "float", NULL);
+
+  size_t maxWG     = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+  size_t localSize = powerOfTwoBelow(std::min((size_t)256, maxWG));
+  cl::Program program = buildProbeProgram(context, device, localSize);
+  *globalBandwidthGBs = probeBandwidth(context, device, queue, program, localSize);
+}
+
+//! Run every probe on device. Takes a few seconds.
+inline DeviceProfile probeDevice(const cl::Context& context, const cl::Device& device)
+{
+  using namespace detail;
+
+  DeviceProfile p;
+  cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+  cl_device_type type = device.getInfo<CL_DEVICE_TYPE>();
+  p.key               = deviceCacheKey(device);
+  p.name              = device.getInfo<CL_DEVICE_NAME>();
+  p.platform          = platform.getInfo<CL_PLATFORM_NAME>();
+  p.driver            = device.getInfo<CL_DRIVER_VERSION>();
+  p.type              = (type & CL_DEVICE_TYPE_GPU) ? "GPU" :
+                        (type & CL_DEVICE_TYPE_CPU) ? "CPU" :
+                        (type & CL_DEVICE_TYPE_ACCELERATOR) ? "ACCELERATOR" : "OTHER";
+  p.computeUnits      = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+  p.clockMHz          = device.getInfo<CL_DEVICE_MAX_CLOCK_FREQUENCY>();
+  p.globalMemBytes    = (double)device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+  p.localMemBytes     = (double)device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+  p.hostUnifiedMemory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() != 0;
+
+  cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+  p.fp32Gflops = probeFlops(context, device, queue, "float", NULL);
+
+  // Some drivers advertise an extension they cannot compile; treat that
+  // the same as not supporting it
+  try
+  {
+    if (hasExtension(device, "cl_khr_fp64"))
+      p.fp64Gflops = probeFlops(context, device, queue, "double", "USE_FP64");
+  }
+  catch (cl::Error&) {}
+  try
+  {
+    if (hasExtension(device, "cl_khr_fp16"))
+      p.fp16Gflops = probeFlops(context, device, queue, "half", "USE_FP16");
+  }
+  catch (cl::Error&) {}
+
+  size_t maxWG     = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+  size_t localSize = powerOfTwoBelow(std::min((size_t)256, maxWG));
+
+  cl::Program program = buildProbeProgram(context, device, localSize);
+
+  p.globalBandwidthGBs = probeBandwidth(context, device, queue, program, localSize);
+
+  // Local bandwidth. The kernel may allow less than the device maximum,
+  // and LOCAL_SIZE sizes its local array, so rebuild it to fit if so.
+  {
+    cl::Kernel localRead(program, "local_read");
+    size_t readSize = localSize;
+    size_t kernelWG = localRead.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    if (kernelWG < readSize)
+    {
+      readSize  = powerOfTwoBelow(kernelWG);
+      localRead = cl::Kernel(buildProbeProgram(context, device, readSize), "local_read");
+    }
+
+    size_t global = p.computeUnits * readSize * 16;
+    cl::Buffer out(context, CL_MEM_WRITE_ONLY, global * sizeof(cl_float));
+    localRead.setArg(0, out);
+    double seconds = bestKernelTime(queue, localRead, cl::NDRange(global),
+                                    cl::NDRange(readSize));
+    p.localBandwidthGBs = (double)global * LOCAL_ITERATIONS * sizeof(cl_float)
+                        / seconds * 1e-9;
+  }
+
+  // Atomics: every work-item on one counter, then each on its own
+  {
+    size_t global = 1024*1024;
+    cl::Buffer counters(context, CL_MEM_READ_WRITE, global * sizeof(cl_int));
+    queue.enqueueFillBuffer(counters, (cl_int)0, 0, global * sizeof(cl_int));
+    cl::Kernel atomics(program, "atomics");
+    atomics.setArg(0, counters);
+
+    atomics.setArg(1, (cl_uint)0);
+    p.atomicContendedGops = global / bestKernelTime(queue, atomics, cl::NDRange(global),
+                                                    cl::NullRange) * 1e-9;
+    atomics.setArg(1, (cl_uint)(global - 1));
+    p.atomicDistributedGops = global / bestKernelTime(queue, atomics, cl::NDRange(global),
+                                                      cl::NullRange) * 1e-9;
+  }
+
+  // Launch latency: enqueue to completion of an empty kernel, host clock
+  {
+    cl::Buffer unused(context, CL_MEM_READ_WRITE, sizeof(cl_int));
+    cl::Kernel empty(program, "empty");
+    empty.setArg(0, unused);
+    cl::CommandQueue plain(context, device);
+    Timer timer;
+    const unsigned launches = 100;
+    plain.enqueueNDRangeKernel(empty, cl::NullRange, cl::NDRange(1), cl::NullRange);
+    plain.finish();
+    uint64_t start = timer.getTimeNanoseconds();
+    for (unsigned i = 0; i < launches; i++)
+    {
+      plain.enqueueNDRangeKernel(empty, cl::NullRange, cl::NDRange(1), cl::NullRange);
+      plain.finish();
+    }
+    p.launchLatencyUs = (timer.getTimeNanoseconds() - start) * 1e-3 / launches;
+  }
+
+  return p;
+}
+
+inline void writeDeviceProfile(std::ostream& out, const DeviceProfile& p)
+{
+  using detail::jsonString;
+  out << std::setprecision(6);
+  out << "{\n"
+      << "  \"key\": "                     << jsonString(p.key)      << ",\n"
+      << "  \"name\": "                    << jsonString(p.name)     << ",\n"
+      << "  \"platform\": "                << jsonString(p.platform) << ",\n"
+      << "  \"driver\": "                  << jsonString(p.driver)   << ",\n"
+      << "  \"type\": "                    << jsonString(p.type)     << ",\n"
+      << "  \"compute_units\": "           << p.computeUnits         << ",\n"
+      << "  \"clock_mhz\": "               << p.clockMHz             << ",\n"
+      << "  \"global_mem_bytes\": "        << std::fixed << std::setprecision(0)
+                                           << p.globalMemBytes       << ",\n"
+      << "  \"local_mem_bytes\": "         << p.localMemBytes        << ",\n"
+      << std::setprecision(3)
+      << "  \"host_unified_memory\": "     << (p.hostUnifiedMemory ? "true" : "false") << ",\n"
+      << "  \"fp32_gflops\": "             << p.fp32Gflops           << ",\n"
+      << "  \"fp64_gflops\": "             << p.fp64Gflops           << ",\n"
+      << "  \"fp16_gflops\": "             << p.fp16Gflops           << ",\n"
+      << "  \"global_bandwidth_gbs\": "    << p.globalBandwidthGBs   << ",\n"
+      << "  \"local_bandwidth_gbs\": "     << p.localBandwidthGBs    << ",\n"
+      << "  \"atomic_contended_gops\": "   << p.atomicContendedGops  << ",\n"
+      << "  \"atomic_distributed_gops\": " << p.atomicDistributedGops << ",\n"
+      << "  \"launch_latency_us\": "       << p.launchLatencyUs      << "\n"
+      << "}\n";
+  out.unsetf(std::ios::floatfield);
+}
+
+inline bool readDeviceProfile(std::istream& in, DeviceProfile& p)
+{
+  using detail::jsonField;
+  std::string text((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  if (jsonField(text, "key").empty() || jsonField(text, "fp32_gflops").empty())
+    return false;
+
+  p.key                   = jsonField(text, "key");
+  p.name                  = jsonField(text, "name");
+  p.platform              = jsonField(text, "platform");
+  p.driver                = jsonField(text, "driver");
+  p.type                  = jsonField(text, "type");
+  p.computeUnits          = atoi(jsonField(text, "compute_units").c_str());
+  p.clockMHz              = atoi(jsonField(text, "clock_mhz").c_str());
+  p.globalMemBytes        = atof(jsonField(text, "global_mem_bytes").c_str());
+  p.localMemBytes         = atof(jsonField(text, "local_mem_bytes").c_str());
+  p.hostUnifiedMemory     = jsonField(text, "host_unified_memory") == "true";
+  p.fp32Gflops            = atof(jsonField(text, "fp32_gflops").c_str());
+  p.fp64Gflops            = atof(jsonField(text, "fp64_gflops").c_str());
+  p.fp16Gflops            = atof(jsonField(text, "fp16_gflops").c_str());
+  p.globalBandwidthGBs    = atof(jsonField(text, "global_bandwidth_gbs").c_str());
+  p.localBandwidthGBs     = atof(jsonField(text, "local_bandwidth_gbs").c_str());
+  p.atomicContendedGops   = atof(jsonField(text, "atomic_contended_gops").c_str());
+  p.atomicDistributedGops = atof(jsonField(text, "atomic_distributed_gops").c_str());
+  p.launchLatencyUs       = atof(jsonField(text, "launch_latency_us").c_str());
+  return true;
+}
+
+//! Location of the cached profile for a device key
+inline std::string deviceProfilePath(const std::string& key)
+{
+  return cacheFile("profile-" + key + ".json");
+}
+
+inline bool saveDeviceProfile(const DeviceProfile& p)
+{
+  std::string path = deviceProfilePath(p.key);
+  if (path.empty())
+    return false;
+
+  // Write then rename, as writeCacheEntries does
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp.c_str());
+    if (!out.is_open())
+      return false;
+    writeDeviceProfile(out, p);
+    if (!out.good())
+      return false;
+  }
+#if defined(_WIN32)
+  remove(path.c_str());
+#endif
+  return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+//! Cached profile for device, probing (and caching) it if there is none
+inline DeviceProfile loadDeviceProfile(const cl::Device& device, bool probe = true)
+{
+  DeviceProfile p;
+  std::string path = deviceProfilePath(deviceCacheKey(device));
+  std::ifstream in(path.c_str());
+  if (!path.empty() && in.is_open() && readDeviceProfile(in, p))
+    return p;
+  if (!probe)
+    return DeviceProfile();
+
+  cl::Context context(device);
+  p = probeDevice(context, device);
+  saveDeviceProfile(p);
+  return p;
+}
+
+} // namespace util
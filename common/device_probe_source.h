@@ -0,0 +1,81 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       device_probe_source.h
+ *
+ * Purpose:    OpenCL C source and sizes of the device probes.
+ *
+ *             Shared by device_probe.hpp and the C device picker
+ *             (device_picker.h), so that C and C++ programs measure the same
+ *             thing and can share the scores cached by "--device auto".
+ *
+ * Note:       Plain C, so it can be included from either language
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#define DEVICE_PROBE_REPS              5
+#define DEVICE_PROBE_FMA_ITERATIONS    512
+#define DEVICE_PROBE_LOCAL_ITERATIONS  1024
+
+static const char *device_probe_source =
+  "#if defined(USE_FP64)\n"
+  "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+  "#endif\n"
+  "#if defined(USE_FP16)\n"
+  "#pragma OPENCL EXTENSION cl_khr_fp16 : enable\n"
+  "#endif\n"
+  "\n"
+  "#if defined(REAL)\n"
+  "// Eight independent chains so that FMA latency is hidden\n"
+  "kernel void fma_chains(global REAL *out, float fa, float fb)\n"
+  "{\n"
+  "  REAL a = (REAL)fa, b = (REAL)fb;\n"
+  "  REAL x0 = (REAL)get_local_id(0), x1 = x0 + (REAL)1, x2 = x0 + (REAL)2,\n"
+  "       x3 = x0 + (REAL)3,          x4 = x0 + (REAL)4, x5 = x0 + (REAL)5,\n"
+  "       x6 = x0 + (REAL)6,          x7 = x0 + (REAL)7;\n"
+  "  for (int i = 0; i < FMA_ITERATIONS; i++)\n"
+  "  {\n"
+  "    x0 = fma(x0, a, b); x1 = fma(x1, a, b); x2 = fma(x2, a, b); x3 = fma(x3, a, b);\n"
+  "    x4 = fma(x4, a, b); x5 = fma(x5, a, b); x6 = fma(x6, a, b); x7 = fma(x7, a, b);\n"
+  "  }\n"
+  "  out[get_global_id(0)] = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;\n"
+  "}\n"
+  "#else\n"
+  "kernel void copy(global const float4 *a, global float4 *b)\n"
+  "{\n"
+  "  size_t i = get_global_id(0);\n"
+  "  b[i] = a[i];\n"
+  "}\n"
+  "\n"
+  "kernel void local_read(global float *out)\n"
+  "{\n"
+  "  local float buf[LOCAL_SIZE];\n"
+  "  uint lid = get_local_id(0);\n"
+  "  buf[lid] = (float)lid;\n"
+  "  barrier(CLK_LOCAL_MEM_FENCE);\n"
+  "\n"
+  "  float sum = 0.0f;\n"
+  "  for (uint i = 0; i < LOCAL_ITERATIONS; i++)\n"
+  "    sum += buf[(lid + i) & (LOCAL_SIZE - 1)];\n"
+  "  out[get_global_id(0)] = sum;\n"
+  "}\n"
+  "\n"
+  "kernel void atomics(global int *counters, uint mask)\n"
+  "{\n"
+  "  atomic_add(&counters[get_global_id(0) & mask], 1);\n"
+  "}\n"
+  "\n"
+  "kernel void empty(global int *unused)\n"
+  "{\n"
+  "}\n"
+  "#endif\n";
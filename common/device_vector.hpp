@@ -0,0 +1,258 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       device_vector.hpp
+ *
+ * Purpose:    A vector with a host copy and a device copy that only
+ *             transfers data when the side being accessed is out of date.
+ *
+ *             Host and device accessors are split into read, write and
+ *             discard variants so that the vector knows which side becomes
+ *             stale. On devices with host-unified memory the buffer is
+ *             mapped for host access instead of being copied.
+ *
+ *             Kernels that use the device buffer must be enqueued on the
+ *             same in-order queue that the vector was created with.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the VAdd_Chain solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace util {
+
+struct TransferCounters
+{
+  size_t bytesToDevice;
+  size_t bytesToHost;
+  size_t bytesMapped;   // accessed in place on host-unified devices
+  size_t transfers;
+};
+
+//! Totals over every DeviceVector in the program
+inline TransferCounters& deviceVectorTotals()
+{
+  static TransferCounters totals = { 0, 0, 0, 0 };
+  return totals;
+}
+
+template <typename T>
+class DeviceVector
+{
+public:
+  DeviceVector(const cl::Context& context, const cl::CommandQueue& queue,
+               size_t size, cl_mem_flags flags = CL_MEM_READ_WRITE)
+    : queue_(queue), size_(size), mapped_(NULL)
+  {
+    init(context, flags);
+  }
+
+  template <typename InputIt>
+  DeviceVector(const cl::Context& context, const cl::CommandQueue& queue,
+               InputIt begin, InputIt end, cl_mem_flags flags = CL_MEM_READ_WRITE)
+    : queue_(queue), size_(std::distance(begin, end)), mapped_(NULL)
+  {
+    init(context, flags);
+    std::copy(begin, end, hostWrite());
+  }
+
+  ~DeviceVector()
+  {
+    try
+    {
+      if (mapped_)
+        unmap();
+      waitUpload();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  size_t size() const { return size_; }
+  bool   isUnified() const { return unified_; }
+
+  //! Host pointer for reading; copies from the device if it holds newer data
+  const T* hostRead()
+  {
+    syncHost();
+    return hostPointer();
+  }
+
+  //! Host pointer for reading and writing; the device copy becomes stale
+  T* hostWrite()
+  {
+    syncHost();
+    deviceValid_ = unified_;
+    return hostPointer();
+  }
+
+  //! Host pointer whose contents will be overwritten; nothing is copied
+  T* hostDiscard()
+  {
+    if (unified_)
+      map();
+    waitUpload();
+    hostValid_   = true;
+    deviceValid_ = unified_;
+    return hostPointer();
+  }
+
+  //! Device buffer for reading; copies from the host if it holds newer data
+  const cl::Buffer& deviceRead()
+  {
+    syncDevice();
+    return buffer_;
+  }
+
+  //! Device buffer for reading and writing; the host copy becomes stale
+  cl::Buffer& deviceWrite()
+  {
+    syncDevice();
+    hostValid_ = unified_;
+    return buffer_;
+  }
+
+  //! Device buffer whose contents will be overwritten; nothing is copied
+  cl::Buffer& deviceDiscard()
+  {
+    if (mapped_)
+      unmap();
+    deviceValid_ = true;
+    hostValid_   = unified_;
+    return buffer_;
+  }
+
+  const TransferCounters& getCounters() const
+  {
+    return counters_;
+  }
+
+private:
+  void init(const cl::Context& context, cl_mem_flags flags)
+  {
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    unified_ = devices[0].getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+
+    if (unified_)
+      flags |= CL_MEM_ALLOC_HOST_PTR;
+    else
+      host_.resize(size_);
+    buffer_ = cl::Buffer(context, flags, std::max((size_t)1, size_) * sizeof(T));
+
+    // Neither side holds anything meaningful yet
+    hostValid_   = true;
+    deviceValid_ = true;
+
+    counters_.bytesToDevice = 0;
+    counters_.bytesToHost   = 0;
+    counters_.bytesMapped   = 0;
+    counters_.transfers     = 0;
+  }
+
+  T* hostPointer()
+  {
+    return unified_ ? mapped_ : (size_ ? &host_[0] : NULL);
+  }
+
+  void syncHost()
+  {
+    if (unified_)
+    {
+      map();
+      return;
+    }
+
+    if (!hostValid_)
+    {
+      queue_.enqueueReadBuffer(buffer_, CL_TRUE, 0, size_*sizeof(T), &host_[0]);
+      count(counters_.bytesToHost, deviceVectorTotals().bytesToHost);
+      hostValid_ = true;
+    }
+    waitUpload();
+  }
+
+  void syncDevice()
+  {
+    if (unified_)
+    {
+      if (mapped_)
+        unmap();
+      return;
+    }
+
+    if (!deviceValid_)
+    {
+      // The upload is left in flight; host writes wait for it to finish
+      queue_.enqueueWriteBuffer(buffer_, CL_FALSE, 0, size_*sizeof(T),
+                                &host_[0], NULL, &upload_);
+      count(counters_.bytesToDevice, deviceVectorTotals().bytesToDevice);
+      deviceValid_ = true;
+    }
+  }
+
+  void map()
+  {
+    if (mapped_)
+      return;
+    mapped_ = (T*)queue_.enqueueMapBuffer(buffer_, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE,
+                                          0, std::max((size_t)1, size_)*sizeof(T));
+    counters_.bytesMapped += size_*sizeof(T);
+    deviceVectorTotals().bytesMapped += size_*sizeof(T);
+  }
+
+  void unmap()
+  {
+    queue_.enqueueUnmapMemObject(buffer_, mapped_);
+    mapped_ = NULL;
+  }
+
+  void waitUpload()
+  {
+    if (upload_())
+    {
+      upload_.wait();
+      upload_ = cl::Event();
+    }
+  }
+
+  void count(size_t& mine, size_t& total)
+  {
+    mine  += size_*sizeof(T);
+    total += size_*sizeof(T);
+    counters_.transfers++;
+    deviceVectorTotals().transfers++;
+  }
+
+  // Copying would leave two objects that disagree about which side is valid
+  DeviceVector(const DeviceVector&);
+  DeviceVector& operator=(const DeviceVector&);
+
+  cl::CommandQueue queue_;
+  cl::Buffer       buffer_;
+  std::vector<T>   host_;
+  size_t           size_;
+  bool             unified_;
+  bool             hostValid_;
+  bool             deviceValid_;
+  T               *mapped_;
+  cl::Event        upload_;
+  TransferCounters counters_;
+};
+
+} // namespace util
@@ -0,0 +1,84 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       json.hpp
+ *
+ * Purpose:    Just enough JSON for the flat files the helpers write: device
+ *             profiles, benchmark results and traces.
+ *
+ *             jsonString() quotes and escapes a value. jsonField() reads the
+ *             value of a key back out of a flat object (or one line of
+ *             one), without decoding escapes other than the backslash.
+ *
+ * Note:       See device_probe.hpp and bench.hpp for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace util {
+
+namespace detail {
+
+inline std::string jsonString(const std::string& s)
+{
+  std::ostringstream out;
+  out << '"';
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (c < 0x20)
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+          << std::dec << std::setfill(' ');
+    else
+      out << c;
+  }
+  out << '"';
+  return out.str();
+}
+
+// Value of "key" in a flat JSON object, undecoded; empty if missing
+inline std::string jsonField(const std::string& text, const std::string& key)
+{
+  size_t pos = text.find("\"" + key + "\"");
+  if (pos == std::string::npos)
+    return "";
+  pos = text.find(':', pos);
+  if (pos == std::string::npos)
+    return "";
+  pos = text.find_first_not_of(" \t\r\n", pos + 1);
+  if (pos == std::string::npos)
+    return "";
+
+  if (text[pos] == '"')
+  {
+    std::string value;
+    for (size_t i = pos + 1; i < text.size() && text[i] != '"'; i++)
+    {
+      if (text[i] == '\\' && i + 1 < text.size())
+        i++;
+      value += text[i];
+    }
+    return value;
+  }
+  size_t end = text.find_first_of(",}\r\n", pos);
+  return text.substr(pos, end - pos);
+}
+
+} // namespace detail
+
+} // namespace util
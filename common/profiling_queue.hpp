@@ -0,0 +1,389 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       profiling_queue.hpp
+ *
+ * Purpose:    A command queue that records what it runs, for a timeline of
+ *             an application's host and device activity.
+ *
+ *             util::ProfilingQueue is a cl::CommandQueue with profiling
+ *             enabled. Its enqueue methods take an optional name as a last
+ *             argument and record the queued, submit, start and end times
+ *             of every command. util::TraceScope records a named region of
+ *             host time. writeChromeTrace() writes everything recorded, from
+ *             all queues and threads, as Chrome trace event JSON, which can
+ *             be opened in chrome://tracing or ui.perfetto.dev.
+ *
+ *             Nothing is recorded until TraceRecorder::get().enable() is
+ *             called, so a ProfilingQueue costs only its profiling events
+ *             when no trace was asked for.
+ *
+ *             Device timestamps are moved onto the host clock using the
+ *             host time at which each queue's first command was enqueued.
+ *             Host timestamps come from util::timerNow(), the clock the
+ *             util.hpp timers use.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             Commands enqueued through a cl::KernelFunctor or cl::copy go
+ *             straight to the underlying cl::CommandQueue and are not
+ *             recorded; enqueue them through the ProfilingQueue instead.
+ *             See the NBody solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <util.hpp>
+#include <json.hpp>
+
+namespace util {
+
+class TraceRecorder
+{
+public:
+  static TraceRecorder& get()
+  {
+    static TraceRecorder recorder;
+    return recorder;
+  }
+
+  //! Start (or stop) recording commands and host regions
+  void enable(bool on = true) { enabled_ = on; }
+
+  bool enabled() const { return enabled_; }
+
+  //! New track for a queue, named in the trace
+  int addQueue(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Track track = { name, 0, false };
+    tracks_.push_back(track);
+    return (int)tracks_.size() - 1;
+  }
+
+  void addCommand(int queue, const std::string& name, const char *category,
+                  const cl::Event& event, uint64_t enqueued)
+  {
+    if (!enabled_)
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Command command = { name, category, queue, event, enqueued };
+    commands_.push_back(command);
+  }
+
+  void addHost(const std::string& name, uint64_t begin, uint64_t end)
+  {
+    if (!enabled_)
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    HostRegion region = { name, threadIndex(), begin, end };
+    host_.push_back(region);
+  }
+
+  /*!
+   * \brief Write everything recorded so far as Chrome trace JSON.
+   *
+   * Waits for every recorded command to complete.
+   */
+  bool write(const std::string& path)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ofstream out(path.c_str());
+    if (!out.is_open())
+      return false;
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [" << std::endl;
+
+    // Names for the tracks: host threads, then two per queue
+    bool first = true;
+    for (size_t t = 0; t < threads_.size(); t++)
+    {
+      std::ostringstream name;
+      name << "host thread " << t;
+      writeTrackName(out, first, hostTid(t), name.str());
+    }
+    for (size_t q = 0; q < tracks_.size(); q++)
+    {
+      writeTrackName(out, first, queuedTid(q), tracks_[q].name + " queued");
+      writeTrackName(out, first, deviceTid(q), tracks_[q].name + " device");
+    }
+
+    for (size_t i = 0; i < host_.size(); i++)
+    {
+      const HostRegion& r = host_[i];
+      writeSlice(out, first, r.name, "host", hostTid(r.thread), r.begin, r.end, "");
+    }
+
+    for (size_t i = 0; i < commands_.size(); i++)
+    {
+      Command& c = commands_[i];
+      c.event.wait();
+      uint64_t queued = c.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+      uint64_t submit = c.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+      uint64_t start  = c.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+      uint64_t end    = c.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+      // The first command fixes the offset from device to host time
+      Track& track = tracks_[c.queue];
+      if (!track.aligned)
+      {
+        track.offset  = (int64_t)c.enqueued - (int64_t)queued;
+        track.aligned = true;
+      }
+      int64_t offset = track.offset;
+
+      std::ostringstream args;
+      args << "\"queued_us\": " << (submit - queued) * 1e-3
+           << ", \"submitted_us\": " << (start - submit) * 1e-3
+           << ", \"running_us\": " << (end - start) * 1e-3;
+
+      writeSlice(out, first, c.name, c.category, queuedTid(c.queue),
+                 queued + offset, start + offset, args.str());
+      writeSlice(out, first, c.name, c.category, deviceTid(c.queue),
+                 start + offset, end + offset, args.str());
+    }
+
+    out << std::endl << "]}" << std::endl;
+    return out.good();
+  }
+
+  //! Forget everything recorded, keeping the queues
+  void clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    commands_.clear();
+    host_.clear();
+  }
+
+private:
+  struct Track
+  {
+    std::string name;
+    int64_t     offset;    // Host time minus device time
+    bool        aligned;
+  };
+
+  struct Command
+  {
+    std::string name;
+    const char *category;
+    int         queue;
+    cl::Event   event;
+    uint64_t    enqueued;  // Host time
+  };
+
+  struct HostRegion
+  {
+    std::string name;
+    int         thread;
+    uint64_t    begin, end;
+  };
+
+  TraceRecorder() : origin_(timerNow()), enabled_(false) {}
+
+  // Small index for the calling thread, in order of first use
+  int threadIndex()
+  {
+    std::thread::id id = std::this_thread::get_id();
+    for (size_t t = 0; t < threads_.size(); t++)
+      if (threads_[t] == id)
+        return (int)t;
+    threads_.push_back(id);
+    return (int)threads_.size() - 1;
+  }
+
+  static int hostTid(size_t thread) { return 1 + (int)thread; }
+  static int queuedTid(size_t queue) { return 1000 + 2*(int)queue; }
+  static int deviceTid(size_t queue) { return 1001 + 2*(int)queue; }
+
+  void writeTrackName(std::ostream& out, bool& first, int tid, const std::string& name)
+  {
+    out << (first ? "" : ",\n")
+        << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": " << tid
+        << ", \"args\": {\"name\": " << detail::jsonString(name) << "}}";
+    first = false;
+  }
+
+  void writeSlice(std::ostream& out, bool& first, const std::string& name,
+                  const char *category, int tid, uint64_t begin, uint64_t end,
+                  const std::string& args)
+  {
+    out << (first ? "" : ",\n")
+        << "{\"ph\": \"X\", \"name\": " << detail::jsonString(name)
+        << ", \"cat\": " << detail::jsonString(category)
+        << ", \"pid\": 1, \"tid\": " << tid
+        << ", \"ts\": " << ((int64_t)begin - (int64_t)origin_) * 1e-3
+        << ", \"dur\": " << (end > begin ? end - begin : 0) * 1e-3;
+    if (!args.empty())
+      out << ", \"args\": {" << args << "}";
+    out << "}";
+    first = false;
+  }
+
+  std::mutex                   mutex_;
+  uint64_t                     origin_;
+  std::atomic<bool>            enabled_;
+  std::vector<Track>           tracks_;
+  std::vector<Command>         commands_;
+  std::vector<HostRegion>      host_;
+  std::vector<std::thread::id> threads_;
+};
+
+//! Record the lifetime of this object as a named region of host time
+class TraceScope
+{
+public:
+  explicit TraceScope(const std::string& name)
+    : name_(name), begin_(timerNow())
+  {
+  }
+
+  ~TraceScope()
+  {
+    TraceRecorder::get().addHost(name_, begin_, timerNow());
+  }
+
+private:
+  TraceScope(const TraceScope&);
+  TraceScope& operator=(const TraceScope&);
+
+  std::string name_;
+  uint64_t    begin_;
+};
+
+inline bool writeChromeTrace(const std::string& path)
+{
+  return TraceRecorder::get().write(path);
+}
+
+class ProfilingQueue : public cl::CommandQueue
+{
+public:
+  ProfilingQueue(const cl::Context& context, const cl::Device& device,
+                 const std::string& name = "queue")
+    : cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE),
+      track_(TraceRecorder::get().addQueue(name))
+  {
+  }
+
+  cl_int enqueueNDRangeKernel(const cl::Kernel& kernel, const cl::NDRange& offset,
+                              const cl::NDRange& global,
+                              const cl::NDRange& local = cl::NullRange,
+                              const std::vector<cl::Event>* events = NULL,
+                              cl::Event* event = NULL, const char *name = NULL)
+  {
+    cl::Event e;
+    cl_int err = cl::CommandQueue::enqueueNDRangeKernel(kernel, offset, global, local,
+                                                        events, &e);
+    // Looking up the kernel name is only worth it when tracing
+    std::string label = name ? name : "";
+    if (!name && TraceRecorder::get().enabled())
+      label = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+    record(label, "kernel", e, event);
+    return err;
+  }
+
+  cl_int enqueueWriteBuffer(const cl::Buffer& buffer, cl_bool blocking, size_t offset,
+                            size_t size, const void *ptr,
+                            const std::vector<cl::Event>* events = NULL,
+                            cl::Event* event = NULL, const char *name = NULL)
+  {
+    cl::Event e;
+    cl_int err = cl::CommandQueue::enqueueWriteBuffer(buffer, blocking, offset, size,
+                                                      ptr, events, &e);
+    record(name ? name : "write", "write", e, event);
+    return err;
+  }
+
+  cl_int enqueueReadBuffer(const cl::Buffer& buffer, cl_bool blocking, size_t offset,
+                           size_t size, void *ptr,
+                           const std::vector<cl::Event>* events = NULL,
+                           cl::Event* event = NULL, const char *name = NULL)
+  {
+    cl::Event e;
+    cl_int err = cl::CommandQueue::enqueueReadBuffer(buffer, blocking, offset, size,
+                                                     ptr, events, &e);
+    record(name ? name : "read", "read", e, event);
+    return err;
+  }
+
+  cl_int enqueueCopyBuffer(const cl::Buffer& src, const cl::Buffer& dst,
+                           size_t srcOffset, size_t dstOffset, size_t size,
+                           const std::vector<cl::Event>* events = NULL,
+                           cl::Event* event = NULL, const char *name = NULL)
+  {
+    cl::Event e;
+    cl_int err = cl::CommandQueue::enqueueCopyBuffer(src, dst, srcOffset, dstOffset,
+                                                     size, events, &e);
+    record(name ? name : "copy", "copy", e, event);
+    return err;
+  }
+
+  template <typename PatternType>
+  cl_int enqueueFillBuffer(const cl::Buffer& buffer, PatternType pattern,
+                           size_t offset, size_t size,
+                           const std::vector<cl::Event>* events = NULL,
+                           cl::Event* event = NULL, const char *name = NULL)
+  {
+    cl::Event e;
+    cl_int err = cl::CommandQueue::enqueueFillBuffer(buffer, pattern, offset, size,
+                                                     events, &e);
+    record(name ? name : "fill", "fill", e, event);
+    return err;
+  }
+
+  void* enqueueMapBuffer(const cl::Buffer& buffer, cl_bool blocking, cl_map_flags flags,
+                         size_t offset, size_t size,
+                         const std::vector<cl::Event>* events = NULL,
+                         cl::Event* event = NULL, cl_int* err = NULL,
+                         const char *name = NULL)
+  {
+    cl::Event e;
+    void *ptr = cl::CommandQueue::enqueueMapBuffer(buffer, blocking, flags, offset, size,
+                                                   events, &e, err);
+    record(name ? name : "map", "map", e, event);
+    return ptr;
+  }
+
+  cl_int enqueueUnmapMemObject(const cl::Memory& memory, void *ptr,
+                               const std::vector<cl::Event>* events = NULL,
+                               cl::Event* event = NULL, const char *name = NULL)
+  {
+    cl::Event e;
+    cl_int err = cl::CommandQueue::enqueueUnmapMemObject(memory, ptr, events, &e);
+    record(name ? name : "unmap", "map", e, event);
+    return err;
+  }
+
+private:
+  void record(const std::string& name, const char *category, const cl::Event& e,
+              cl::Event *event)
+  {
+    TraceRecorder::get().addCommand(track_, name, category, e, timerNow());
+    if (event)
+      *event = e;
+  }
+
+  int track_;
+};
+
+} // namespace util
@@ -0,0 +1,256 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       program_cache.hpp
+ *
+ * Purpose:    Build a program once per device and driver, not once per run.
+ *
+ *             buildProgram() keys a program by a hash of its source and
+ *             build options together with deviceCacheKey() (device name and
+ *             driver version), and keeps CL_PROGRAM_BINARIES for that key in
+ *             the device cache directory (see device_cache.hpp). Later runs
+ *             create the program from the binary instead of compiling it.
+ *             A binary the driver rejects is rebuilt from source and
+ *             replaced, so a stale cache costs one compile, never a failure.
+ *
+ *             Binaries compiled ahead of time (see the Precompile solution)
+ *             are looked for first, in $OPENCL_PRECOMPILED_DIR or else
+ *             ../precompiled, which is where `make precompile` puts them
+ *             for the solutions. Their manifest.txt maps each key to a
+ *             binary file in the same directory.
+ *
+ *             Set OPENCL_PROGRAM_CACHE=0 to always build from source, for
+ *             example to time a cold start.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             Only the source text is hashed, so a program that #includes
+ *             other files will not see changes to them.
+ *             See the MatMul solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <device_cache.hpp>
+
+namespace util {
+
+struct ProgramCacheStats
+{
+  unsigned precompiled;  // Programs created from an ahead-of-time binary
+  unsigned hits;         // Programs created from a cached binary
+  unsigned misses;       // Programs built from source
+  unsigned rejected;     // Binaries the driver would not load
+};
+
+inline ProgramCacheStats& programCacheStats()
+{
+  static ProgramCacheStats stats = { 0, 0, 0, 0 };
+  return stats;
+}
+
+inline bool programCacheEnabled()
+{
+  const char *setting = getenv("OPENCL_PROGRAM_CACHE");
+  return !setting || std::string(setting) != "0";
+}
+
+//! Name for a program built from source with options for device
+inline std::string programCacheKey(const cl::Device& device, const std::string& source,
+                                   const std::string& options)
+{
+  // Options differing only in spacing build the same program
+  std::string normalized;
+  std::istringstream words(options);
+  std::string word;
+  while (words >> word)
+    normalized += (normalized.empty() ? "" : " ") + word;
+
+  // FNV-1a over the source and options, separated so that moving text
+  // from one to the other changes the key
+  std::string text = source + '\0' + normalized;
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < text.size(); i++)
+  {
+    hash ^= (unsigned char)text[i];
+    hash *= 1099511628211ULL;
+  }
+
+  std::ostringstream key;
+  key << deviceCacheKey(device) << "-" << std::hex << hash;
+  return key.str();
+}
+
+//! Binary of a program built for a single device
+inline std::vector<unsigned char> programBinary(const cl::Program& program)
+{
+  cl::Program::Binaries binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+  return binaries.empty() ? std::vector<unsigned char>() : binaries[0];
+}
+
+inline bool readBinaryFile(const std::string& path, std::vector<unsigned char>& binary)
+{
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file.is_open())
+    return false;
+  binary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return !binary.empty();
+}
+
+inline bool writeBinaryFile(const std::string& path, const std::vector<unsigned char>& binary)
+{
+  if (path.empty() || binary.empty())
+    return false;
+
+  // Write then rename, as writeCacheEntries does
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream file(tmp.c_str(), std::ios::binary);
+    if (!file.is_open())
+      return false;
+    file.write((const char*)&binary[0], binary.size());
+    if (!file.good())
+      return false;
+  }
+#if defined(_WIN32)
+  remove(path.c_str());
+#endif
+  return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+//! Directory of ahead-of-time binaries, which may not exist
+inline std::string precompiledDirectory()
+{
+  const char *dir = getenv("OPENCL_PRECOMPILED_DIR");
+  if (dir && *dir)
+    return dir;
+#if defined(_WIN32)
+  return "..\\precompiled";
+#else
+  return "../precompiled";
+#endif
+}
+
+inline std::string precompiledPath(const std::string& dir, const std::string& name)
+{
+#if defined(_WIN32)
+  return dir + "\\" + name;
+#else
+  return dir + "/" + name;
+#endif
+}
+
+/*!
+ * \brief Create and build a program from a binary for device.
+ *
+ * Returns false, rather than throwing, if the driver rejects the binary.
+ */
+inline bool buildProgramFromBinary(const cl::Context& context, const cl::Device& device,
+                                   const std::vector<unsigned char>& binary,
+                                   const std::string& options, cl::Program& program)
+{
+  std::vector<cl::Device> devices(1, device);
+  try
+  {
+    std::vector<cl_int> status;
+    program = cl::Program(context, devices, cl::Program::Binaries(1, binary), &status);
+    if (status.empty() || status[0] != CL_SUCCESS)
+      return false;
+    program.build(devices, options.c_str());
+    return true;
+  }
+  catch (cl::Error&)
+  {
+    return false;
+  }
+}
+
+/*!
+ * \brief Build source for device, from the cached binary if there is one.
+ *
+ * Throws cl::BuildError if the source does not compile, as building the
+ * program directly would. If cached is not NULL it is set to whether the
+ * binary was precompiled or came from the cache.
+ */
+inline cl::Program buildProgram(const cl::Context& context, const cl::Device& device,
+                                const std::string& source,
+                                const std::string& options = "",
+                                bool *cached = NULL)
+{
+  ProgramCacheStats& stats = programCacheStats();
+  if (!programCacheEnabled())
+  {
+    stats.misses++;
+    if (cached)
+      *cached = false;
+    cl::Program program(context, source);
+    program.build(std::vector<cl::Device>(1, device), options.c_str());
+    return program;
+  }
+
+  std::string key = programCacheKey(device, source, options);
+  cl::Program program;
+  std::vector<unsigned char> binary;
+
+  // Ahead-of-time binaries, which are never removed from here
+  std::map<std::string, std::string> manifest;
+  std::string dir = precompiledDirectory();
+  if (readCacheEntries(precompiledPath(dir, "manifest.txt"), manifest) &&
+      manifest.count(key))
+  {
+    std::string file = manifest[key].substr(0, manifest[key].find(' '));
+    if (readBinaryFile(precompiledPath(dir, file), binary))
+    {
+      if (buildProgramFromBinary(context, device, binary, options, program))
+      {
+        stats.precompiled++;
+        if (cached)
+          *cached = true;
+        return program;
+      }
+      stats.rejected++;
+    }
+  }
+
+  std::string path = cacheFile("program-" + key + ".bin");
+  if (!path.empty() && readBinaryFile(path, binary))
+  {
+    if (buildProgramFromBinary(context, device, binary, options, program))
+    {
+      stats.hits++;
+      if (cached)
+        *cached = true;
+      return program;
+    }
+    stats.rejected++;
+    remove(path.c_str());
+  }
+
+  stats.misses++;
+  if (cached)
+    *cached = false;
+  program = cl::Program(context, source);
+  program.build(std::vector<cl::Device>(1, device), options.c_str());
+  if (!path.empty())
+    writeBinaryFile(path, programBinary(program));
+  return program;
+}
+
+} // namespace util
@@ -0,0 +1,251 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       staging_pool.hpp
+ *
+ * Purpose:    A pool of pinned host memory for asynchronous transfers.
+ *
+ *             A few arenas are allocated with CL_MEM_ALLOC_HOST_PTR and
+ *             mapped once, then carved into fixed-size blocks. Transfers are
+ *             split into block-sized chunks which are copied through the
+ *             blocks with non-blocking reads and writes, so the host memcpy
+ *             of one chunk overlaps the DMA of the previous one. A block is
+ *             recycled once the event of the transfer using it completes.
+ *
+ *             The pool is tied to one in-order command queue.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the HostDevTransfer solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace util {
+
+struct StagingStats
+{
+  size_t bytesUploaded;
+  size_t bytesDownloaded;
+  size_t chunks;
+  size_t stalls;        // times a block had to be waited for
+};
+
+class StagingPool
+{
+public:
+  //! A block of pinned memory handed out by acquire()
+  struct Block
+  {
+    char  *ptr;
+    size_t size;
+  };
+
+  StagingPool(const cl::Context& context, const cl::CommandQueue& queue,
+              size_t blockBytes = 1024*1024, unsigned numBlocks = 8,
+              unsigned numArenas = 2)
+    : queue_(queue), blockBytes_(blockBytes)
+  {
+    unsigned perArena = (numBlocks + numArenas - 1) / numArenas;
+    for (unsigned a = 0; a < numArenas; a++)
+    {
+      Arena arena;
+      arena.buffer = cl::Buffer(context, CL_MEM_ALLOC_HOST_PTR,
+                                perArena * blockBytes);
+      arena.ptr = (char*)queue_.enqueueMapBuffer(
+        arena.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+        0, perArena * blockBytes);
+      arenas_.push_back(arena);
+
+      for (unsigned b = 0; b < perArena; b++)
+      {
+        Block block = { arena.ptr + b*blockBytes, blockBytes };
+        free_.push_back(block);
+      }
+    }
+
+    stats_.bytesUploaded   = 0;
+    stats_.bytesDownloaded = 0;
+    stats_.chunks          = 0;
+    stats_.stalls          = 0;
+  }
+
+  ~StagingPool()
+  {
+    try
+    {
+      finish();
+      for (size_t a = 0; a < arenas_.size(); a++)
+        queue_.enqueueUnmapMemObject(arenas_[a].buffer, arenas_[a].ptr);
+      queue_.finish();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  //! Get a free block, waiting for the oldest transfer if none are free
+  Block acquire()
+  {
+    if (free_.empty())
+      reclaim(false);
+    if (free_.empty())
+    {
+      stats_.stalls++;
+      reclaim(true);
+    }
+    if (free_.empty())
+      throw cl::Error(CL_OUT_OF_RESOURCES, "StagingPool: all blocks acquired");
+    Block block = free_.back();
+    free_.pop_back();
+    return block;
+  }
+
+  //! Return a block once event has completed
+  void release(const Block& block, const cl::Event& event)
+  {
+    InFlight f = { block, event };
+    inFlight_.push_back(f);
+  }
+
+  //! Return a block that is not in use by any command
+  void release(const Block& block)
+  {
+    free_.push_back(block);
+  }
+
+  //! Copy size bytes from host memory src into dst at offset. The source can
+  //! be reused as soon as this returns. The returned event completes when
+  //! the last chunk has reached the device.
+  cl::Event upload(const cl::Buffer& dst, size_t offset, size_t size,
+                   const void *src, const std::vector<cl::Event> *wait = NULL)
+  {
+    cl::Event event;
+    for (size_t done = 0; done < size; done += blockBytes_)
+    {
+      size_t n = std::min(blockBytes_, size - done);
+      Block block = acquire();
+      memcpy(block.ptr, (const char*)src + done, n);
+      queue_.enqueueWriteBuffer(dst, CL_FALSE, offset + done, n, block.ptr,
+                                done == 0 ? wait : NULL, &event);
+      release(block, event);
+      stats_.chunks++;
+    }
+    queue_.flush();
+    stats_.bytesUploaded += size;
+    return event;
+  }
+
+  //! Copy size bytes from src at offset into host memory dst, returning when
+  //! the data has arrived. Chunks are read ahead into as many blocks as are
+  //! free, and copied out as each one completes.
+  void download(const cl::Buffer& src, size_t offset, size_t size, void *dst,
+                const std::vector<cl::Event> *wait = NULL)
+  {
+    std::deque<Pending> pending;
+    for (size_t done = 0; done < size; done += blockBytes_)
+    {
+      // Make room by finishing our own reads before waiting on anything else
+      if (free_.empty() && !pending.empty())
+        drain(pending, dst);
+
+      Pending p;
+      p.block  = acquire();
+      p.offset = done;
+      p.size   = std::min(blockBytes_, size - done);
+      queue_.enqueueReadBuffer(src, CL_FALSE, offset + done, p.size, p.block.ptr,
+                               done == 0 ? wait : NULL, &p.event);
+      queue_.flush();
+      pending.push_back(p);
+      stats_.chunks++;
+    }
+    while (!pending.empty())
+      drain(pending, dst);
+    stats_.bytesDownloaded += size;
+  }
+
+  //! Wait for every transfer using the pool
+  void finish()
+  {
+    while (!inFlight_.empty())
+      reclaim(true);
+  }
+
+  size_t getBlockBytes() const { return blockBytes_; }
+  const StagingStats& getStats() const { return stats_; }
+
+private:
+  struct Arena
+  {
+    cl::Buffer buffer;
+    char      *ptr;
+  };
+
+  struct InFlight
+  {
+    Block     block;
+    cl::Event event;
+  };
+
+  struct Pending
+  {
+    Block     block;
+    cl::Event event;
+    size_t    offset;
+    size_t    size;
+  };
+
+  // Move completed blocks back to the free list. If block is set, wait for
+  // the oldest transfer first so that at least one block is recovered.
+  void reclaim(bool block)
+  {
+    if (block && !inFlight_.empty())
+      inFlight_.front().event.wait();
+
+    // Commands on an in-order queue complete in order
+    while (!inFlight_.empty())
+    {
+      cl_int status =
+        inFlight_.front().event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+      if (status != CL_COMPLETE)
+        break;
+      free_.push_back(inFlight_.front().block);
+      inFlight_.pop_front();
+    }
+  }
+
+  void drain(std::deque<Pending>& pending, void *dst)
+  {
+    Pending& p = pending.front();
+    p.event.wait();
+    memcpy((char*)dst + p.offset, p.block.ptr, p.size);
+    free_.push_back(p.block);
+    pending.pop_front();
+  }
+
+  // The arenas stay mapped for the lifetime of the pool
+  StagingPool(const StagingPool&);
+  StagingPool& operator=(const StagingPool&);
+
+  cl::CommandQueue     queue_;
+  size_t               blockBytes_;
+  std::vector<Arena>   arenas_;
+  std::vector<Block>   free_;
+  std::deque<InFlight> inFlight_;
+  StagingStats         stats_;
+};
+
+} // namespace util
@@ -0,0 +1,364 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       stream_executor.hpp
+ *
+ * Purpose:    Run an element-wise computation over host vectors that are
+ *             larger than a single device allocation (or the whole device
+ *             memory) by streaming them through a small ring of device
+ *             buffers.
+ *
+ *             Each chunk is uploaded, computed and downloaded on its own
+ *             command queue, with events chaining the three stages together
+ *             so that the transfers of one chunk overlap the compute of its
+ *             neighbours.
+ *
+ *             overlapSeconds() measures how long two lists of profiled
+ *             commands ran at the same time; see also the HostDevTransfer
+ *             solution's overlap mode.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the VAdd_Stream solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <util.hpp>
+
+namespace util {
+
+// Start and end of a profiled command, in device nanoseconds
+struct EventInterval
+{
+  cl_ulong start, end;
+};
+
+inline EventInterval eventInterval(const cl::Event& event)
+{
+  EventInterval i = { event.getProfilingInfo<CL_PROFILING_COMMAND_START>(),
+                      event.getProfilingInfo<CL_PROFILING_COMMAND_END>() };
+  return i;
+}
+
+inline std::vector<EventInterval> eventIntervals(const std::vector<cl::Event>& events)
+{
+  std::vector<EventInterval> intervals;
+  for (size_t i = 0; i < events.size(); i++)
+    intervals.push_back(eventInterval(events[i]));
+  return intervals;
+}
+
+inline double busySeconds(const std::vector<EventInterval>& intervals)
+{
+  double total = 0.0;
+  for (size_t i = 0; i < intervals.size(); i++)
+    total += (intervals[i].end - intervals[i].start) * 1e-9;
+  return total;
+}
+
+// Total time during which both lists had a command running. Each list comes
+// from an in-order queue, so its intervals are sorted and do not overlap.
+inline double overlapSeconds(const std::vector<EventInterval>& a,
+                             const std::vector<EventInterval>& b)
+{
+  double total = 0.0;
+  size_t i = 0, j = 0;
+  while (i < a.size() && j < b.size())
+  {
+    cl_ulong start = std::max(a[i].start, b[j].start);
+    cl_ulong end   = std::min(a[i].end,   b[j].end);
+    if (end > start)
+      total += (end - start) * 1e-9;
+
+    if (a[i].end < b[j].end)
+      i++;
+    else
+      j++;
+  }
+  return total;
+}
+
+struct StreamStats
+{
+  unsigned chunks;
+  double   bytesUploaded;
+  double   bytesDownloaded;
+
+  // Host-side time from the first enqueue to the last completion
+  double   wallSeconds;
+
+  // Device busy time of each stage, summed over all chunks (from profiling)
+  double   uploadSeconds;
+  double   computeSeconds;
+  double   downloadSeconds;
+
+  // Transfer time during which a compute was running, from the same events
+  double   hiddenSeconds;
+
+  // Bandwidth of a single chunk transfer run in isolation, in bytes/s
+  double   peakUploadBandwidth;
+  double   peakDownloadBandwidth;
+
+  double transferSeconds() const
+  {
+    return uploadSeconds + downloadSeconds;
+  }
+
+  // Time the transfers would take at peak bandwidth, with nothing else running
+  double idealTransferSeconds() const
+  {
+    double t = 0.0;
+    if (peakUploadBandwidth > 0.0)
+      t += bytesUploaded / peakUploadBandwidth;
+    if (peakDownloadBandwidth > 0.0)
+      t += bytesDownloaded / peakDownloadBandwidth;
+    return t;
+  }
+
+  // Achieved end-to-end throughput as a fraction of peak transfer bandwidth
+  double peakFraction() const
+  {
+    return wallSeconds > 0.0 ? idealTransferSeconds() / wallSeconds : 0.0;
+  }
+
+  // Fraction of the transfer time hidden behind compute
+  double hiddenFraction() const
+  {
+    double total = transferSeconds();
+    return total > 0.0 ? std::min(1.0, hiddenSeconds / total) : 0.0;
+  }
+};
+
+template <typename T>
+class StreamExecutor
+{
+public:
+  /*!
+   * \brief Enqueues the computation for one chunk.
+   *
+   * The callback must enqueue its work on \p queue, wait on \p wait and
+   * return the event of its last command in \p done. Only the first
+   * \p count elements of each buffer are valid.
+   */
+  typedef std::function<void(cl::CommandQueue& queue,
+                             const std::vector<cl::Buffer>& inputs,
+                             const std::vector<cl::Buffer>& outputs,
+                             size_t count,
+                             const std::vector<cl::Event>& wait,
+                             cl::Event& done)> ComputeFunc;
+
+  StreamExecutor(const cl::Context& context, const cl::Device& device,
+                 unsigned numInputs, unsigned numOutputs,
+                 size_t chunkElements, unsigned depth = 3)
+    : context_(context), chunkElements_(chunkElements), calibrated_(false)
+  {
+    uploadQueue_   = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+    computeQueue_  = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+    downloadQueue_ = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+    size_t bytes = chunkElements * sizeof(T);
+    slots_.resize(std::max(depth, 1u));
+    for (size_t s = 0; s < slots_.size(); s++)
+    {
+      for (unsigned i = 0; i < numInputs; i++)
+        slots_[s].inputs.push_back(cl::Buffer(context, CL_MEM_READ_ONLY, bytes));
+      for (unsigned i = 0; i < numOutputs; i++)
+        slots_[s].outputs.push_back(cl::Buffer(context, CL_MEM_WRITE_ONLY, bytes));
+    }
+
+    stats_ = StreamStats();
+  }
+
+  /*!
+   * \brief Picks the largest chunk that fits the allocation limits of the
+   * device, capped at \p maxBytes per buffer.
+   */
+  static size_t defaultChunkElements(const cl::Device& device,
+                                     unsigned numBuffers, unsigned depth,
+                                     size_t maxBytes = 16*1024*1024)
+  {
+    cl_ulong maxAlloc  = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+    cl_ulong globalMem = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+
+    // Leave half of the device memory for everybody else
+    cl_ulong limit = globalMem / 2 / std::max(1u, numBuffers*depth);
+    limit = std::min(limit, maxAlloc);
+    limit = std::min(limit, (cl_ulong)maxBytes);
+
+    return std::max((size_t)1, (size_t)(limit / sizeof(T)));
+  }
+
+  /*!
+   * \brief Measures the bandwidth of a single chunk upload and download with
+   * nothing else in flight, which is used as the peak for the statistics.
+   */
+  void calibrate(unsigned repeats = 4)
+  {
+    std::vector<T> h_tmp(chunkElements_);
+    cl::Buffer& d_tmp = slots_[0].inputs.empty() ?
+      slots_[0].outputs[0] : slots_[0].inputs[0];
+    size_t bytes = chunkElements_ * sizeof(T);
+
+    double bestUp = 0.0, bestDown = 0.0;
+    for (unsigned r = 0; r < repeats; r++)
+    {
+      cl::Event up, down;
+      uploadQueue_.enqueueWriteBuffer(d_tmp, CL_TRUE, 0, bytes, &h_tmp[0], NULL, &up);
+      uploadQueue_.enqueueReadBuffer(d_tmp, CL_TRUE, 0, bytes, &h_tmp[0], NULL, &down);
+      double upSeconds   = eventSeconds(up);
+      double downSeconds = eventSeconds(down);
+      if (upSeconds > 0.0)
+        bestUp   = std::max(bestUp,   bytes / upSeconds);
+      if (downSeconds > 0.0)
+        bestDown = std::max(bestDown, bytes / downSeconds);
+    }
+    stats_.peakUploadBandwidth   = bestUp;
+    stats_.peakDownloadBandwidth = bestDown;
+    calibrated_ = true;
+  }
+
+  /*!
+   * \brief Streams \p length elements of every input through \p compute and
+   * writes the results to \p outputs. Blocks until everything is complete.
+   */
+  void run(const std::vector<const T*>& inputs, const std::vector<T*>& outputs,
+           size_t length, ComputeFunc compute)
+  {
+    if (!calibrated_)
+      calibrate();
+
+    size_t depth = slots_.size();
+    std::vector<cl::Event> uploads, computes, downloads;
+
+    // Last compute/download issued on each slot, guarding buffer reuse
+    std::vector<cl::Event> slotCompute(depth), slotDownload(depth);
+    std::vector<bool>      slotBusy(depth, false);
+
+    Timer timer;
+    uint64_t startTime = timer.getTimeNanoseconds();
+
+    unsigned chunk = 0;
+    for (size_t offset = 0; offset < length; offset += chunkElements_, chunk++)
+    {
+      size_t s     = chunk % depth;
+      Slot& slot   = slots_[s];
+      size_t count = std::min(chunkElements_, length - offset);
+      size_t bytes = count * sizeof(T);
+
+      // Inputs can be overwritten once the previous compute on this slot is done
+      std::vector<cl::Event> uploadWait;
+      if (slotBusy[s])
+        uploadWait.push_back(slotCompute[s]);
+
+      std::vector<cl::Event> computeWait;
+      for (size_t i = 0; i < inputs.size(); i++)
+      {
+        cl::Event e;
+        uploadQueue_.enqueueWriteBuffer(slot.inputs[i], CL_FALSE, 0, bytes,
+                                        inputs[i] + offset,
+                                        uploadWait.empty() ? NULL : &uploadWait, &e);
+        computeWait.push_back(e);
+        uploads.push_back(e);
+      }
+      uploadQueue_.flush();
+
+      // Outputs can be overwritten once the previous download is done
+      if (slotBusy[s])
+        computeWait.push_back(slotDownload[s]);
+
+      cl::Event done;
+      compute(computeQueue_, slot.inputs, slot.outputs, count, computeWait, done);
+      computeQueue_.flush();
+      computes.push_back(done);
+      slotCompute[s] = done;
+
+      std::vector<cl::Event> downloadWait(1, done);
+      for (size_t o = 0; o < outputs.size(); o++)
+      {
+        cl::Event e;
+        downloadQueue_.enqueueReadBuffer(slot.outputs[o], CL_FALSE, 0, bytes,
+                                         outputs[o] + offset, &downloadWait, &e);
+        downloads.push_back(e);
+        slotDownload[s] = e;
+      }
+      downloadQueue_.flush();
+
+      // With no outputs the compute itself releases the slot
+      if (outputs.empty())
+        slotDownload[s] = done;
+      slotBusy[s] = true;
+    }
+
+    uploadQueue_.finish();
+    computeQueue_.finish();
+    downloadQueue_.finish();
+
+    uint64_t endTime = timer.getTimeNanoseconds();
+
+    stats_.chunks          = chunk;
+    stats_.bytesUploaded   = (double)length * sizeof(T) * inputs.size();
+    stats_.bytesDownloaded = (double)length * sizeof(T) * outputs.size();
+    stats_.wallSeconds     = (endTime - startTime) * 1e-9;
+    std::vector<EventInterval> uploadIntervals   = eventIntervals(uploads);
+    std::vector<EventInterval> computeIntervals  = eventIntervals(computes);
+    std::vector<EventInterval> downloadIntervals = eventIntervals(downloads);
+    stats_.uploadSeconds   = busySeconds(uploadIntervals);
+    stats_.computeSeconds  = busySeconds(computeIntervals);
+    stats_.downloadSeconds = busySeconds(downloadIntervals);
+    stats_.hiddenSeconds   = overlapSeconds(uploadIntervals, computeIntervals) +
+                             overlapSeconds(downloadIntervals, computeIntervals);
+  }
+
+  const StreamStats& getStats() const
+  {
+    return stats_;
+  }
+
+  size_t getChunkElements() const
+  {
+    return chunkElements_;
+  }
+
+  unsigned getDepth() const
+  {
+    return slots_.size();
+  }
+
+private:
+  struct Slot
+  {
+    std::vector<cl::Buffer> inputs;
+    std::vector<cl::Buffer> outputs;
+  };
+
+  static double eventSeconds(const cl::Event& e)
+  {
+    cl_ulong start = e.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+    cl_ulong end   = e.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+    return (end - start) * 1e-9;
+  }
+
+  cl::Context       context_;
+  cl::CommandQueue  uploadQueue_;
+  cl::CommandQueue  computeQueue_;
+  cl::CommandQueue  downloadQueue_;
+  std::vector<Slot> slots_;
+  size_t            chunkElements_;
+  bool              calibrated_;
+  StreamStats       stats_;
+};
+
+} // namespace util
@@ -0,0 +1,331 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       transfer_strategy.hpp
+ *
+ * Purpose:    Pick the fastest way to move data to and from a device by
+ *             measuring it, rather than guessing from device properties.
+ *
+ *             On first use for a device, each upload and download path is
+ *             timed at a few size classes:
+ *
+ *               direct   enqueueWriteBuffer/enqueueReadBuffer on the
+ *                        application's memory
+ *               staged   chunked copies through a util::StagingPool
+ *               map      map the device buffer and memcpy
+ *
+ *             The winners are cached in memory and on disk (see
+ *             device_cache.hpp), and upload()/download() then use the
+ *             winner for the size class of each transfer.
+ *
+ *             Every path blocks: upload() and download() return once the
+ *             data has arrived, whichever path the measurement picked.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the HostDevTransfer solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <util.hpp>
+#include <device_cache.hpp>
+#include <staging_pool.hpp>
+
+namespace util {
+
+enum TransferPath
+{
+  TRANSFER_DIRECT,
+  TRANSFER_STAGED,
+  TRANSFER_MAP,
+  TRANSFER_NUM_PATHS
+};
+
+inline const char* transferPathName(TransferPath path)
+{
+  switch (path)
+  {
+    case TRANSFER_DIRECT: return "direct";
+    case TRANSFER_STAGED: return "staged";
+    case TRANSFER_MAP:    return "map";
+    default:              return "unknown";
+  }
+}
+
+class TransferStrategy
+{
+public:
+  //! Smallest size of each class; a transfer uses the largest class it fills
+  static const unsigned NUM_CLASSES = 4;
+  static size_t classSize(unsigned c)
+  {
+    static const size_t sizes[NUM_CLASSES] = {
+      4*1024, 64*1024, 1024*1024, 16*1024*1024
+    };
+    return sizes[c];
+  }
+
+  /*!
+   * \brief Loads the choices for \p device from the cache, measuring them
+   * if they are not there (or \p useCache is false).
+   */
+  TransferStrategy(const cl::Context& context, const cl::Device& device,
+                   const cl::CommandQueue& queue, bool useCache = true)
+    : context_(context), queue_(queue), pool_(context, queue),
+      fromCache_(false)
+  {
+    std::string key = deviceCacheKey(device);
+    std::map<std::string, Choices>& memory = memoryCache();
+
+    if (useCache && memory.count(key))
+    {
+      choices_   = memory[key];
+      fromCache_ = true;
+      return;
+    }
+    if (useCache && load(key))
+    {
+      memory[key] = choices_;
+      fromCache_  = true;
+      return;
+    }
+
+    calibrate(device);
+    memory[key] = choices_;
+    save(key);
+  }
+
+  //! Copy size bytes from src to dst at offset, returning once they arrive
+  void upload(cl::Buffer& dst, size_t offset, size_t size, const void *src)
+  {
+    upload(uploadPath(size), dst, offset, size, src);
+  }
+
+  //! Copy size bytes from src at offset to dst, returning once they arrive
+  void download(const cl::Buffer& src, size_t offset, size_t size, void *dst)
+  {
+    download(downloadPath(size), src, offset, size, dst);
+  }
+
+  TransferPath uploadPath(size_t size) const
+  {
+    return choices_.upload[sizeClass(size)];
+  }
+
+  TransferPath downloadPath(size_t size) const
+  {
+    return choices_.download[sizeClass(size)];
+  }
+
+  //! True if the choices came from an earlier measurement
+  bool fromCache() const { return fromCache_; }
+
+  void print(std::ostream& out) const
+  {
+    out << "Size class    Upload    Download" << std::endl;
+    for (unsigned c = 0; c < NUM_CLASSES; c++)
+    {
+      std::ostringstream label;
+      if (classSize(c) >= 1024*1024)
+        label << ">= " << classSize(c) / (1024*1024) << " MB";
+      else
+        label << ">= " << classSize(c) / 1024 << " KB";
+      out << std::left << std::setw(14) << label.str()
+          << std::setw(10) << transferPathName(choices_.upload[c])
+          << transferPathName(choices_.download[c]) << std::right << std::endl;
+    }
+  }
+
+private:
+  struct Choices
+  {
+    TransferPath upload[NUM_CLASSES];
+    TransferPath download[NUM_CLASSES];
+  };
+
+  static std::map<std::string, Choices>& memoryCache()
+  {
+    static std::map<std::string, Choices> cache;
+    return cache;
+  }
+
+  static unsigned sizeClass(size_t size)
+  {
+    unsigned c = 0;
+    while (c + 1 < NUM_CLASSES && size >= classSize(c + 1))
+      c++;
+    return c;
+  }
+
+  void upload(TransferPath path, cl::Buffer& dst, size_t offset, size_t size,
+              const void *src)
+  {
+    if (path == TRANSFER_STAGED)
+    {
+      // The pool only waits for its blocks, not for the last write
+      cl::Event event = pool_.upload(dst, offset, size, src);
+      if (event())
+        event.wait();
+    }
+    else if (path == TRANSFER_MAP)
+    {
+      void *ptr = queue_.enqueueMapBuffer(dst, CL_TRUE,
+                                          CL_MAP_WRITE_INVALIDATE_REGION,
+                                          offset, size);
+      memcpy(ptr, src, size);
+      queue_.enqueueUnmapMemObject(dst, ptr);
+    }
+    else
+    {
+      queue_.enqueueWriteBuffer(dst, CL_TRUE, offset, size, src);
+    }
+  }
+
+  void download(TransferPath path, const cl::Buffer& src, size_t offset,
+                size_t size, void *dst)
+  {
+    if (path == TRANSFER_STAGED)
+    {
+      pool_.download(src, offset, size, dst);
+    }
+    else if (path == TRANSFER_MAP)
+    {
+      void *ptr = queue_.enqueueMapBuffer(src, CL_TRUE, CL_MAP_READ, offset, size);
+      memcpy(dst, ptr, size);
+      queue_.enqueueUnmapMemObject(src, ptr);
+    }
+    else
+    {
+      queue_.enqueueReadBuffer(src, CL_TRUE, offset, size, dst);
+    }
+  }
+
+  // Best of a few repetitions after a warm-up, in seconds
+  template <typename F>
+  double best(F transfer)
+  {
+    Timer timer;
+    double fastest = 1e30;
+    for (unsigned r = 0; r < 4; r++)
+    {
+      uint64_t start = timer.getTimeNanoseconds();
+      transfer();
+      queue_.finish();
+      double t = (timer.getTimeNanoseconds() - start) * 1e-9;
+      if (r > 0)
+        fastest = std::min(fastest, t);
+    }
+    return fastest;
+  }
+
+  void calibrate(const cl::Device& device)
+  {
+    size_t maxAlloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+
+    for (unsigned c = 0; c < NUM_CLASSES; c++)
+    {
+      // Classes too large to allocate take the choice of the one below
+      size_t size = classSize(c);
+      if (size > maxAlloc && c > 0)
+      {
+        choices_.upload[c]   = choices_.upload[c-1];
+        choices_.download[c] = choices_.download[c-1];
+        continue;
+      }
+
+      cl::Buffer buffer(context_, CL_MEM_READ_WRITE, size);
+      std::vector<char> host(size);
+
+      double up[TRANSFER_NUM_PATHS], down[TRANSFER_NUM_PATHS];
+      for (int p = 0; p < TRANSFER_NUM_PATHS; p++)
+      {
+        TransferPath path = (TransferPath)p;
+        up[p] = best([&]() { upload(path, buffer, 0, size, &host[0]); });
+        down[p] = best([&]() { download(path, buffer, 0, size, &host[0]); });
+      }
+      choices_.upload[c] =
+        (TransferPath)(std::min_element(up, up + TRANSFER_NUM_PATHS) - up);
+      choices_.download[c] =
+        (TransferPath)(std::min_element(down, down + TRANSFER_NUM_PATHS) - down);
+    }
+  }
+
+  std::string cachePath(const std::string& key) const
+  {
+    return cacheFile("transfer-" + key + ".txt");
+  }
+
+  bool load(const std::string& key)
+  {
+    std::map<std::string, std::string> entries;
+    std::string path = cachePath(key);
+    if (path.empty() || !readCacheEntries(path, entries))
+      return false;
+
+    for (unsigned c = 0; c < NUM_CLASSES; c++)
+    {
+      std::ostringstream up, down;
+      up << "upload." << classSize(c);
+      down << "download." << classSize(c);
+      if (!parsePath(entries[up.str()], choices_.upload[c]) ||
+          !parsePath(entries[down.str()], choices_.download[c]))
+        return false;
+    }
+    return true;
+  }
+
+  void save(const std::string& key) const
+  {
+    std::map<std::string, std::string> entries;
+    for (unsigned c = 0; c < NUM_CLASSES; c++)
+    {
+      std::ostringstream up, down;
+      up << "upload." << classSize(c);
+      down << "download." << classSize(c);
+      entries[up.str()]   = transferPathName(choices_.upload[c]);
+      entries[down.str()] = transferPathName(choices_.download[c]);
+    }
+    writeCacheEntries(cachePath(key), entries);
+  }
+
+  static bool parsePath(const std::string& name, TransferPath& path)
+  {
+    for (int p = 0; p < TRANSFER_NUM_PATHS; p++)
+    {
+      if (name == transferPathName((TransferPath)p))
+      {
+        path = (TransferPath)p;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  TransferStrategy(const TransferStrategy&);
+  TransferStrategy& operator=(const TransferStrategy&);
+
+  cl::Context      context_;
+  cl::CommandQueue queue_;
+  StagingPool      pool_;
+  Choices          choices_;
+  bool             fromCache_;
+};
+
+} // namespace util
@@ -11,13 +11,16 @@
 #ifndef __UTIL_C_HDR
 #define __UTIL_C_HDR
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #if defined(_WIN32) && !defined(__MINGW32__)
 #include <windows.h>
 #else
 #include <sys/time.h>
+#include <time.h>
 #endif
 
 // Utility to load an OpenCL kernel source file
@@ -45,32 +48,251 @@ char *loadProgram(const char *filename)
   return source;
 }
 
-// Utility to return the current time in nanoseconds since the epoch
-double getCurrentTimeNanoseconds()
+// Utility to return the time in nanoseconds on a monotonic clock,
+// from an arbitrary origin
+uint64_t timerNow()
 {
 #if defined(_WIN32) && !defined(__MINGW32__)
-	LARGE_INTEGER StartingTime;
+	LARGE_INTEGER Count;
 	LARGE_INTEGER Frequency;
 	QueryPerformanceFrequency(&Frequency);
-	QueryPerformanceCounter(&StartingTime);
-	return (StartingTime.QuadPart * 1e9) / (double)Frequency.QuadPart;
+	QueryPerformanceCounter(&Count);
+	return (uint64_t)((Count.QuadPart * 1e9) / (double)Frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 #else
+  // Not monotonic: build with _DEFAULT_SOURCE (or _POSIX_C_SOURCE) for clock_gettime
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  return tv.tv_usec * 1e3 + tv.tv_sec * 1e9;
+  return (uint64_t)tv.tv_sec * 1000000000ULL + (uint64_t)tv.tv_usec * 1000ULL;
 #endif
 }
 
-// Utility to return the current time in microseconds since the epoch
+// Utility to return the current time in nanoseconds, from an arbitrary origin
+double getCurrentTimeNanoseconds()
+{
+  return (double)timerNow();
+}
+
+// Utility to return the current time in microseconds, from an arbitrary origin
 double getCurrentTimeMicroseconds()
 {
   return getCurrentTimeNanoseconds() / 1e3;
 }
 
-// Utility to return the current time in seconds since the epoch
+// Utility to return the current time in seconds, from an arbitrary origin
 double wtime()
 {
   return getCurrentTimeNanoseconds() / 1e9;
 }
 
+/*
+ * Named timer regions, as in util.hpp.
+ *
+ * Time a region with:
+ *
+ *     static int region = -1;
+ *     if (region < 0) region = timerRegion("update");
+ *     uint64_t start = timerNow();
+ *     ...
+ *     recordTimer(region, timerNow() - start);
+ *
+ * Each thread records into its own ring of recent samples and its own
+ * running totals, without locking. The regions are printed at exit, or by
+ * timerReport(), with the count, total and minimum over every sample and
+ * the median and 99th percentile over the samples still in the rings.
+ */
+
+#ifndef UTIL_TIMER_RING_SIZE
+#define UTIL_TIMER_RING_SIZE   4096    // Samples kept per thread
+#endif
+#ifndef UTIL_TIMER_MAX_REGIONS
+#define UTIL_TIMER_MAX_REGIONS 64
+#endif
+#ifndef UTIL_TIMER_MAX_THREADS
+#define UTIL_TIMER_MAX_THREADS 64
+#endif
+
+#if defined(_MSC_VER)
+#define UTIL_THREAD_LOCAL          __declspec(thread)
+#define UTIL_LOAD_ACQUIRE(p)       (*(volatile uint64_t *)(p))
+#define UTIL_STORE_RELEASE(p, v)   (*(volatile uint64_t *)(p) = (v))
+#define UTIL_FETCH_ADD(p, v)       InterlockedExchangeAdd((volatile LONG *)(p), (v))
+#define UTIL_EXCHANGE(p, v)        InterlockedExchange((volatile LONG *)(p), (v))
+#else
+#define UTIL_THREAD_LOCAL          __thread
+#define UTIL_LOAD_ACQUIRE(p)       __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define UTIL_STORE_RELEASE(p, v)   __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define UTIL_FETCH_ADD(p, v)       __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define UTIL_EXCHANGE(p, v)        __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#endif
+
+typedef struct
+{
+  int      region;
+  uint64_t nanoseconds;
+} TimerSample;
+
+// Written only by its own thread, read by the report
+typedef struct
+{
+  uint64_t    head;
+  TimerSample samples[UTIL_TIMER_RING_SIZE];
+  uint64_t    count[UTIL_TIMER_MAX_REGIONS];
+  uint64_t    total[UTIL_TIMER_MAX_REGIONS];
+  uint64_t    min[UTIL_TIMER_MAX_REGIONS];
+} TimerRing;
+
+static char       *timerNames[UTIL_TIMER_MAX_REGIONS];
+static int         timerNumRegions = 0;
+static long        timerLock       = 0;
+static TimerRing  *timerRings[UTIL_TIMER_MAX_THREADS];
+static long        timerNumRings   = 0;
+static int         timerAtExit     = 1;
+static UTIL_THREAD_LOCAL TimerRing *timerRing = NULL;
+
+void timerReport(FILE *out);
+
+void timerReportOnExit(void)
+{
+  if (timerAtExit)
+    timerReport(stdout);
+}
+
+// Utility to return the index of the region called name, added if new
+int timerRegion(const char *name)
+{
+  while (UTIL_EXCHANGE(&timerLock, 1))
+    ;
+
+  int region = -1;
+  for (int r = 0; r < timerNumRegions; r++)
+  {
+    if (!strcmp(timerNames[r], name))
+      region = r;
+  }
+  if (region < 0 && timerNumRegions < UTIL_TIMER_MAX_REGIONS)
+  {
+    if (!timerNumRegions)
+      atexit(timerReportOnExit);
+    region = timerNumRegions++;
+    timerNames[region] = (char *)malloc(strlen(name) + 1);
+    strcpy(timerNames[region], name);
+  }
+  else if (region < 0)
+  {
+    fprintf(stderr, "Too many timer regions, ignoring: %s\n", name);
+  }
+
+  UTIL_EXCHANGE(&timerLock, 0);
+  return region;
+}
+
+// Utility to add a sample to region from the calling thread
+void recordTimer(int region, uint64_t nanoseconds)
+{
+  if (region < 0 || region >= UTIL_TIMER_MAX_REGIONS)
+    return;
+
+  if (!timerRing)
+  {
+    // Never freed, so a thread's samples outlive it
+    long slot = UTIL_FETCH_ADD(&timerNumRings, 1);
+    if (slot >= UTIL_TIMER_MAX_THREADS)
+      return;
+    TimerRing *ring = (TimerRing *)calloc(1, sizeof(TimerRing));
+    if (!ring)
+      return;
+    for (int r = 0; r < UTIL_TIMER_MAX_REGIONS; r++)
+      ring->min[r] = ~0ULL;
+    timerRings[slot] = ring;
+    timerRing = ring;
+  }
+
+  TimerRing *ring = timerRing;
+  uint64_t head = ring->head;
+  ring->samples[head % UTIL_TIMER_RING_SIZE].region      = region;
+  ring->samples[head % UTIL_TIMER_RING_SIZE].nanoseconds = nanoseconds;
+  UTIL_STORE_RELEASE(&ring->head, head + 1);
+
+  ring->count[region]++;
+  ring->total[region] += nanoseconds;
+  if (nanoseconds < ring->min[region])
+    ring->min[region] = nanoseconds;
+}
+
+int timerCompare(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Utility to print every region with samples; call while no timed thread runs
+void timerReport(FILE *out)
+{
+  long numRings = UTIL_FETCH_ADD(&timerNumRings, 0);
+  if (numRings > UTIL_TIMER_MAX_THREADS)
+    numRings = UTIL_TIMER_MAX_THREADS;
+  if (!numRings)
+    return;
+
+  uint64_t *recent = (uint64_t *)malloc(numRings * UTIL_TIMER_RING_SIZE * sizeof(uint64_t));
+  if (!recent)
+    return;
+
+  int header = 0;
+  for (int r = 0; r < timerNumRegions; r++)
+  {
+    uint64_t count = 0, total = 0, min = ~0ULL;
+    size_t   kept  = 0;
+    for (long t = 0; t < numRings; t++)
+    {
+      TimerRing *ring = timerRings[t];
+      if (!ring)
+        continue;
+      count += ring->count[r];
+      total += ring->total[r];
+      if (ring->min[r] < min)
+        min = ring->min[r];
+
+      uint64_t head  = UTIL_LOAD_ACQUIRE(&ring->head);
+      uint64_t first = head > UTIL_TIMER_RING_SIZE ? head - UTIL_TIMER_RING_SIZE : 0;
+      for (uint64_t i = first; i < head; i++)
+      {
+        TimerSample *sample = &ring->samples[i % UTIL_TIMER_RING_SIZE];
+        if (sample->region == r)
+          recent[kept++] = sample->nanoseconds;
+      }
+    }
+    if (!count)
+      continue;
+
+    if (!header)
+    {
+      fprintf(out, "\nRegion                 Count   Total (ms)   Min (us)"
+                   "   Median (us)   p99 (us)\n");
+      for (int i = 0; i < 81; i++)
+        fputc('-', out);
+      fputc('\n', out);
+      header = 1;
+    }
+
+    qsort(recent, kept, sizeof(uint64_t), timerCompare);
+    double median = kept ? recent[kept / 2] * 1e-3 : 0;
+    double p99    = kept ? recent[(kept * 99) / 100] * 1e-3 : 0;
+    fprintf(out, "%-20s%8llu%13.3f%11.3f%14.3f%11.3f\n", timerNames[r],
+            (unsigned long long)count, total * 1e-6, min * 1e-3, median, p99);
+  }
+  free(recent);
+}
+
+// Utility to choose whether the regions are printed at exit, as by default
+void timerReportAtExit(int enable)
+{
+  timerAtExit = enable;
+}
+
 #endif
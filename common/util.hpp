@@ -21,9 +21,15 @@ typedef unsigned __int64 uint64_t;
 #include <unistd.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <cstdlib>
 
@@ -223,6 +229,243 @@ public:
 };
 #endif
 
+/*
+ * Named timer regions.
+ *
+ * A ScopedTimer adds the time between its construction and destruction to
+ * a named region. Each thread records into its own ring of recent samples
+ * and its own running totals, so recording takes no lock. The regions are
+ * reported at exit, or on demand by timerReport(), with the count, total
+ * and minimum over every sample and the median and 99th percentile over
+ * the samples still in the rings.
+ *
+ * Looking a region up by name takes a lock; in a hot loop look it up once:
+ *
+ *     static const int region = util::timerRegion("update");
+ *     util::ScopedTimer timer(region);
+ */
+
+#ifndef UTIL_TIMER_RING_SIZE
+#define UTIL_TIMER_RING_SIZE   4096    // Samples kept per thread
+#endif
+#ifndef UTIL_TIMER_MAX_REGIONS
+#define UTIL_TIMER_MAX_REGIONS 64
+#endif
+
+//! Nanoseconds on a monotonic clock, from an arbitrary origin
+inline uint64_t timerNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace detail {
+
+struct TimerSample
+{
+    int      region;
+    uint64_t nanoseconds;
+};
+
+// Written only by its own thread, read by the report
+struct TimerRing
+{
+    std::atomic<uint64_t> head;
+    TimerSample           samples[UTIL_TIMER_RING_SIZE];
+    std::atomic<uint64_t> count[UTIL_TIMER_MAX_REGIONS];
+    std::atomic<uint64_t> total[UTIL_TIMER_MAX_REGIONS];
+    std::atomic<uint64_t> min[UTIL_TIMER_MAX_REGIONS];
+
+    TimerRing() : head(0)
+    {
+        for (int r = 0; r < UTIL_TIMER_MAX_REGIONS; r++)
+        {
+            count[r] = 0;
+            total[r] = 0;
+            min[r]   = ~0ULL;
+        }
+    }
+};
+
+class TimerRegistry
+{
+public:
+    static TimerRegistry& get()
+    {
+        static TimerRegistry registry;
+        return registry;
+    }
+
+    int region(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t r = 0; r < names_.size(); r++)
+            if (names_[r] == name)
+                return (int)r;
+        if (names_.size() >= UTIL_TIMER_MAX_REGIONS)
+        {
+            std::cout << "Too many timer regions, ignoring: " << name << std::endl;
+            return -1;
+        }
+        names_.push_back(name);
+        return (int)names_.size() - 1;
+    }
+
+    //! Ring for the calling thread, created on its first sample
+    TimerRing& ring()
+    {
+        static thread_local TimerRing *ring = NULL;
+        if (!ring)
+        {
+            // Never freed, so a thread's samples outlive it
+            ring = new TimerRing;
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings_.push_back(ring);
+        }
+        return *ring;
+    }
+
+    /*!
+     * \brief Print every region with samples.
+     *
+     * Should be called while no timed thread is running, as at exit.
+     */
+    void report(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool header = false;
+        for (size_t r = 0; r < names_.size(); r++)
+        {
+            uint64_t count = 0, total = 0, min = ~0ULL;
+            std::vector<uint64_t> recent;
+            for (size_t t = 0; t < rings_.size(); t++)
+            {
+                TimerRing& ring = *rings_[t];
+                count += ring.count[r].load(std::memory_order_relaxed);
+                total += ring.total[r].load(std::memory_order_relaxed);
+                min    = (std::min)(min, ring.min[r].load(std::memory_order_relaxed));
+
+                uint64_t head = ring.head.load(std::memory_order_acquire);
+                uint64_t kept = std::min<uint64_t>(head, UTIL_TIMER_RING_SIZE);
+                for (uint64_t i = head - kept; i < head; i++)
+                {
+                    const TimerSample& sample = ring.samples[i % UTIL_TIMER_RING_SIZE];
+                    if (sample.region == (int)r)
+                        recent.push_back(sample.nanoseconds);
+                }
+            }
+            if (!count)
+                continue;
+
+            if (!header)
+            {
+                out << std::endl
+                    << "Region                 Count   Total (ms)   Min (us)"
+                       "   Median (us)   p99 (us)" << std::endl
+                    << std::string(81, '-') << std::endl;
+                header = true;
+            }
+
+            std::sort(recent.begin(), recent.end());
+            double median = recent.empty() ? 0 : recent[recent.size() / 2] * 1e-3;
+            double p99    = recent.empty() ? 0 : recent[(recent.size() * 99) / 100] * 1e-3;
+
+            std::ios::fmtflags flags = out.flags();
+            std::streamsize precision = out.precision();
+            out << std::fixed << std::setprecision(3)
+                << std::left << std::setw(20) << names_[r] << std::right
+                << std::setw(8) << count
+                << std::setw(13) << total * 1e-6
+                << std::setw(11) << min * 1e-3
+                << std::setw(14) << median
+                << std::setw(11) << p99 << std::endl;
+            out.flags(flags);
+            out.precision(precision);
+        }
+    }
+
+    void reportAtExit(bool enable)
+    {
+        reportAtExit_ = enable;
+    }
+
+private:
+    TimerRegistry() : reportAtExit_(true) {}
+
+    ~TimerRegistry()
+    {
+        if (reportAtExit_)
+            report(std::cout);
+    }
+
+    std::mutex               mutex_;
+    std::vector<std::string> names_;
+    std::vector<TimerRing*>  rings_;
+    bool                     reportAtExit_;
+};
+
+} // namespace detail
+
+//! Index of the region called name, added if new
+inline int timerRegion(const std::string& name)
+{
+    return detail::TimerRegistry::get().region(name);
+}
+
+//! Add a sample to region from the calling thread
+inline void recordTimer(int region, uint64_t nanoseconds)
+{
+    if (region < 0 || region >= UTIL_TIMER_MAX_REGIONS)
+        return;
+
+    detail::TimerRing& ring = detail::TimerRegistry::get().ring();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.samples[head % UTIL_TIMER_RING_SIZE].region      = region;
+    ring.samples[head % UTIL_TIMER_RING_SIZE].nanoseconds = nanoseconds;
+    ring.head.store(head + 1, std::memory_order_release);
+
+    // Single writer, so no read-modify-write is needed
+    ring.count[region].store(ring.count[region].load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+    ring.total[region].store(ring.total[region].load(std::memory_order_relaxed) + nanoseconds,
+                             std::memory_order_relaxed);
+    if (nanoseconds < ring.min[region].load(std::memory_order_relaxed))
+        ring.min[region].store(nanoseconds, std::memory_order_relaxed);
+}
+
+//! Print the regions recorded so far
+inline void timerReport(std::ostream& out = std::cout)
+{
+    detail::TimerRegistry::get().report(out);
+}
+
+//! Whether the regions are printed at exit, which they are by default
+inline void timerReportAtExit(bool enable)
+{
+    detail::TimerRegistry::get().reportAtExit(enable);
+}
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(int region) : region_(region), start_(timerNow()) {}
+
+    explicit ScopedTimer(const std::string& name)
+        : region_(timerRegion(name)), start_(timerNow()) {}
+
+    ~ScopedTimer()
+    {
+        recordTimer(region_, timerNow() - start_);
+    }
+
+private:
+    ScopedTimer(const ScopedTimer&);
+    ScopedTimer& operator=(const ScopedTimer&);
+
+    int      region_;
+    uint64_t start_;
+};
+
 } // namespace util
 
 #endif // __UTIL_HDR
@@ -0,0 +1,291 @@
+/*------------------------------------------------------------------------------
+ *
+ * Name:       write_coalescer.hpp
+ *
+ * Purpose:    Batch many small host-to-device writes into one transfer.
+ *
+ *             Each write is appended to a host staging area along with an
+ *             entry in an offset table. flush() uploads the staging area and
+ *             the table with one write each, then a scatter kernel copies
+ *             every entry to its place in the destination buffer, with one
+ *             kernel launch per distinct destination buffer.
+ *
+ *             Entries for one buffer are scattered in parallel, so a write
+ *             that overlaps one already staged for the same buffer flushes
+ *             first; the last write to a byte always wins, as it does with
+ *             enqueueWriteBuffer. The table holds 32-bit offsets, so writes
+ *             beyond 4 GB in a buffer are sent on their own.
+ *
+ *             This trades the per-call overhead of many enqueueWriteBuffer
+ *             calls for one extra device-side copy, so it only pays off for
+ *             small writes. The HostDevTransfer coalesce mode measures where
+ *             the crossover is.
+ *
+ * Note:       Must be included AFTER the relevant OpenCL header
+ *             See the HostDevTransfer solution for usage
+ */
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace util {
+
+static const char *write_coalescer_source = R"CLC(
+// One work-group per table entry. An entry is (staging offset, destination
+// offset, size) in bytes; entries that are word aligned are copied a word
+// at a time.
+kernel void scatter(global const uchar *staging,
+                    global const uint4 *table,
+                    uint first,
+                    global uchar *dst)
+{
+  uint4 e   = table[first + get_group_id(0)];
+  uint  lid = get_local_id(0);
+  uint  lsz = get_local_size(0);
+
+  if (((e.x | e.y | e.z) & 3) == 0)
+  {
+    global const uint *s = (global const uint*)(staging + e.x);
+    global uint       *d = (global uint*)(dst + e.y);
+    for (uint i = lid; i < e.z/4; i += lsz)
+      d[i] = s[i];
+  }
+  else
+  {
+    for (uint i = lid; i < e.z; i += lsz)
+      dst[e.y + i] = staging[e.x + i];
+  }
+}
+)CLC";
+
+struct CoalescerStats
+{
+  size_t writes;        // writes passed to write()
+  size_t direct;        // writes too large to stage, sent on their own
+  size_t flushes;
+  size_t launches;      // scatter kernels enqueued
+  size_t bytes;
+};
+
+class WriteCoalescer
+{
+public:
+  //! Writes are staged until capacity bytes are pending, then flushed
+  WriteCoalescer(const cl::Context& context, const cl::Device& device,
+                 const cl::CommandQueue& queue, size_t capacity = 4*1024*1024)
+    : context_(context), queue_(queue), capacity_(capacity), used_(0),
+      tableCapacity_(0)
+  {
+    program_ = cl::Program(context, write_coalescer_source);
+    program_.build(std::vector<cl::Device>(1, device));
+    scatter_ = cl::Kernel(program_, "scatter");
+
+    size_t maxWG = scatter_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    wgsize_ = std::min(maxWG, (size_t)64);
+
+    // Staging offsets go in the 32-bit table too
+    if (capacity_ > (size_t)CL_UINT_MAX)
+      throw cl::Error(CL_INVALID_VALUE, "WriteCoalescer: capacity must be below 4 GB");
+
+    host_.resize(capacity_);
+    staging_ = cl::Buffer(context, CL_MEM_READ_ONLY, capacity_);
+
+    stats_.writes   = 0;
+    stats_.direct   = 0;
+    stats_.flushes  = 0;
+    stats_.launches = 0;
+    stats_.bytes    = 0;
+  }
+
+  ~WriteCoalescer()
+  {
+    try
+    {
+      flush();
+      waitUpload();
+    }
+    catch (...)
+    {
+    }
+  }
+
+  //! Queue a write of size bytes from src to dst at offset. The source is
+  //! copied immediately, so it can be reused as soon as this returns.
+  void write(const cl::Buffer& dst, size_t offset, size_t size, const void *src)
+  {
+    stats_.writes++;
+    stats_.bytes += size;
+    if (size == 0)
+      return;
+
+    // Nothing to gain from staging large writes, and the table cannot
+    // address beyond 4 GB
+    if (size > capacity_ / 4 || offset + size > (size_t)CL_UINT_MAX)
+    {
+      flush();
+      queue_.enqueueWriteBuffer(dst, CL_TRUE, offset, size, src);
+      stats_.direct++;
+      return;
+    }
+
+    // Keep every entry word aligned in the staging area
+    size_t padded = (size + 3) & ~(size_t)3;
+    if (used_ + padded > capacity_ || overlapsPending(dst, offset, size))
+      flush();
+
+    // The previous flush may still be reading the staging area
+    waitUpload();
+
+    memcpy(&host_[used_], src, size);
+    cl_uint4 entry = {{ (cl_uint)used_, (cl_uint)offset, (cl_uint)size, 0 }};
+    Target& t = target(dst);
+    t.entries.push_back(entry);
+    t.ranges[offset] = offset + size;
+    used_ += padded;
+  }
+
+  //! Upload everything staged so far and scatter it. The returned event
+  //! completes when the last scatter kernel has finished.
+  cl::Event flush()
+  {
+    cl::Event event;
+    if (targets_.empty())
+      return event;
+
+    std::vector<cl_uint4> table;
+    for (size_t t = 0; t < targets_.size(); t++)
+      table.insert(table.end(),
+                   targets_[t].entries.begin(), targets_[t].entries.end());
+
+    if (table.size() > tableCapacity_)
+    {
+      tableCapacity_ = std::max(table.size(), 2*tableCapacity_);
+      table_ = cl::Buffer(context_, CL_MEM_READ_ONLY,
+                          tableCapacity_ * sizeof(cl_uint4));
+    }
+    hostTable_.swap(table);
+
+    queue_.enqueueWriteBuffer(staging_, CL_FALSE, 0, used_, &host_[0]);
+    queue_.enqueueWriteBuffer(table_, CL_FALSE, 0,
+                              hostTable_.size() * sizeof(cl_uint4),
+                              &hostTable_[0], NULL, &upload_);
+
+    cl_uint first = 0;
+    for (size_t t = 0; t < targets_.size(); t++)
+    {
+      cl_uint count = (cl_uint)targets_[t].entries.size();
+      scatter_.setArg(0, staging_);
+      scatter_.setArg(1, table_);
+      scatter_.setArg(2, first);
+      scatter_.setArg(3, targets_[t].buffer);
+      queue_.enqueueNDRangeKernel(scatter_, cl::NullRange,
+                                  cl::NDRange(count * wgsize_),
+                                  cl::NDRange(wgsize_), NULL, &event);
+      first += count;
+      stats_.launches++;
+    }
+    queue_.flush();
+
+    targets_.clear();
+    used_ = 0;
+    stats_.flushes++;
+    return event;
+  }
+
+  //! Bytes currently staged and not yet flushed
+  size_t pending() const { return used_; }
+
+  const CoalescerStats& getStats() const { return stats_; }
+
+private:
+  struct Target
+  {
+    cl::Buffer               buffer;
+    std::vector<cl_uint4>    entries;
+    std::map<size_t, size_t> ranges;    // Staged byte ranges, start to end
+  };
+
+  // Whether [offset, offset+size) overlaps a write staged for buffer. The
+  // staged ranges never overlap each other, so only the neighbours matter.
+  bool overlapsPending(const cl::Buffer& buffer, size_t offset, size_t size) const
+  {
+    for (size_t t = 0; t < targets_.size(); t++)
+    {
+      if (targets_[t].buffer() != buffer())
+        continue;
+
+      const std::map<size_t, size_t>& ranges = targets_[t].ranges;
+      std::map<size_t, size_t>::const_iterator next = ranges.upper_bound(offset);
+      if (next != ranges.end() && next->first < offset + size)
+        return true;
+      if (next != ranges.begin())
+      {
+        --next;
+        if (next->second > offset)
+          return true;
+      }
+      return false;
+    }
+    return false;
+  }
+
+  // Entries are grouped by destination, since each needs its own launch
+  Target& target(const cl::Buffer& buffer)
+  {
+    for (size_t t = 0; t < targets_.size(); t++)
+    {
+      if (targets_[t].buffer() == buffer())
+        return targets_[t];
+    }
+    targets_.push_back(Target());
+    targets_.back().buffer = buffer;
+    return targets_.back();
+  }
+
+  void waitUpload()
+  {
+    if (upload_())
+    {
+      upload_.wait();
+      upload_ = cl::Event();
+    }
+  }
+
+  WriteCoalescer(const WriteCoalescer&);
+  WriteCoalescer& operator=(const WriteCoalescer&);
+
+  cl::Context           context_;
+  cl::CommandQueue      queue_;
+  cl::Program           program_;
+  cl::Kernel            scatter_;
+  size_t                wgsize_;
+
+  size_t                capacity_;
+  size_t                used_;
+  std::vector<char>     host_;
+  cl::Buffer            staging_;
+
+  size_t                tableCapacity_;
+  std::vector<cl_uint4> hostTable_;
+  cl::Buffer            table_;
+  cl::Event             upload_;
+
+  std::vector<Target>   targets_;
+  CoalescerStats        stats_;
+};
+
+} // namespace util
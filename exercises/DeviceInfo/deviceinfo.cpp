@@ -2,7 +2,9 @@
  * Display Device Information
  *
  * Script to print out some information about the OpenCL devices
- * and platforms available on your system
+ * and platforms available on your system. Unless --no-probe is given,
+ * each device is also measured (see device_probe.hpp) and its profile
+ * written as JSON to the device cache, and to --output DIR if given.
  *
  * History: C++ version written by Tom Deakin, 2012
  *          Updated by Tom Deakin, August 2013
@@ -18,6 +20,9 @@
  *
  */
 
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <vector>
 
@@ -30,9 +35,19 @@
 #include <CL/cl2.hpp>
 
 #include <device_picker.hpp>
+#include <device_probe.hpp>
 
-int main(void)
+cl_uint     deviceIndex = DEVICE_ALL;
+bool        probe = true;
+std::string outputDir;
+
+void parseArguments(int argc, char *argv[]);
+void printProfile(const util::DeviceProfile& profile);
+
+int main(int argc, char *argv[])
 {
+  parseArguments(argc, argv);
+
   try
   {
     // Discover number of platforms
@@ -40,7 +55,17 @@ int main(void)
     cl::Platform::get(&platforms);
     std::cout << "\nNumber of OpenCL plaforms: " << platforms.size() << std::endl;
 
-    // Investigate each platform
+    // Check device index in range
+    std::vector<cl::Device> allDevices;
+    if (deviceIndex != DEVICE_ALL && deviceIndex >= getDeviceList(allDevices))
+    {
+      std::cout << "Invalid device index" << std::endl;
+      return 1;
+    }
+
+    // Investigate each platform. Device indices count across platforms,
+    // in the same order as getDeviceList()
+    unsigned index = 0;
     std::cout << "\n-------------------------" << std::endl;
     for (std::vector<cl::Platform>::iterator plat = platforms.begin(); plat != platforms.end(); plat++)
     {
@@ -62,6 +87,9 @@ int main(void)
       // Investigate each device
       for (std::vector<cl::Device>::iterator dev = devices.begin(); dev != devices.end(); dev++ )
       {
+        if (deviceIndex != DEVICE_ALL && index++ != deviceIndex)
+          continue;
+
         std::cout << "\t-------------------------" << std::endl;
 
         std::cout << "\t\tName: " << getDeviceName(*dev) << std::endl;
@@ -94,6 +122,35 @@ int main(void)
           std::cout << *st << " ";
         std::cout << "\x08)" << std::endl;
 
+        if (probe)
+        {
+          try
+          {
+            cl::Context context(*dev);
+            util::DeviceProfile profile = util::probeDevice(context, *dev);
+            printProfile(profile);
+
+            if (util::saveDeviceProfile(profile))
+              std::cout << "\t\tProfile: " << util::deviceProfilePath(profile.key) << std::endl;
+            if (!outputDir.empty())
+            {
+              std::string path = outputDir + "/profile-" + profile.key + ".json";
+              std::ofstream out(path.c_str());
+              util::writeDeviceProfile(out, profile);
+              if (out.good())
+                std::cout << "\t\tProfile: " << path << std::endl;
+              else
+                std::cout << "\t\tCannot write " << path << std::endl;
+            }
+          }
+          catch (cl::Error& err)
+          {
+            // Carry on with the other devices
+            std::cout << "\t\tProbe failed: " << err.what()
+                      << " (" << err_code(err.err()) << ")" << std::endl;
+          }
+        }
+
         std::cout << "\t-------------------------" << std::endl;
 
       }
@@ -119,3 +176,71 @@ int main(void)
 
   return 0;
 }
+
+void printProfile(const util::DeviceProfile& p)
+{
+  std::ios::fmtflags flags = std::cout.flags();
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "\t\tMeasured:" << std::endl;
+  std::cout << "\t\t  FP32:              " << p.fp32Gflops << " GFLOP/s" << std::endl;
+  if (p.fp64Gflops > 0)
+    std::cout << "\t\t  FP64:              " << p.fp64Gflops << " GFLOP/s" << std::endl;
+  if (p.fp16Gflops > 0)
+    std::cout << "\t\t  FP16:              " << p.fp16Gflops << " GFLOP/s" << std::endl;
+  std::cout << "\t\t  Global bandwidth:  " << p.globalBandwidthGBs << " GB/s" << std::endl;
+  std::cout << "\t\t  Local bandwidth:   " << p.localBandwidthGBs << " GB/s" << std::endl;
+  std::cout << std::setprecision(3);
+  std::cout << "\t\t  Atomics:           " << p.atomicContendedGops << " Gop/s contended, "
+            << p.atomicDistributedGops << " Gop/s distributed" << std::endl;
+  std::cout << std::setprecision(1);
+  std::cout << "\t\t  Launch latency:    " << p.launchLatencyUs << " us" << std::endl;
+  std::cout << "\t\t  Ridge point:       "
+            << p.fp32Gflops / p.globalBandwidthGBs << " FLOP/byte" << std::endl;
+  std::cout.flags(flags);
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--no-probe"))
+    {
+      probe = false;
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex))
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--output") || !strcmp(argv[i], "-o"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid output directory" << std::endl;
+        exit(1);
+      }
+      outputDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./deviceinfo-c++ [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --device   INDEX     Only report device at INDEX, or 'auto'" << std::endl;
+      std::cout << "      --no-probe           Only print what devices report" << std::endl;
+      std::cout << "  -o  --output   DIR       Also write JSON profiles to DIR" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}
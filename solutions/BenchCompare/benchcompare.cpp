@@ -0,0 +1,160 @@
+//
+// Benchmark comparison
+//
+// Compares the results the solutions wrote with the benchmark harness
+// (common/bench.hpp) against a stored baseline, and fails if any median
+// time got slower by more than the threshold, if a result in the baseline
+// is missing, or if the baseline is from another device. `make bench` in the solutions
+// directory runs the solutions and then this; `make bench-baseline` stores
+// their results as the new baseline.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <bench.hpp>
+
+void parseArguments(int argc, char *argv[]);
+
+// Parameters, with default values.
+std::string baselineDir = "../bench/baseline";
+std::string resultsDir  = "../bench/results";
+double      threshold   = 10.0;   // Percent slower that counts as a regression
+bool        allowDeviceMismatch = false;
+std::vector<std::string> names;   // Benchmarks to compare
+
+int main(int argc, char *argv[])
+{
+  parseArguments(argc, argv);
+
+  if (names.empty())
+  {
+    std::cout << "No benchmarks to compare (try '--help')" << std::endl;
+    return 1;
+  }
+
+  unsigned regressions = 0, missing = 0, mismatched = 0;
+  std::cout << std::endl
+            << "Benchmark                   Baseline (ms) Current (ms)  Change" << std::endl
+            << "----------------------------------------------------------------" << std::endl;
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    std::cout << names[i] << std::endl;
+
+    util::BenchFile current, baseline;
+    if (!util::readBenchResults(resultsDir + "/" + names[i] + ".json", current))
+    {
+      std::cout << "  no results" << std::endl;
+      missing++;
+      continue;
+    }
+    if (!util::readBenchResults(baselineDir + "/" + names[i] + ".json", baseline))
+      std::cout << "  (no baseline)" << std::endl;
+
+    util::BenchComparison comparison =
+      util::compareBench(baseline, current, threshold / 100.0, allowDeviceMismatch);
+    regressions += comparison.regressions;
+    missing     += comparison.missing;
+    mismatched  += comparison.deviceMismatch ? 1 : 0;
+  }
+
+  std::cout << std::endl;
+  if (missing)
+    std::cout << missing << " baseline results (or whole benchmarks) are missing"
+              << std::endl;
+  if (mismatched)
+    std::cout << mismatched << " baselines are from another device"
+                 " (use '--allow-device-mismatch' to compare anyway)" << std::endl;
+  if (regressions)
+    std::cout << regressions << " results regressed by more than " << threshold
+              << "%" << std::endl;
+  if (regressions || missing || mismatched)
+    return 1;
+  std::cout << "No regressions beyond " << threshold << "%" << std::endl;
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--baseline"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid baseline directory" << std::endl;
+        exit(1);
+      }
+      baselineDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--results"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid results directory" << std::endl;
+        exit(1);
+      }
+      resultsDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--threshold"))
+    {
+      char *next;
+      if (++i >= argc || (threshold = strtod(argv[i], &next), *next) || threshold < 0)
+      {
+        std::cout << "Invalid threshold" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--allow-device-mismatch"))
+    {
+      allowDeviceMismatch = true;
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./benchcompare [OPTIONS] NAME..." << std::endl << std::endl;
+      std::cout << "Compares NAME.json in the results and baseline directories" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --baseline   DIR     Directory of baseline results" << std::endl;
+      std::cout << "      --results    DIR     Directory of current results" << std::endl;
+      std::cout << "      --threshold  PCT     Slowdown that fails (default 10)" << std::endl;
+      std::cout << "      --allow-device-mismatch" << std::endl;
+      std::cout << "                           Compare against a baseline from another device" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else if (argv[i][0] != '-')
+    {
+      names.push_back(argv[i]);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}
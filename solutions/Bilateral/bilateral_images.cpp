@@ -40,6 +40,8 @@ HostImage* createHostImage(int width, int height);
 
 #include <device_picker.hpp>
 #include <util.hpp>
+#include <program_cache.hpp>
+#include <bench.hpp>
 
 #undef main
 #undef min
@@ -96,7 +98,6 @@ int main(int argc, char *argv[])
 
     cl::Context context(device);
     cl::CommandQueue queue(context);
-    cl::Program program(context, util::loadProgram("bilateral_images.cl"));
 
     std::stringstream options;
     options.setf(std::ios::fixed);
@@ -105,7 +106,8 @@ int main(int argc, char *argv[])
     options << " -DRADIUS=" << radius;
     options << " -DSIGMA_DOMAIN=" << sigmaDomain;
     options << " -DSIGMA_RANGE=" << sigmaRange;
-    program.build(options.str().c_str());
+    cl::Program program = util::buildProgram(context, device, util::loadProgram("bilateral_images.cl"),
+                                             options.str());
 
     cl::KernelFunctor<cl::Image2D, cl::Image2D>
       kernel(program, "bilateral");
@@ -149,16 +151,20 @@ int main(int argc, char *argv[])
 
     // Apply filter
     std::cout << "Running OpenCL..." << std::endl;
-    util::Timer timer;
-    uint64_t startTime = timer.getTimeMicroseconds();
-    for (unsigned i = 0; i < iterations; i++)
+    util::Benchmark bench("bilateral_images", device);
+    bench.param("width", image->w);
+    bench.param("height", image->h);
+    bench.param("radius", radius);
+    bench.param("iterations", iterations);
+    double total = bench.time("filter", [&]()
     {
-      kernel(cl::EnqueueArgs(queue, global, wgsize),
-             input, output);
-    }
-    queue.finish();
-    uint64_t endTime = timer.getTimeMicroseconds();
-    double total = ((endTime-startTime)*1e-3);
+      for (unsigned i = 0; i < iterations; i++)
+      {
+        kernel(cl::EnqueueArgs(queue, global, wgsize),
+               input, output);
+      }
+      queue.finish();
+    }, (double)image->w*image->h*iterations*1e-6, "Mpixels/s").median;
     std::cout << std::fixed << std::setprecision(1);
     std::cout << "OpenCL took " << total << "ms"
               << " (" << (total/iterations) << "ms / frame)"
@@ -187,9 +193,10 @@ int main(int argc, char *argv[])
 #ifdef USE_SDL
       SDL_LockSurface(image);
 #endif
-      startTime = timer.getTimeMicroseconds();
+      util::Timer timer;
+      uint64_t startTime = timer.getTimeMicroseconds();
       runReference((uint8_t*)image->pixels, reference, image->w, image->h);
-      endTime = timer.getTimeMicroseconds();
+      uint64_t endTime = timer.getTimeMicroseconds();
       std::cout << "Reference took " << ((endTime-startTime)*1e-3) << "ms"
                 << std::endl << std::endl;
 
@@ -236,6 +243,8 @@ int main(int argc, char *argv[])
 
       delete[] reference;
     }
+
+    bench.write();
   }
   catch (cl::BuildError error)
   {
@@ -297,7 +306,8 @@ void parseArguments(int argc, char *argv[])
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], &deviceIndex))
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_COMPUTE) ||
+          deviceIndex == DEVICE_ALL)
       {
         std::cout << "Invalid device index" << std::endl;
         exit(1);
@@ -388,7 +398,7 @@ void parseArguments(int argc, char *argv[])
       std::cout << "Options:" << std::endl;
       std::cout << "  -h  --help               Print the message" << std::endl;
       std::cout << "      --list               List available devices" << std::endl;
-      std::cout << "      --device     INDEX   Select device at INDEX" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
       std::cout << "      --image      FILE    Use FILE as input (must be 32-bit RGBA)" << std::endl;
       std::cout << "  -i  --iterations ITRS    Number of benchmark iterations" << std::endl;
       std::cout << "      --noverify           Skip verification" << std::endl;
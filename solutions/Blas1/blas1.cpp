@@ -0,0 +1,362 @@
+//
+// OpenCL BLAS level 1 benchmark
+//
+// Checks and times each routine in common/blas1.hpp and compares the
+// bandwidth it achieves with the STREAM copy/triad bandwidth of the device.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <bench.hpp>
+#include <blas1.hpp>
+#include <device_picker.hpp>
+#include <util.hpp>
+
+void parseArguments(int argc, char *argv[]);
+
+// Benchmark parameters, with default values.
+unsigned deviceIndex   =      0;
+unsigned length        =     16; // Vector length in millions of elements
+unsigned iterations    =     32;
+unsigned vectorWidth   =      0; // 0 uses the device's preferred width
+unsigned unroll        =      0; // 0 picks one from the vector width
+float    tolerance     =   1e-3f;
+
+const char *stream_source =
+"kernel void stream_copy(global const float *a, global float *c)"
+"{"
+"  const size_t i = get_global_id(0);"
+"  c[i] = a[i];"
+"}"
+"kernel void stream_triad(global float *a, global const float *b,"
+"                         global const float *c, const float scalar)"
+"{"
+"  const size_t i = get_global_id(0);"
+"  a[i] = b[i] + scalar*c[i];"
+"}";
+
+// Run f() a number of times after a warm-up and return the average seconds
+template <typename F>
+double timeIterations(util::Benchmark& bench, const char *name,
+                      cl::CommandQueue& queue, F f)
+{
+  f();
+  queue.finish();
+
+  const util::BenchResult& result = bench.time(name, [&]() {
+    for (unsigned i = 0; i < iterations; i++)
+      f();
+    queue.finish();
+  });
+
+  return result.median * 1e-3 / iterations;
+}
+
+void printResult(const char *name, double bytes, double seconds, double ceiling)
+{
+  double bandwidth = bytes / seconds * 1e-9;
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::setw(12) << seconds*1e3 << " ms"
+            << std::setw(12) << bandwidth << " GB/s"
+            << std::setw(10) << (bandwidth / ceiling) * 100 << " %"
+            << std::endl;
+}
+
+bool check(const char *name, double value, double reference)
+{
+  double error = fabs(value - reference) / std::max(fabs(reference), 1.0);
+  if (error > tolerance)
+  {
+    std::cout << "Verification of " << name << " failed: got " << value
+              << ", expected " << reference << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parseArguments(argc, argv);
+
+    // Get list of devices
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+
+    // Check device index in range
+    if (deviceIndex >= devices.size())
+    {
+      std::cout << "Invalid device index (try '--list')" << std::endl;
+      return 1;
+    }
+
+    cl::Device device = devices[deviceIndex];
+
+    std::string name = getDeviceName(device);
+    std::cout << std::endl << "Using OpenCL device: " << name << std::endl;
+
+    cl::Context context(device);
+    cl::CommandQueue queue(context);
+
+    util::Blas1 blas(context, device, vectorWidth, unroll);
+
+    util::Benchmark bench("blas1", device);
+
+    cl_uint n = length * 1000 * 1000;
+    size_t bytes = n * sizeof(cl_float);
+    std::cout << "Vector length = " << n << std::endl
+              << "Vector width  = " << blas.getVectorWidth() << std::endl
+              << "Unroll        = " << blas.getUnroll() << std::endl
+              << "Iterations    = " << iterations << std::endl
+              << std::endl;
+    bench.param("length", n);
+    bench.param("vector_width", blas.getVectorWidth());
+    bench.param("unroll", blas.getUnroll());
+    bench.param("iterations", iterations);
+
+    std::vector<float> h_x(n), h_y(n);
+    for (cl_uint i = 0; i < n; i++)
+    {
+      h_x[i] = (rand() / (float)RAND_MAX) - 0.5f;
+      h_y[i] = (rand() / (float)RAND_MAX) - 0.5f;
+    }
+
+    cl::Buffer d_x(context, CL_MEM_READ_WRITE, bytes);
+    cl::Buffer d_y(context, CL_MEM_READ_WRITE, bytes);
+    cl::Buffer d_z(context, CL_MEM_READ_WRITE, bytes);
+    cl::Buffer d_sum(context, CL_MEM_READ_WRITE, sizeof(cl_float));
+    cl::Buffer d_index(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+    cl::copy(queue, h_x.begin(), h_x.end(), d_x);
+    cl::copy(queue, h_y.begin(), h_y.end(), d_y);
+
+    // Check the reductions against the host
+    double dot = 0.0, sumsq = 0.0, asum = 0.0;
+    cl_uint imax = 0;
+    for (cl_uint i = 0; i < n; i++)
+    {
+      dot   += (double)h_x[i] * h_y[i];
+      sumsq += (double)h_x[i] * h_x[i];
+      asum  += fabs(h_x[i]);
+      if (fabs(h_x[i]) > fabs(h_x[imax]))
+        imax = i;
+    }
+
+    bool pass = true;
+    cl_float result;
+    cl_uint  index;
+    blas.dot(queue, n, d_x, d_y, d_sum);
+    queue.enqueueReadBuffer(d_sum, CL_TRUE, 0, sizeof(result), &result);
+    pass &= check("dot", result, dot);
+    blas.nrm2(queue, n, d_x, d_sum);
+    queue.enqueueReadBuffer(d_sum, CL_TRUE, 0, sizeof(result), &result);
+    pass &= check("nrm2", result, sqrt(sumsq));
+    blas.asum(queue, n, d_x, d_sum);
+    queue.enqueueReadBuffer(d_sum, CL_TRUE, 0, sizeof(result), &result);
+    pass &= check("asum", result, asum);
+    blas.iamax(queue, n, d_x, d_index);
+    queue.enqueueReadBuffer(d_index, CL_TRUE, 0, sizeof(index), &index);
+    pass &= check("iamax", index, imax);
+
+    // Check the element-wise routines: z = x, swap(y, z), y = 2y, y = 3x + y
+    std::vector<float> h_out(n);
+    blas.copy(queue, n, d_x, d_z);
+    blas.swap(queue, n, d_y, d_z);
+    blas.scal(queue, n, 2.0f, d_y);
+    blas.axpy(queue, n, 3.0f, d_x, d_y);
+    cl::copy(queue, d_y, h_out.begin(), h_out.end());
+    bool elementwise = true;
+    for (cl_uint i = 0; i < n && elementwise; i++)
+      elementwise = check("copy/swap/scal/axpy", h_out[i], 5.0*h_x[i]);
+    cl::copy(queue, d_z, h_out.begin(), h_out.end());
+    for (cl_uint i = 0; i < n && elementwise; i++)
+      elementwise = check("swap", h_out[i], h_y[i]);
+    pass &= elementwise;
+
+    // STREAM ceiling
+    cl::Program program(context, stream_source, true);
+    cl::KernelFunctor<cl::Buffer, cl::Buffer> streamCopy(program, "stream_copy");
+    cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl_float>
+      streamTriad(program, "stream_triad");
+
+    double copyTime = timeIterations(bench, "STREAM copy", queue, [&]() {
+      streamCopy(cl::EnqueueArgs(queue, cl::NDRange(n)), d_x, d_z);
+    });
+    double triadTime = timeIterations(bench, "STREAM triad", queue, [&]() {
+      streamTriad(cl::EnqueueArgs(queue, cl::NDRange(n)), d_z, d_x, d_y, 0.5f);
+    });
+    double ceiling = std::max(2*bytes / copyTime, 3*bytes / triadTime) * 1e-9;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Routine             Time        Bandwidth    STREAM" << std::endl
+              << "---------------------------------------------------" << std::endl;
+    printResult("STREAM copy", 2*bytes, copyTime, ceiling);
+    printResult("STREAM triad", 3*bytes, triadTime, ceiling);
+
+    printResult("copy", 2*bytes, timeIterations(bench, "copy", queue, [&]() {
+      blas.copy(queue, n, d_x, d_z);
+    }), ceiling);
+    printResult("swap", 4*bytes, timeIterations(bench, "swap", queue, [&]() {
+      blas.swap(queue, n, d_y, d_z);
+    }), ceiling);
+    printResult("scal", 2*bytes, timeIterations(bench, "scal", queue, [&]() {
+      blas.scal(queue, n, 1.0f, d_y);
+    }), ceiling);
+    printResult("axpy", 3*bytes, timeIterations(bench, "axpy", queue, [&]() {
+      blas.axpy(queue, n, 1e-6f, d_x, d_y);
+    }), ceiling);
+    printResult("dot", 2*bytes, timeIterations(bench, "dot", queue, [&]() {
+      blas.dot(queue, n, d_x, d_y, d_sum);
+    }), ceiling);
+    printResult("nrm2", bytes, timeIterations(bench, "nrm2", queue, [&]() {
+      blas.nrm2(queue, n, d_x, d_sum);
+    }), ceiling);
+    printResult("asum", bytes, timeIterations(bench, "asum", queue, [&]() {
+      blas.asum(queue, n, d_x, d_sum);
+    }), ceiling);
+    printResult("iamax", bytes, timeIterations(bench, "iamax", queue, [&]() {
+      blas.iamax(queue, n, d_x, d_index);
+    }), ceiling);
+
+    std::cout << std::endl << (pass ? "Verification passed" : "Verification FAILED")
+              << std::endl;
+    bench.write();
+  }
+  catch (cl::BuildError error)
+  {
+    std::string log = error.getBuildLog()[0].second;
+    std::cerr << std::endl << "Build failed:" << std::endl << log << std::endl;
+  }
+  catch (cl::Error err)
+  {
+    std::cout << "Exception:" << std::endl
+              << "ERROR: "
+              << err.what()
+              << "("
+              << err_code(err.err())
+              << ")"
+              << std::endl;
+  }
+  std::cout << std::endl;
+
+#if defined(_WIN32)
+  system("pause");
+#endif
+
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--list"))
+    {
+      // Get list of devices
+      std::vector<cl::Device> devices;
+      getDeviceList(devices);
+
+      // Print device names
+      if (devices.size() == 0)
+      {
+        std::cout << "No devices found." << std::endl;
+      }
+      else
+      {
+        std::cout << std::endl;
+        std::cout << "Devices:" << std::endl;
+        for (unsigned i = 0; i < devices.size(); i++)
+        {
+          std::cout << i << ": " << getDeviceName(devices[i]) << std::endl;
+        }
+        std::cout << std::endl;
+      }
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_MEMORY) ||
+          deviceIndex == DEVICE_ALL)
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--length") || !strcmp(argv[i], "-n"))
+    {
+      // The kernels index with cl_uint
+      if (++i >= argc || !parseUInt(argv[i], &length) || length == 0 ||
+          length > CL_UINT_MAX / (1000 * 1000))
+      {
+        std::cout << "Invalid vector length" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--iterations") || !strcmp(argv[i], "-i"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &iterations) || iterations == 0)
+      {
+        std::cout << "Invalid number of iterations" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--width"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &vectorWidth))
+      {
+        std::cout << "Invalid vector width" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--unroll"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &unroll))
+      {
+        std::cout << "Invalid unroll factor" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./blas1 [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --list               List available devices" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
+      std::cout << "  -n  --length     N       Vector length in millions of elements" << std::endl;
+      std::cout << "  -i  --iterations ITRS    Number of benchmark iterations" << std::endl;
+      std::cout << "      --width      W       Vector width (1, 2, 4, 8 or 16)" << std::endl;
+      std::cout << "      --unroll     U       Unroll factor" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}
@@ -12,27 +12,31 @@
  *
  */
 
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <vector>
 
-#ifdef __APPLE__
-#define CL_SILENCE_DEPRECATION
-#endif
-#define CL_HPP_ENABLE_EXCEPTIONS
-#define CL_HPP_TARGET_OPENCL_VERSION 120
-#define CL_HPP_MINIMUM_OPENCL_VERSION 120
-#include <CL/cl2.hpp>
+#include "transfer.hpp"
+
+#include <bench.hpp>
+#include <staging_pool.hpp>
+#include <transfer_strategy.hpp>
 
 #include <device_picker.hpp>
-#include <util.hpp>
 
 void parseArguments(int argc, char *argv[]);
 
 // Benchmark parameters, with default values.
-unsigned deviceIndex   =      0;
-unsigned bufferSize    =      2; // Size in MB
-unsigned iterations    =     32;
+unsigned    deviceIndex   =      0;
+unsigned    bufferSize    =      2; // Size in MB
+unsigned    iterations    =     32;
+unsigned    minSizeKB     =      4;
+unsigned    maxSizeMB     =   1024;
+std::string outputFile    =     "";
+unsigned    numChunks     =      8;
+std::string inputFile     =     "";
+std::string mode          = "basic";
 
 const char *kernel_source =
 "kernel void fill(global uint *data, uint value)"
@@ -54,15 +58,19 @@ bool checkOutput(cl_uint *data, cl_uint value)
   return pass;
 }
 
-void runBenchmark(cl::Context& context, cl::CommandQueue& queue,
+void runBenchmark(util::Benchmark& bench, const char *name,
+                  cl::Context& context, cl::CommandQueue& queue,
                   cl::KernelFunctor<cl::Buffer, cl_uint> fill,
                   cl::Buffer& d_buffer, // device buffer
                   cl_uint    *h_buffer, // host buffer, ignored for zero-copy
-                  bool zeroCopy)
+                  bool zeroCopy,
+                  util::StagingPool *pool = NULL, // read through pinned blocks
+                  util::TransferStrategy *strategy = NULL) // measured fastest path
 {
   bool pass = true;
   util::Timer timer;
   uint64_t transferTime = 0;
+  std::vector<double> samples;
   uint64_t startTime = timer.getTimeMicroseconds();
   for (cl_uint i = 0; i < iterations; i++)
   {
@@ -79,6 +87,15 @@ void runBenchmark(cl::Context& context, cl::CommandQueue& queue,
         d_buffer, CL_TRUE, CL_MAP_READ, 0, bufferSize
       );
     }
+    else if (strategy)
+    {
+      strategy->download(d_buffer, 0, bufferSize, h_buffer);
+    }
+    else if (pool)
+    {
+      // Read in chunks through the pinned staging blocks
+      pool->download(d_buffer, 0, bufferSize, h_buffer);
+    }
     else
     {
       // Read data from device buffer to host buffer
@@ -96,6 +113,7 @@ void runBenchmark(cl::Context& context, cl::CommandQueue& queue,
     }
 
     transferTime += (endTransfer - startTransfer);
+    samples.push_back((endTransfer - startTransfer) * 1e-3);
   }
   queue.finish();
 
@@ -104,6 +122,8 @@ void runBenchmark(cl::Context& context, cl::CommandQueue& queue,
   double seconds    = (endTime - startTime) * 1e-6;
   double totalBytes = iterations * (double)bufferSize;
   double bandwidth  = (totalBytes / transferTime) * 1e-3;
+  if (pass)
+    bench.record(name, samples, bufferSize * 1e-9, "GB/s");
   std::cout << std::fixed << std::setprecision(2);
   if (pass)
   {
@@ -122,6 +142,89 @@ void runBenchmark(cl::Context& context, cl::CommandQueue& queue,
   }
 }
 
+// Compare the baseline read with zero-copy (host-unified) or pinned reads,
+// and with whichever path TransferStrategy measured as fastest
+void runBasic(util::Benchmark& bench, cl::Context& context, cl::Device& device,
+              cl::CommandQueue& queue, bool unifiedMemory)
+{
+  util::TransferStrategy strategy(context, device, queue);
+  std::cout << "Transfer strategy"
+            << (strategy.fromCache() ? " (cached)" : " (measured)") << ":" << std::endl;
+  strategy.print(std::cout);
+  std::cout << std::endl;
+
+  cl::Program program(context, kernel_source, true);
+  cl::KernelFunctor<cl::Buffer, cl_uint> fill(program, "fill");
+
+  std::cout << "Type          Total   Transfer       Bandwidth" << std::endl
+            << "----------------------------------------------" << std::endl;
+
+
+  // Baseline - using a regular buffer with enqueueReadBuffer
+  {
+    // Create device buffer
+    cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
+
+    // Create host buffer
+    cl_uint *h_buffer = new cl_uint[bufferSize/4];
+
+    std::cout << "Baseline ";
+    runBenchmark(bench, "baseline", context, queue, fill, d_buffer, h_buffer, false);
+
+    delete[] h_buffer;
+  }
+
+  if (unifiedMemory)
+  {
+    // Create a host-accessible device buffer
+    cl::Buffer d_buffer(context, CL_MEM_ALLOC_HOST_PTR, bufferSize);
+
+    // No separate host buffer needed
+
+    std::cout << "Zero-Copy";
+    runBenchmark(bench, "zero-copy", context, queue, fill, d_buffer, NULL, true);
+  }
+  else
+  {
+    // Create device buffer
+    cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
+
+    // Create a pinned host buffer (using a mapped device buffer)
+    cl::Buffer d_pinned(context, CL_MEM_ALLOC_HOST_PTR, bufferSize);
+    cl_uint *h_pinned = (cl_uint*)queue.enqueueMapBuffer(
+      d_pinned, CL_TRUE, CL_MAP_READ, 0, bufferSize
+    );
+
+    std::cout << "Pinned   ";
+    runBenchmark(bench, "pinned", context, queue, fill, d_buffer, h_pinned, false);
+
+    // Unmap pinned host buffer
+    queue.enqueueUnmapMemObject(d_pinned, h_pinned);
+
+    // Pageable host buffer, staged through a pool of pinned blocks
+    cl_uint *h_buffer = new cl_uint[bufferSize/4];
+    {
+      util::StagingPool pool(context, queue);
+
+      std::cout << "Staged   ";
+      runBenchmark(bench, "staged", context, queue, fill, d_buffer, h_buffer, false, &pool);
+    }
+    delete[] h_buffer;
+  }
+
+  // Whatever was measured to be fastest at this size
+  {
+    cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
+    cl_uint *h_buffer = new cl_uint[bufferSize/4];
+
+    std::cout << "Auto     ";
+    runBenchmark(bench, "auto", context, queue, fill, d_buffer, h_buffer, false,
+                 NULL, &strategy);
+
+    delete[] h_buffer;
+  }
+}
+
 int main(int argc, char *argv[])
 {
   try
@@ -158,54 +261,36 @@ int main(int argc, char *argv[])
 
     cl::Context context(device);
     cl::CommandQueue queue(context);
-    cl::Program program(context, kernel_source, true);
-    cl::KernelFunctor<cl::Buffer, cl_uint> fill(program, "fill");
-
-    std::cout << "Type          Total   Transfer       Bandwidth" << std::endl
-              << "----------------------------------------------" << std::endl;
-
-
-    // Baseline - using a regular buffer with enqueueReadBuffer
-    {
-      // Create device buffer
-      cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
-
-      // Create host buffer
-      cl_uint *h_buffer = new cl_uint[bufferSize/4];
 
-      std::cout << "Baseline ";
-      runBenchmark(context, queue, fill, d_buffer, h_buffer, false);
+    // Only the basic mode records results
+    util::Benchmark bench("transfer", device);
+    bench.param("mode", mode);
+    bench.param("buffer_bytes", bufferSize);
+    bench.param("iterations", iterations);
 
-      delete[] h_buffer;
-    }
-
-    if (unifiedMemory)
-    {
-      // Create a host-accessible device buffer
-      cl::Buffer d_buffer(context, CL_MEM_ALLOC_HOST_PTR, bufferSize);
-
-      // No separate host buffer needed
-
-      std::cout << "Zero-Copy";
-      runBenchmark(context, queue, fill, d_buffer, NULL, true);
-    }
-    else
+    if (mode == "basic")
     {
-      // Create device buffer
-      cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
-
-      // Create a pinned host buffer (using a mapped device buffer)
-      cl::Buffer d_pinned(context, CL_MEM_ALLOC_HOST_PTR, bufferSize);
-      cl_uint *h_pinned = (cl_uint*)queue.enqueueMapBuffer(
-        d_pinned, CL_TRUE, CL_MAP_READ, 0, bufferSize
-      );
-
-      std::cout << "Pinned   ";
-      runBenchmark(context, queue, fill, d_buffer, h_pinned, false);
-
-      // Unmap pinned host buffer
-      queue.enqueueUnmapMemObject(d_pinned, h_pinned);
+      runBasic(bench, context, device, queue, unifiedMemory);
+      bench.write();
     }
+    else if (mode == "matrix")
+      runMatrix(context, device, queue);
+    else if (mode == "overlap")
+      runOverlap(context, device, queue);
+    else if (mode == "coalesce")
+      runCoalesce(context, device, queue);
+    else if (mode == "compress")
+      runCompress(context, device, queue);
+    else if (mode == "svm")
+      runSVM(context, device, queue);
+    else if (mode == "rect")
+      runRect(context, device, queue);
+    else if (mode == "latency")
+      runLatency(context, device, queue);
+    else if (mode == "threads")
+      runThreads(context, device, queue);
+    else if (mode == "file")
+      runFile(context, device, queue);
   }
   catch (cl::BuildError error)
   {
@@ -260,7 +345,8 @@ void parseArguments(int argc, char *argv[])
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], &deviceIndex))
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_MEMORY) ||
+          deviceIndex == DEVICE_ALL)
       {
         std::cout << "Invalid device index" << std::endl;
         exit(1);
@@ -282,6 +368,66 @@ void parseArguments(int argc, char *argv[])
         exit(1);
       }
     }
+    else if (!strcmp(argv[i], "--mode") || !strcmp(argv[i], "-m"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Missing mode" << std::endl;
+        exit(1);
+      }
+      mode = argv[i];
+      const char *modes[] = { "basic", "matrix", "overlap", "coalesce", "compress",
+                              "svm", "rect", "latency", "threads",
+                              "file" };
+      const char **end = modes + sizeof(modes)/sizeof(modes[0]);
+      if (std::find(modes, end, mode) == end)
+      {
+        std::cout << "Unknown mode '" << mode << "' (try '--help')" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--min-size"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &minSizeKB) || minSizeKB == 0)
+      {
+        std::cout << "Invalid minimum size" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--max-size"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &maxSizeMB) || maxSizeMB == 0)
+      {
+        std::cout << "Invalid maximum size" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--chunks"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &numChunks) || numChunks == 0)
+      {
+        std::cout << "Invalid number of chunks" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--file"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Missing input file" << std::endl;
+        exit(1);
+      }
+      inputFile = argv[i];
+    }
+    else if (!strcmp(argv[i], "--output") || !strcmp(argv[i], "-o"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Missing output file" << std::endl;
+        exit(1);
+      }
+      outputFile = argv[i];
+    }
     else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
     {
       std::cout << std::endl;
@@ -289,9 +435,27 @@ void parseArguments(int argc, char *argv[])
       std::cout << "Options:" << std::endl;
       std::cout << "  -h  --help               Print the message" << std::endl;
       std::cout << "      --list               List available devices" << std::endl;
-      std::cout << "      --device     INDEX   Select device at INDEX" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
       std::cout << "  -s  --size       S       Buffer size in MB" << std::endl;
       std::cout << "  -i  --iterations ITRS    Number of benchmark iterations" << std::endl;
+      std::cout << "  -m  --mode       MODE    Benchmark to run (default: basic)" << std::endl;
+      std::cout << "      --min-size   KB      Smallest size in size sweeps" << std::endl;
+      std::cout << "      --max-size   MB      Largest size in size sweeps" << std::endl;
+      std::cout << "      --chunks     N       Chunks per buffer in overlap mode" << std::endl;
+      std::cout << "      --file       FILE    Input for file mode (default: generated)" << std::endl;
+      std::cout << "  -o  --output     FILE    Write CSV results to FILE" << std::endl;
+      std::cout << std::endl;
+      std::cout << "Modes:" << std::endl;
+      std::cout << "  basic      Read back with enqueueReadBuffer against zero-copy/pinned/staged/auto" << std::endl;
+      std::cout << "  matrix     H2D/D2H/D2D for every allocation flavour, swept over sizes" << std::endl;
+      std::cout << "  overlap    Fill kernel on one chunk while the previous chunk is read" << std::endl;
+      std::cout << "  coalesce   Many small writes, individually and batched with a scatter kernel" << std::endl;
+      std::cout << "  compress   Compress on host threads, decompress on the device" << std::endl;
+      std::cout << "  svm        Coarse- and fine-grained SVM against buffer read/map" << std::endl;
+      std::cout << "  rect       2D halo regions via rect transfers, packing and copy-rect" << std::endl;
+      std::cout << "  latency    Per-transfer latency percentiles and histograms" << std::endl;
+      std::cout << "  threads    Concurrent writes from several threads, one queue each" << std::endl;
+      std::cout << "  file       File to device via read, mmap and O_DIRECT, hot and cold" << std::endl;
       std::cout << std::endl;
       exit(0);
     }
@@ -0,0 +1,82 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Declarations shared between the benchmark modes
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <util.hpp>
+
+// Benchmark parameters, defined in transfer.cpp
+extern unsigned    deviceIndex;
+extern unsigned    bufferSize;    // Size in bytes once the modes run
+extern unsigned    iterations;
+extern unsigned    minSizeKB;     // Smallest size in size sweeps
+extern unsigned    maxSizeMB;     // Largest size in size sweeps
+extern std::string outputFile;    // CSV output, empty for stdout
+extern unsigned    numChunks;     // Chunks per buffer in overlap mode
+extern std::string inputFile;     // File mode input, empty for a generated file
+
+// Source of the fill kernel used to produce data on the device
+extern const char *kernel_source;
+
+// Check a buffer produced by the fill kernel with the given value
+bool checkOutput(cl_uint *data, cl_uint value);
+
+// Page-aligned host allocations, as required for CL_MEM_USE_HOST_PTR
+inline void* alignedAlloc(size_t size)
+{
+#if defined(_WIN32)
+  return _aligned_malloc(size, 4096);
+#else
+  void *ptr = NULL;
+  if (posix_memalign(&ptr, 4096, size))
+    return NULL;
+  return ptr;
+#endif
+}
+
+inline void alignedFree(void *ptr)
+{
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+
+// Benchmark modes
+void runMatrix(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runOverlap(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runCoalesce(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runCompress(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runSVM(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runRect(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runLatency(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runThreads(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
+void runFile(cl::Context& context, cl::Device& device, cl::CommandQueue& queue);
@@ -0,0 +1,154 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Coalesce mode: many small writes scattered over several buffers, issued
+// either as individual enqueueWriteBuffer calls or gathered by a
+// util::WriteCoalescer into one upload and a device-side scatter. The
+// write size is swept to find where coalescing stops paying off.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <iomanip>
+
+#include "transfer.hpp"
+
+#include <write_coalescer.hpp>
+
+namespace {
+
+const unsigned NUM_TARGETS = 4;
+const size_t   MAX_WRITES  = 4096;
+
+struct Write
+{
+  unsigned target;
+  size_t   offset;
+};
+
+// Clear the destinations, then read them back after a run and compare
+// against the host-side expected contents
+void clearTargets(cl::CommandQueue& queue, std::vector<cl::Buffer>& targets)
+{
+  for (unsigned t = 0; t < targets.size(); t++)
+    queue.enqueueFillBuffer(targets[t], (cl_uchar)0, 0, bufferSize);
+  queue.finish();
+}
+
+bool checkTargets(cl::CommandQueue& queue, std::vector<cl::Buffer>& targets,
+                  const std::vector< std::vector<char> >& expected)
+{
+  std::vector<char> result(bufferSize);
+  for (unsigned t = 0; t < targets.size(); t++)
+  {
+    queue.enqueueReadBuffer(targets[t], CL_TRUE, 0, bufferSize, &result[0]);
+    if (result != expected[t])
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+void runCoalesce(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  util::WriteCoalescer coalescer(context, device, queue);
+  util::Timer timer;
+
+  std::vector<cl::Buffer> targets;
+  for (unsigned t = 0; t < NUM_TARGETS; t++)
+    targets.push_back(cl::Buffer(context, CL_MEM_READ_WRITE, bufferSize));
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "     Size   Writes   Individual    Coalesced   Speed-up" << std::endl
+            << "                        (us/write)   (us/write)" << std::endl
+            << "-------------------------------------------------------" << std::endl;
+
+  size_t crossover = 0;
+  bool   allPass   = true;
+  for (size_t size = 4; size <= 64*1024 && 2*size <= bufferSize; size *= 2)
+  {
+    // Writes go to every other slot of each target, round-robin over targets
+    size_t slots  = bufferSize / (2*size);
+    size_t writes = std::min(MAX_WRITES, slots * NUM_TARGETS);
+
+    std::vector<Write> plan(writes);
+    std::vector<char>  source(writes * size);
+    std::vector< std::vector<char> > expected(NUM_TARGETS,
+                                              std::vector<char>(bufferSize, 0));
+    for (size_t w = 0; w < writes; w++)
+    {
+      plan[w].target = w % NUM_TARGETS;
+      plan[w].offset = (w / NUM_TARGETS) * 2*size;
+      for (size_t b = 0; b < size; b++)
+        source[w*size + b] = (char)(w*31 + b);
+      std::copy(&source[w*size], &source[w*size] + size,
+                &expected[plan[w].target][plan[w].offset]);
+    }
+
+    // Individual non-blocking writes, waited for at the end
+    clearTargets(queue, targets);
+    uint64_t start = timer.getTimeNanoseconds();
+    for (unsigned i = 0; i < iterations; i++)
+    {
+      for (size_t w = 0; w < writes; w++)
+        queue.enqueueWriteBuffer(targets[plan[w].target], CL_FALSE,
+                                 plan[w].offset, size, &source[w*size]);
+      queue.finish();
+    }
+    double individual = (timer.getTimeNanoseconds() - start) * 1e-3;
+    bool pass = checkTargets(queue, targets, expected);
+
+    // Coalesced into one upload and a scatter per target
+    clearTargets(queue, targets);
+    start = timer.getTimeNanoseconds();
+    for (unsigned i = 0; i < iterations; i++)
+    {
+      for (size_t w = 0; w < writes; w++)
+        coalescer.write(targets[plan[w].target], plan[w].offset, size,
+                        &source[w*size]);
+      coalescer.flush();
+      queue.finish();
+    }
+    double coalesced = (timer.getTimeNanoseconds() - start) * 1e-3;
+    pass &= checkTargets(queue, targets, expected);
+    allPass &= pass;
+
+    double perWrite = 1.0 / ((double)writes * iterations);
+    double speedup  = individual / coalesced;
+    if (speedup > 1.0)
+      crossover = size;
+
+    std::cout << std::setw(9) << size
+              << std::setw(9) << writes
+              << std::setw(13) << individual * perWrite
+              << std::setw(13) << coalesced * perWrite
+              << std::setw(10) << speedup << "x"
+              << (pass ? "" : "   FAILED")
+              << std::endl;
+  }
+
+  const util::CoalescerStats& stats = coalescer.getStats();
+  std::cout << std::endl
+            << "Coalescer: " << stats.writes << " writes, "
+            << stats.flushes << " flushes, "
+            << stats.launches << " scatter kernels, "
+            << stats.direct << " sent directly" << std::endl;
+
+  if (!allPass)
+    std::cout << "Verification FAILED" << std::endl;
+  else if (crossover == 0)
+    std::cout << "Individual writes were faster at every size" << std::endl;
+  else
+    std::cout << "Coalescing was faster for writes of up to "
+              << crossover << " bytes" << std::endl;
+}
@@ -0,0 +1,303 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Compress mode: the data is compressed on host threads, the compressed
+// bytes are written to the device and a kernel decompresses them. The
+// effective bandwidth (uncompressed bytes delivered per second) is compared
+// with writing the raw data, for several data distributions.
+//
+// The format works on 32-bit words in blocks of BLOCK_WORDS. Each byte
+// plane of a block is delta encoded and then run-length encoded
+// (PackBits style), giving one independent stream per block and plane so
+// that every stream can be decoded by its own work-item.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "transfer.hpp"
+
+namespace {
+
+const cl_uint BLOCK_WORDS = 1024;
+
+const char *decompress_source =
+"// Control byte c < 128: c+1 literal deltas follow\n"
+"// Control byte c >= 128: the next delta is repeated c-126 times\n"
+"kernel void decompress(global const uchar *in,\n"
+"                       global const uint  *offsets,\n"
+"                       uint numStreams, uint totalWords,\n"
+"                       global uchar *out)\n"
+"{\n"
+"  uint stream = get_global_id(0);\n"
+"  if (stream >= numStreams)\n"
+"    return;\n"
+"\n"
+"  uint first = (stream / 4) * BLOCK_WORDS;\n"
+"  uint n     = min((uint)BLOCK_WORDS, totalWords - first);\n"
+"\n"
+"  global const uchar *p = in + offsets[stream];\n"
+"  global uchar       *o = out + first*4 + stream%4;\n"
+"  uchar value = 0;\n"
+"  uint  i     = 0;\n"
+"  while (i < n)\n"
+"  {\n"
+"    uchar c = *p++;\n"
+"    if (c < 128)\n"
+"    {\n"
+"      for (uint k = 0; k <= c; k++)\n"
+"      {\n"
+"        value += *p++;\n"
+"        o[4*i++] = value;\n"
+"      }\n"
+"    }\n"
+"    else\n"
+"    {\n"
+"      uchar d = *p++;\n"
+"      for (uint k = 0; k < c-126u; k++)\n"
+"      {\n"
+"        value += d;\n"
+"        o[4*i++] = value;\n"
+"      }\n"
+"    }\n"
+"  }\n"
+"}\n";
+
+struct Compressed
+{
+  std::vector<cl_uchar> bytes;
+  std::vector<cl_uint>  offsets;  // start of each stream in bytes
+};
+
+// Delta encode one byte plane of n words, then run-length encode the deltas
+void encodeStream(const cl_uint *data, size_t n, unsigned plane,
+                  std::vector<cl_uchar>& out)
+{
+  std::vector<cl_uchar> delta(n);
+  cl_uchar prev = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    cl_uchar b = (cl_uchar)(data[i] >> (8*plane));
+    delta[i] = b - prev;
+    prev     = b;
+  }
+
+  size_t i = 0;
+  while (i < n)
+  {
+    size_t run = 1;
+    while (i + run < n && run < 129 && delta[i+run] == delta[i])
+      run++;
+
+    if (run >= 2)
+    {
+      out.push_back((cl_uchar)(126 + run));
+      out.push_back(delta[i]);
+      i += run;
+    }
+    else
+    {
+      // Literals up to the start of the next run
+      size_t j = i;
+      while (j < n && j - i < 128 && !(j + 1 < n && delta[j] == delta[j+1]))
+        j++;
+      out.push_back((cl_uchar)(j - i - 1));
+      out.insert(out.end(), delta.begin() + i, delta.begin() + j);
+      i = j;
+    }
+  }
+}
+
+// Streams are shared out between threads, then concatenated
+void compress(const std::vector<cl_uint>& data, unsigned numThreads,
+              Compressed& result)
+{
+  size_t numBlocks  = (data.size() + BLOCK_WORDS - 1) / BLOCK_WORDS;
+  size_t numStreams = numBlocks * 4;
+  std::vector< std::vector<cl_uchar> > streams(numStreams);
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    threads.push_back(std::thread([&, t]() {
+      for (size_t s = t; s < numStreams; s += numThreads)
+      {
+        size_t first = (s/4) * BLOCK_WORDS;
+        size_t n     = std::min((size_t)BLOCK_WORDS, data.size() - first);
+        streams[s].reserve(n + n/128 + 2);
+        encodeStream(&data[first], n, s%4, streams[s]);
+      }
+    }));
+  }
+  for (unsigned t = 0; t < numThreads; t++)
+    threads[t].join();
+
+  result.offsets.resize(numStreams);
+  size_t total = 0;
+  for (size_t s = 0; s < numStreams; s++)
+  {
+    result.offsets[s] = (cl_uint)total;
+    total += streams[s].size();
+  }
+  result.bytes.resize(std::max(total, (size_t)1));
+  for (size_t s = 0; s < numStreams; s++)
+  {
+    if (!streams[s].empty())
+      memcpy(&result.bytes[result.offsets[s]], &streams[s][0], streams[s].size());
+  }
+  result.bytes.resize(total);
+}
+
+// Test data, as 32-bit words
+void generate(const std::string& name, std::vector<cl_uint>& data)
+{
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<cl_uint> uniform;
+  size_t n = data.size();
+
+  if (name == "sparse")
+  {
+    // Mostly zero, with 1 in 20 entries set
+    for (size_t i = 0; i < n; i++)
+      data[i] = (uniform(rng) % 20 == 0) ? uniform(rng) : 0;
+  }
+  else if (name == "smooth-int")
+  {
+    // A slowly varying integer field, like an image row
+    for (size_t i = 0; i < n; i++)
+      data[i] = (cl_uint)(32768 + 30000*sin(i * 0.001));
+  }
+  else if (name == "smooth-float")
+  {
+    // The same field stored as floats; only the high bytes compress well
+    for (size_t i = 0; i < n; i++)
+    {
+      float f = (float)sin(i * 0.001);
+      memcpy(&data[i], &f, sizeof(float));
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < n; i++)
+      data[i] = uniform(rng);
+  }
+}
+
+} // namespace
+
+void runCompress(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  std::ostringstream options;
+  options << "-DBLOCK_WORDS=" << BLOCK_WORDS;
+  cl::Program program(context, decompress_source);
+  program.build(std::vector<cl::Device>(1, device), options.str().c_str());
+  cl::KernelFunctor<cl::Buffer, cl::Buffer, cl_uint, cl_uint, cl::Buffer>
+    decompress(program, "decompress");
+
+  unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+  size_t   numWords   = bufferSize / 4;
+  size_t   numStreams = ((numWords + BLOCK_WORDS - 1) / BLOCK_WORDS) * 4;
+
+  cl::Buffer d_raw(context, CL_MEM_READ_WRITE, bufferSize);
+  cl::Buffer d_out(context, CL_MEM_READ_WRITE, bufferSize);
+  // Worst case is one control byte per 128 literals
+  size_t maxCompressed = bufferSize + numStreams * (BLOCK_WORDS/128 + 1);
+  cl::Buffer d_compressed(context, CL_MEM_READ_ONLY, maxCompressed);
+  cl::Buffer d_offsets(context, CL_MEM_READ_ONLY, numStreams * sizeof(cl_uint));
+
+  std::cout << "Compression threads = " << numThreads << std::endl << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Data            Ratio   Compress   Transfer   Decompress"
+               "      Raw    Effective   Pipelined (bound)" << std::endl
+            << "                           (ms)       (ms)         (ms)"
+               "   (GB/s)       (GB/s)              (GB/s)" << std::endl
+            << "-------------------------------------------------------"
+               "--------------------------------------------" << std::endl;
+
+  const char *distributions[] = { "sparse", "smooth-int", "smooth-float", "random" };
+  std::vector<cl_uint> data(numWords), result(numWords);
+  util::Timer timer;
+
+  for (unsigned d = 0; d < 4; d++)
+  {
+    generate(distributions[d], data);
+
+    double rawTime = 0, compressTime = 0, transferTime = 0, decompressTime = 0;
+    bool pass = true;
+    Compressed c;
+    for (unsigned i = 0; i <= iterations; i++)
+    {
+      // Clear the output, so a decompress that fails to write it is caught
+      queue.enqueueFillBuffer(d_out, (cl_uchar)0, 0, bufferSize);
+      queue.finish();
+
+      // Raw transfer
+      uint64_t t0 = timer.getTimeNanoseconds();
+      queue.enqueueWriteBuffer(d_raw, CL_TRUE, 0, bufferSize, &data[0]);
+      uint64_t t1 = timer.getTimeNanoseconds();
+
+      // Compress, transfer, decompress
+      compress(data, numThreads, c);
+      uint64_t t2 = timer.getTimeNanoseconds();
+      if (!c.bytes.empty())
+        queue.enqueueWriteBuffer(d_compressed, CL_FALSE, 0, c.bytes.size(), &c.bytes[0]);
+      queue.enqueueWriteBuffer(d_offsets, CL_FALSE, 0,
+                               numStreams * sizeof(cl_uint), &c.offsets[0]);
+      queue.finish();
+      uint64_t t3 = timer.getTimeNanoseconds();
+      decompress(cl::EnqueueArgs(queue, cl::NDRange(numStreams)),
+                 d_compressed, d_offsets, (cl_uint)numStreams, (cl_uint)numWords,
+                 d_out);
+      queue.finish();
+      uint64_t t4 = timer.getTimeNanoseconds();
+
+      // Check every iteration, outside the timed region
+      queue.enqueueReadBuffer(d_out, CL_TRUE, 0, bufferSize, &result[0]);
+      if (result != data)
+        pass = false;
+
+      // The first iteration is a warm-up
+      if (i == 0)
+        continue;
+      rawTime        += (t1 - t0) * 1e-9;
+      compressTime   += (t2 - t1) * 1e-9;
+      transferTime   += (t3 - t2) * 1e-9;
+      decompressTime += (t4 - t3) * 1e-9;
+    }
+
+    double bytes     = (double)bufferSize * iterations;
+    double ratio     = (double)bufferSize / std::max((size_t)1, c.bytes.size());
+    double serial    = compressTime + transferTime + decompressTime;
+    // With chunks in flight, the slowest stage sets the rate
+    double pipelined = std::max(compressTime, std::max(transferTime, decompressTime));
+
+    std::cout << std::left << std::setw(14) << distributions[d] << std::right
+              << std::setw(7) << ratio
+              << std::setw(11) << compressTime/iterations*1e3
+              << std::setw(11) << transferTime/iterations*1e3
+              << std::setw(13) << decompressTime/iterations*1e3
+              << std::setw(9) << bytes/rawTime*1e-9
+              << std::setw(13) << bytes/serial*1e-9
+              << std::setw(20) << bytes/pipelined*1e-9
+              << (pass ? "" : "   FAILED")
+              << std::endl;
+  }
+
+  std::cout << std::endl
+            << "Effective: compress, transfer and decompress run back to back" << std::endl
+            << "Pipelined (bound): if the three stages were overlapped over chunks" << std::endl;
+}
@@ -0,0 +1,347 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// File mode: load a file into a device buffer, end to end, four ways:
+//
+//   read+write      read() into host memory, then enqueueWriteBuffer
+//   mmap+use-host   mmap the file, wrap it in a CL_MEM_USE_HOST_PTR buffer
+//                   and copy that to the device buffer
+//   mmap+write      mmap the file and enqueueWriteBuffer from the mapping
+//   direct+pinned   O_DIRECT reads into two pinned buffers, each written to
+//                   the device while the next chunk is being read
+//
+// with the file hot in the page cache and cold (dropped from the cache
+// with posix_fadvise, which is best effort). Uses POSIX file APIs, so this
+// mode is not available on Windows.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+
+#include "transfer.hpp"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+void runFile(cl::Context&, cl::Device&, cl::CommandQueue&)
+{
+  std::cout << "File mode needs POSIX file APIs and is not available on Windows"
+            << std::endl;
+}
+
+#else
+
+namespace {
+
+const size_t   DIRECT_CHUNK = 4*1024*1024;
+const size_t   ALIGNMENT    = 4096;
+const unsigned MAX_REPS     = 5;
+
+struct FileContext
+{
+  cl::Context      context;
+  cl::CommandQueue queue;
+  std::string      path;
+  size_t           size;
+  cl::Buffer       d_dst;
+};
+
+bool readAll(int fd, char *dst, size_t size)
+{
+  size_t done = 0;
+  while (done < size)
+  {
+    ssize_t n = read(fd, dst + done, size - done);
+    if (n <= 0)
+      return false;
+    done += n;
+  }
+  return true;
+}
+
+// Pull the whole file into the page cache
+void warmCache(const FileContext& f)
+{
+  int fd = open(f.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  std::vector<char> scratch(1024*1024);
+  while (read(fd, &scratch[0], scratch.size()) > 0)
+    ;
+  close(fd);
+}
+
+bool dropCache(const FileContext& f)
+{
+#if defined(POSIX_FADV_DONTNEED)
+  int fd = open(f.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  // Dirty pages are not dropped, so write them back first
+  fsync(fd);
+  int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return err == 0;
+#else
+  return false;
+#endif
+}
+
+// read() into host memory, then a plain write
+bool loadReadWrite(FileContext& f)
+{
+  int fd = open(f.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  std::vector<char> host(f.size);
+  bool ok = readAll(fd, &host[0], f.size);
+  close(fd);
+  if (ok)
+    f.queue.enqueueWriteBuffer(f.d_dst, CL_TRUE, 0, f.size, &host[0]);
+  return ok;
+}
+
+// The runtime reads the file pages itself as it copies to the device
+bool loadMmapUseHostPtr(FileContext& f)
+{
+  int fd = open(f.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  // Private and writable, since the runtime may write through the pointer
+  void *ptr = mmap(NULL, f.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED)
+    return false;
+
+  {
+    cl::Buffer d_file(f.context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, f.size, ptr);
+    f.queue.enqueueCopyBuffer(d_file, f.d_dst, 0, 0, f.size);
+    f.queue.finish();
+  }
+  munmap(ptr, f.size);
+  return true;
+}
+
+bool loadMmapWrite(FileContext& f)
+{
+  int fd = open(f.path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  void *ptr = mmap(NULL, f.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED)
+    return false;
+
+  f.queue.enqueueWriteBuffer(f.d_dst, CL_TRUE, 0, f.size, ptr);
+  munmap(ptr, f.size);
+  return true;
+}
+
+// Bypass the page cache into pinned memory, double buffered so that the
+// read of one chunk overlaps the write of the previous one
+bool loadDirectPinned(FileContext& f)
+{
+#if defined(O_DIRECT)
+  int fd = open(f.path.c_str(), O_RDONLY | O_DIRECT);
+  if (fd < 0)
+    return false;
+
+  cl::Buffer d_pinned[2];
+  char *h_pinned[2];
+  cl::Event written[2];
+  bool ok = true;
+  for (int b = 0; b < 2; b++)
+  {
+    d_pinned[b] = cl::Buffer(f.context, CL_MEM_ALLOC_HOST_PTR, DIRECT_CHUNK);
+    h_pinned[b] = (char*)f.queue.enqueueMapBuffer(
+      d_pinned[b], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, DIRECT_CHUNK);
+    // O_DIRECT needs aligned memory, which pinned allocations normally are
+    ok &= ((size_t)h_pinned[b] % ALIGNMENT == 0);
+  }
+
+  for (size_t offset = 0, b = 0; ok && offset < f.size; offset += DIRECT_CHUNK, b ^= 1)
+  {
+    if (written[b]())
+      written[b].wait();
+
+    // The final read may be short; O_DIRECT still wants a whole-block request
+    size_t n = std::min(DIRECT_CHUNK, f.size - offset);
+    ssize_t got = pread(fd, h_pinned[b], DIRECT_CHUNK, offset);
+    if (got < (ssize_t)n)
+    {
+      ok = false;
+      break;
+    }
+    f.queue.enqueueWriteBuffer(f.d_dst, CL_FALSE, offset, n, h_pinned[b],
+                               NULL, &written[b]);
+  }
+  f.queue.finish();
+  close(fd);
+
+  for (int b = 0; b < 2; b++)
+    f.queue.enqueueUnmapMemObject(d_pinned[b], h_pinned[b]);
+  f.queue.finish();
+  return ok;
+#else
+  return false;
+#endif
+}
+
+bool verify(FileContext& f, const std::vector<char>& expected)
+{
+  std::vector<char> result(f.size);
+  f.queue.enqueueReadBuffer(f.d_dst, CL_TRUE, 0, f.size, &result[0]);
+  return result == expected;
+}
+
+void runPath(FileContext& f, const char *name, std::function<bool(FileContext&)> load,
+             const std::vector<char>& expected, bool cold)
+{
+  util::Timer timer;
+  unsigned reps = std::max(1u, std::min(iterations, MAX_REPS));
+  double best = 1e30, total = 0.0;
+  bool ok = true;
+
+  for (unsigned r = 0; r < reps && ok; r++)
+  {
+    if (cold)
+      dropCache(f);
+    else
+      warmCache(f);
+    f.queue.enqueueFillBuffer(f.d_dst, (cl_uchar)0, 0, f.size);
+    f.queue.finish();
+
+    uint64_t start = timer.getTimeNanoseconds();
+    ok = load(f);
+    f.queue.finish();
+    double seconds = (timer.getTimeNanoseconds() - start) * 1e-9;
+    total += seconds;
+    best   = std::min(best, seconds);
+  }
+
+  std::cout << std::left << std::setw(16) << name << std::setw(6)
+            << (cold ? "cold" : "hot") << std::right;
+  if (!ok)
+  {
+    std::cout << std::setw(12) << "-" << std::setw(12) << "-"
+              << "   not available" << std::endl;
+  }
+  else
+  {
+    bool pass = verify(f, expected);
+    std::cout << std::setw(12) << f.size / (total / reps) * 1e-9
+              << std::setw(12) << f.size / best * 1e-9
+              << (pass ? "" : "   FAILED") << std::endl;
+  }
+}
+
+// Removes the file at path, if any, however runFile returns
+struct TemporaryFile
+{
+  std::string path;
+
+  ~TemporaryFile()
+  {
+    if (!path.empty())
+      unlink(path.c_str());
+  }
+};
+
+} // namespace
+
+void runFile(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  FileContext f;
+  f.context = context;
+  f.queue   = queue;
+
+  // Without an input file, write one of the benchmark size
+  bool temporary = inputFile.empty();
+  f.path = temporary ? "transfer_file.tmp" : inputFile;
+  TemporaryFile cleanup;
+  if (temporary)
+  {
+    cleanup.path = f.path;
+    std::ofstream out(f.path.c_str(), std::ios::binary);
+    std::vector<cl_uint> words(1024*1024);
+    for (size_t written = 0; written < bufferSize; written += words.size()*4)
+    {
+      size_t n = std::min(words.size()*4, bufferSize - written);
+      for (size_t i = 0; i < words.size(); i++)
+        words[i] = (cl_uint)(written/4 + i);
+      out.write((const char*)&words[0], n);
+    }
+    if (!out.good())
+    {
+      std::cout << "Cannot write file: " << f.path << std::endl;
+      return;
+    }
+  }
+
+  struct stat st;
+  if (stat(f.path.c_str(), &st) != 0 || st.st_size == 0)
+  {
+    std::cout << "Cannot read file: " << f.path << std::endl;
+    return;
+  }
+  f.size = st.st_size;
+  if (f.size > device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>())
+  {
+    std::cout << "File is larger than the largest device allocation" << std::endl;
+    return;
+  }
+  f.d_dst = cl::Buffer(context, CL_MEM_READ_WRITE, f.size);
+
+  // Reference contents, to check every path
+  std::vector<char> expected(f.size);
+  {
+    int fd = open(f.path.c_str(), O_RDONLY);
+    bool ok = fd >= 0 && readAll(fd, &expected[0], f.size);
+    if (fd >= 0)
+      close(fd);
+    if (!ok)
+    {
+      std::cout << "Cannot read file: " << f.path << std::endl;
+      return;
+    }
+  }
+
+  std::cout << "File        = " << f.path << " (" << f.size / (1024*1024) << " MB)"
+            << std::endl << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Path            Cache       Mean        Best" << std::endl
+            << "                          (GB/s)      (GB/s)" << std::endl
+            << "--------------------------------------------" << std::endl;
+
+  for (int cold = 0; cold < 2; cold++)
+  {
+    runPath(f, "read+write",    loadReadWrite,      expected, cold);
+    runPath(f, "mmap+use-host", loadMmapUseHostPtr, expected, cold);
+    runPath(f, "mmap+write",    loadMmapWrite,      expected, cold);
+    runPath(f, "direct+pinned", loadDirectPinned,   expected, cold);
+  }
+
+  if (!dropCache(f))
+    std::cout << std::endl
+              << "Could not drop the file from the page cache; "
+                 "cold results are really warm" << std::endl;
+}
+
+#endif
@@ -0,0 +1,191 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Latency mode: every transfer is timed individually, with the host clock
+// around the blocking call and with the command's profiling timestamps.
+// The distribution is printed as percentiles and a histogram for each path,
+// since a good average can hide the occasional slow transfer.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+
+#include "transfer.hpp"
+
+namespace {
+
+const unsigned MIN_SAMPLES = 1000;
+const unsigned HISTOGRAM_WIDTH = 40;
+
+struct Samples
+{
+  const char *name;
+  std::vector<double> host;    // microseconds
+  std::vector<double> device;  // microseconds
+};
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+  size_t i = (size_t)ceil(p * sorted.size());
+  return sorted[std::min(sorted.size(), std::max((size_t)1, i)) - 1];
+}
+
+void printPercentiles(const char *name, const char *clock, std::vector<double> samples)
+{
+  std::sort(samples.begin(), samples.end());
+  std::cout << std::left << std::setw(14) << name << std::setw(8) << clock
+            << std::right
+            << std::setw(10) << samples.front()
+            << std::setw(10) << percentile(samples, 0.50)
+            << std::setw(10) << percentile(samples, 0.90)
+            << std::setw(10) << percentile(samples, 0.99)
+            << std::setw(10) << samples.back()
+            << std::endl;
+}
+
+// Buckets double in width from the fastest sample, so the tail is visible
+void printHistogram(const Samples& s)
+{
+  double lo = *std::min_element(s.host.begin(), s.host.end());
+  lo = std::max(lo, 0.01);
+
+  std::vector<size_t> counts;
+  for (size_t i = 0; i < s.host.size(); i++)
+  {
+    size_t b = (size_t)std::max(0.0, floor(log2(s.host[i] / lo)));
+    if (b >= counts.size())
+      counts.resize(b + 1, 0);
+    counts[b]++;
+  }
+  size_t most = *std::max_element(counts.begin(), counts.end());
+
+  std::cout << s.name << " (host clock)" << std::endl;
+  for (size_t b = 0; b < counts.size(); b++)
+  {
+    size_t bar = (counts[b] * HISTOGRAM_WIDTH + most - 1) / most;
+    std::cout << "  " << std::setw(10) << lo * pow(2.0, (double)b)
+              << " - " << std::left << std::setw(10) << lo * pow(2.0, (double)b + 1) << std::right
+              << " us " << std::setw(7) << counts[b] << "  "
+              << std::string(bar, '#') << std::endl;
+  }
+}
+
+// Time one path. produce runs untimed before each transfer; transfer
+// performs it, blocking, and returns the event for the command.
+Samples timePath(cl::CommandQueue& queue, const char *name, unsigned samples,
+                 std::function<void()> produce, std::function<cl::Event()> transfer)
+{
+  Samples s;
+  s.name = name;
+  util::Timer timer;
+
+  for (unsigned i = 0; i <= samples; i++)
+  {
+    produce();
+    queue.finish();
+
+    uint64_t start = timer.getTimeNanoseconds();
+    cl::Event event = transfer();
+    uint64_t end = timer.getTimeNanoseconds();
+    queue.finish();
+
+    // The first transfer is a warm-up
+    if (i == 0)
+      continue;
+    s.host.push_back((end - start) * 1e-3);
+    s.device.push_back(
+      (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+       event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-3);
+  }
+  return s;
+}
+
+} // namespace
+
+void runLatency(cl::Context& context, cl::Device& device, cl::CommandQueue&)
+{
+  // Profiling timestamps need a queue of our own
+  cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+  cl::Program program(context, kernel_source, true);
+  cl::KernelFunctor<cl::Buffer, cl_uint> fill(program, "fill");
+
+  unsigned samples = std::max(iterations, MIN_SAMPLES);
+  std::cout << "Samples     = " << samples << " per path" << std::endl << std::endl;
+
+  cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
+  cl::Buffer d_mapped(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize);
+  cl::Buffer d_pinned(context, CL_MEM_ALLOC_HOST_PTR, bufferSize);
+  void *h_pinned = queue.enqueueMapBuffer(d_pinned, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE, 0, bufferSize);
+  std::vector<char> h_buffer(bufferSize);
+
+  cl_uint value = 0;
+  std::function<void()> produce = [&]() {
+    fill(cl::EnqueueArgs(queue, cl::NDRange(bufferSize/4)), d_buffer, value++);
+  };
+  std::function<void()> produceMapped = [&]() {
+    fill(cl::EnqueueArgs(queue, cl::NDRange(bufferSize/4)), d_mapped, value++);
+  };
+  std::function<void()> nothing = []() {};
+
+  std::vector<Samples> results;
+  results.push_back(timePath(queue, "read", samples, produce, [&]() {
+    cl::Event e;
+    queue.enqueueReadBuffer(d_buffer, CL_TRUE, 0, bufferSize, &h_buffer[0], NULL, &e);
+    return e;
+  }));
+  results.push_back(timePath(queue, "read-pinned", samples, produce, [&]() {
+    cl::Event e;
+    queue.enqueueReadBuffer(d_buffer, CL_TRUE, 0, bufferSize, h_pinned, NULL, &e);
+    return e;
+  }));
+  results.push_back(timePath(queue, "map-read", samples, produceMapped, [&]() {
+    cl::Event e;
+    void *ptr = queue.enqueueMapBuffer(d_mapped, CL_TRUE, CL_MAP_READ,
+                                       0, bufferSize, NULL, &e);
+    queue.enqueueUnmapMemObject(d_mapped, ptr);
+    return e;
+  }));
+  results.push_back(timePath(queue, "write", samples, nothing, [&]() {
+    cl::Event e;
+    queue.enqueueWriteBuffer(d_buffer, CL_TRUE, 0, bufferSize, &h_buffer[0], NULL, &e);
+    return e;
+  }));
+  results.push_back(timePath(queue, "write-pinned", samples, nothing, [&]() {
+    cl::Event e;
+    queue.enqueueWriteBuffer(d_buffer, CL_TRUE, 0, bufferSize, h_pinned, NULL, &e);
+    return e;
+  }));
+
+  queue.enqueueUnmapMemObject(d_pinned, h_pinned);
+  queue.finish();
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "Path          Clock          min       p50       p90       p99       max" << std::endl
+            << "                              (us)      (us)      (us)      (us)      (us)" << std::endl
+            << "------------------------------------------------------------------------" << std::endl;
+  for (size_t r = 0; r < results.size(); r++)
+  {
+    printPercentiles(results[r].name, "host",   results[r].host);
+    printPercentiles("",              "device", results[r].device);
+  }
+
+  std::cout << std::endl;
+  for (size_t r = 0; r < results.size(); r++)
+  {
+    printHistogram(results[r]);
+    std::cout << std::endl;
+  }
+}
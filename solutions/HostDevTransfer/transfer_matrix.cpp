@@ -0,0 +1,213 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Transfer matrix mode: every direction (H2D, D2H, D2D) with every buffer
+// allocation flavour, swept over transfer sizes, written out as CSV.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+
+#include "transfer.hpp"
+
+namespace {
+
+struct MatrixContext
+{
+  cl::Context      context;
+  cl::CommandQueue queue;
+  cl::KernelFunctor<cl::Buffer, cl_uint> fill;
+  std::ostream    *out;
+};
+
+// Fewer repetitions for large sizes so the sweep finishes in reasonable time
+unsigned repetitions(size_t size)
+{
+  size_t reps = (256*1024*1024) / size;
+  return (unsigned)std::max((size_t)3, std::min(reps, (size_t)1000));
+}
+
+// Time one path at one size. If source is given, the fill kernel writes it
+// before every repetition (untimed) so that the data is dirty on the device.
+void timePath(MatrixContext& m, const char *direction, const char *path,
+              size_t size, cl::Buffer *source, std::function<void()> transfer)
+{
+  unsigned reps = repetitions(size);
+  util::Timer timer;
+  double total = 0.0, best = 1e30;
+
+  for (unsigned r = 0; r <= reps; r++)
+  {
+    if (source)
+      m.fill(cl::EnqueueArgs(m.queue, cl::NDRange(size/4)), *source, r);
+    m.queue.finish();
+
+    uint64_t start = timer.getTimeNanoseconds();
+    transfer();
+    m.queue.finish();
+    uint64_t end = timer.getTimeNanoseconds();
+
+    // The first repetition is a warm-up
+    if (r == 0)
+      continue;
+    double us = (end - start) * 1e-3;
+    total += us;
+    best   = std::min(best, us);
+  }
+
+  double mean = total / reps;
+  *m.out << direction << "," << path << "," << size << "," << reps << ","
+         << std::fixed << std::setprecision(3)
+         << mean << "," << best << "," << (size / mean) * 1e-3
+         << std::endl;
+}
+
+// Plain device buffers with pageable host memory
+void runPlain(MatrixContext& m, size_t size)
+{
+  cl::Buffer d_a(m.context, CL_MEM_READ_WRITE, size);
+  cl::Buffer d_b(m.context, CL_MEM_READ_WRITE, size);
+  std::vector<char> h_data(size);
+
+  timePath(m, "H2D", "write", size, NULL, [&]() {
+    m.queue.enqueueWriteBuffer(d_a, CL_TRUE, 0, size, &h_data[0]);
+  });
+  timePath(m, "D2H", "read", size, &d_a, [&]() {
+    m.queue.enqueueReadBuffer(d_a, CL_TRUE, 0, size, &h_data[0]);
+  });
+  timePath(m, "D2D", "copy", size, &d_a, [&]() {
+    m.queue.enqueueCopyBuffer(d_a, d_b, 0, 0, size);
+  });
+}
+
+// Plain device buffer with pinned host memory (a mapped ALLOC_HOST_PTR buffer)
+void runPinned(MatrixContext& m, size_t size)
+{
+  cl::Buffer d_a(m.context, CL_MEM_READ_WRITE, size);
+  cl::Buffer d_pinned(m.context, CL_MEM_ALLOC_HOST_PTR, size);
+  void *h_pinned = m.queue.enqueueMapBuffer(
+    d_pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size);
+
+  timePath(m, "H2D", "write-pinned", size, NULL, [&]() {
+    m.queue.enqueueWriteBuffer(d_a, CL_TRUE, 0, size, h_pinned);
+  });
+  timePath(m, "D2H", "read-pinned", size, &d_a, [&]() {
+    m.queue.enqueueReadBuffer(d_a, CL_TRUE, 0, size, h_pinned);
+  });
+
+  m.queue.enqueueUnmapMemObject(d_pinned, h_pinned);
+  m.queue.finish();
+}
+
+// Host-accessible device buffers, accessed by mapping them. The data still
+// has to get to/from the application's own memory, so the memcpy is timed.
+void runAllocHostPtr(MatrixContext& m, size_t size)
+{
+  cl::Buffer d_a(m.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+  cl::Buffer d_b(m.context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
+  std::vector<char> h_data(size);
+
+  timePath(m, "H2D", "map-write", size, NULL, [&]() {
+    void *ptr = m.queue.enqueueMapBuffer(d_a, CL_TRUE, CL_MAP_WRITE, 0, size);
+    memcpy(ptr, &h_data[0], size);
+    m.queue.enqueueUnmapMemObject(d_a, ptr);
+  });
+  timePath(m, "H2D", "map-write-invalidate", size, NULL, [&]() {
+    void *ptr = m.queue.enqueueMapBuffer(
+      d_a, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, size);
+    memcpy(ptr, &h_data[0], size);
+    m.queue.enqueueUnmapMemObject(d_a, ptr);
+  });
+  timePath(m, "D2H", "map-read", size, &d_a, [&]() {
+    void *ptr = m.queue.enqueueMapBuffer(d_a, CL_TRUE, CL_MAP_READ, 0, size);
+    memcpy(&h_data[0], ptr, size);
+    m.queue.enqueueUnmapMemObject(d_a, ptr);
+  });
+  timePath(m, "D2D", "copy-alloc-host-ptr", size, &d_a, [&]() {
+    m.queue.enqueueCopyBuffer(d_a, d_b, 0, 0, size);
+  });
+}
+
+// Device buffers wrapping application memory. Map/unmap is all that is
+// needed to make either side see the other's writes.
+void runUseHostPtr(MatrixContext& m, size_t size)
+{
+  void *h_a = alignedAlloc(size);
+  void *h_b = alignedAlloc(size);
+  if (!h_a || !h_b)
+  {
+    alignedFree(h_a);
+    alignedFree(h_b);
+    return;
+  }
+
+  {
+    cl::Buffer d_a(m.context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, h_a);
+    cl::Buffer d_b(m.context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, h_b);
+
+    timePath(m, "H2D", "use-host-ptr", size, NULL, [&]() {
+      void *ptr = m.queue.enqueueMapBuffer(d_a, CL_TRUE, CL_MAP_WRITE, 0, size);
+      m.queue.enqueueUnmapMemObject(d_a, ptr);
+    });
+    timePath(m, "D2H", "use-host-ptr", size, &d_a, [&]() {
+      void *ptr = m.queue.enqueueMapBuffer(d_a, CL_TRUE, CL_MAP_READ, 0, size);
+      m.queue.enqueueUnmapMemObject(d_a, ptr);
+    });
+    timePath(m, "D2D", "copy-use-host-ptr", size, &d_a, [&]() {
+      m.queue.enqueueCopyBuffer(d_a, d_b, 0, 0, size);
+    });
+    m.queue.finish();
+  }
+
+  alignedFree(h_a);
+  alignedFree(h_b);
+}
+
+} // namespace
+
+void runMatrix(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  cl::Program program(context, kernel_source, true);
+
+  std::ofstream file;
+  MatrixContext m = { context, queue,
+                      cl::KernelFunctor<cl::Buffer, cl_uint>(program, "fill"),
+                      &std::cout };
+  if (!outputFile.empty())
+  {
+    file.open(outputFile.c_str());
+    if (!file.is_open())
+    {
+      std::cout << "Cannot open file: " << outputFile << std::endl;
+      return;
+    }
+    m.out = &file;
+    std::cout << "Writing results to " << outputFile << std::endl;
+  }
+
+  size_t maxAlloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+  size_t minSize  = (size_t)minSizeKB * 1024;
+  size_t maxSize  = std::min((size_t)maxSizeMB * 1024 * 1024, maxAlloc);
+
+  *m.out << "direction,path,bytes,repetitions,mean_us,min_us,bandwidth_GBs"
+         << std::endl;
+  for (size_t size = minSize; size <= maxSize; size *= 2)
+  {
+    runPlain(m, size);
+    runPinned(m, size);
+    runAllocHostPtr(m, size);
+    runUseHostPtr(m, size);
+  }
+}
@@ -0,0 +1,165 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Overlap mode: the buffer is split into chunks and the fill kernel for
+// chunk i runs on one queue while chunk i-1 is read back on another. The
+// amount of overlap seen in the profiling timestamps shows whether the
+// device has a copy engine that works independently of the compute units.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <iomanip>
+
+#include "transfer.hpp"
+
+#include <stream_executor.hpp>
+
+namespace {
+
+void printRow(const char *name, double seconds, double bytes, bool pass)
+{
+  if (pass)
+  {
+    std::cout << name
+              << "   " << std::setw(8) << seconds*1e3 << " ms"
+              << "   " << std::setw(8) << bytes / seconds * 1e-9 << " GB/s"
+              << std::endl;
+  }
+  else
+  {
+    std::cout << name
+              << "   " << std::setw(8) << "-" << " ms"
+              << "   " << std::setw(8) << "-" << " GB/s"
+              << "   FAILED"
+              << std::endl;
+  }
+}
+
+} // namespace
+
+void runOverlap(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  cl::Program program(context, kernel_source, true);
+  cl::KernelFunctor<cl::Buffer, cl_uint> fill(program, "fill");
+
+  cl::CommandQueue computeQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+  cl::CommandQueue copyQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+  size_t chunkItems = (bufferSize/4) / numChunks;
+  size_t chunkBytes = chunkItems * 4;
+  if (chunkItems == 0 || chunkItems * numChunks != bufferSize/4)
+  {
+    std::cout << "Buffer size must divide into " << numChunks
+              << " chunks of whole words" << std::endl;
+    return;
+  }
+
+  // Asynchronous copies need pinned host memory
+  cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
+  cl::Buffer d_pinned(context, CL_MEM_ALLOC_HOST_PTR, bufferSize);
+  cl_uint *h_pinned = (cl_uint*)queue.enqueueMapBuffer(
+    d_pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bufferSize);
+
+  std::cout << "Chunks      = " << numChunks << " x "
+            << chunkBytes / 1024 << " KB" << std::endl << std::endl;
+
+  double totalBytes = iterations * (double)bufferSize;
+  util::Timer timer;
+
+  // Warm up both queues
+  fill(cl::EnqueueArgs(computeQueue, cl::NDRange(bufferSize/4)), d_buffer, 0);
+  computeQueue.finish();
+  copyQueue.enqueueReadBuffer(d_buffer, CL_TRUE, 0, bufferSize, h_pinned);
+
+
+  // Serialized: each chunk is filled, then read back, before the next starts
+  bool serialPass = true;
+  uint64_t start = timer.getTimeNanoseconds();
+  for (cl_uint i = 0; i < iterations; i++)
+  {
+    for (unsigned c = 0; c < numChunks; c++)
+    {
+      fill(cl::EnqueueArgs(computeQueue, cl::NDRange(c*chunkItems),
+                           cl::NDRange(chunkItems), cl::NullRange),
+           d_buffer, i);
+      computeQueue.finish();
+      copyQueue.enqueueReadBuffer(d_buffer, CL_TRUE, c*chunkBytes, chunkBytes,
+                                  h_pinned + c*chunkItems);
+    }
+    serialPass &= checkOutput(h_pinned, i);
+  }
+  double serialSeconds = (timer.getTimeNanoseconds() - start) * 1e-9;
+
+
+  // Overlapped: the read of chunk c only waits for the fill of chunk c, so
+  // it can run while the fill of chunk c+1 is executing
+  bool overlapPass = true;
+  std::vector<util::EventInterval> kernels, copies;
+  start = timer.getTimeNanoseconds();
+  for (cl_uint i = 0; i < iterations; i++)
+  {
+    std::vector<cl::Event> fills(numChunks), reads(numChunks);
+    for (unsigned c = 0; c < numChunks; c++)
+    {
+      fills[c] = fill(cl::EnqueueArgs(computeQueue, cl::NDRange(c*chunkItems),
+                                      cl::NDRange(chunkItems), cl::NullRange),
+                      d_buffer, i);
+      computeQueue.flush();
+
+      std::vector<cl::Event> wait(1, fills[c]);
+      copyQueue.enqueueReadBuffer(d_buffer, CL_FALSE, c*chunkBytes, chunkBytes,
+                                  h_pinned + c*chunkItems, &wait, &reads[c]);
+      copyQueue.flush();
+    }
+    copyQueue.finish();
+    computeQueue.finish();
+
+    overlapPass &= checkOutput(h_pinned, i);
+
+    for (unsigned c = 0; c < numChunks; c++)
+    {
+      kernels.push_back(util::eventInterval(fills[c]));
+      copies.push_back(util::eventInterval(reads[c]));
+    }
+  }
+  double overlapWall = (timer.getTimeNanoseconds() - start) * 1e-9;
+
+  queue.enqueueUnmapMemObject(d_pinned, h_pinned);
+  queue.finish();
+
+  double kernelBusy   = util::busySeconds(kernels);
+  double copyBusy     = util::busySeconds(copies);
+  double overlap      = util::overlapSeconds(kernels, copies);
+  double maxOverlap   = std::min(kernelBusy, copyBusy);
+  double fraction     = maxOverlap > 0.0 ? overlap / maxOverlap : 0.0;
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Type            Total       Throughput" << std::endl
+            << "--------------------------------------" << std::endl;
+  printRow("Serialized", serialSeconds, totalBytes, serialPass);
+  printRow("Overlapped", overlapWall, totalBytes, overlapPass);
+  std::cout << std::endl
+            << "Kernel busy          " << std::setw(8) << kernelBusy*1e3 << " ms" << std::endl
+            << "Copy busy            " << std::setw(8) << copyBusy*1e3 << " ms" << std::endl
+            << "Kernel/copy overlap  " << std::setw(8) << overlap*1e3 << " ms" << std::endl
+            << "Overlap fraction     " << std::setw(8) << fraction*100 << " %" << std::endl
+            << "Speed-up             " << std::setw(8) << serialSeconds / overlapWall << " x" << std::endl
+            << std::endl;
+
+  if (fraction > 0.5)
+    std::cout << "Copies run concurrently with kernels: "
+                 "the device appears to have an independent copy engine" << std::endl;
+  else
+    std::cout << "Copies and kernels are mostly serialized: "
+                 "no independent copy engine was observed" << std::endl;
+}
@@ -0,0 +1,278 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Rect mode: move a 2D sub-region of a row-major grid between the host and
+// the device, as a halo exchange would. Each region is moved four ways:
+//
+//   rect         enqueueRead/WriteBufferRect straight to/from packed host memory
+//   device-pack  pack kernel into a contiguous buffer, then a plain transfer
+//   copy-rect    enqueueCopyBufferRect into a contiguous buffer, then a plain
+//                transfer
+//   host-pack    transfer every row the region spans and pack on the host
+//
+// for several row pitches and region shapes, to find the fastest on each
+// device.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+
+#include "transfer.hpp"
+
+namespace {
+
+const char *rect_source =
+"kernel void pack(global const uint *grid, uint pitch, uint x0, uint y0,\n"
+"                 global uint *packed)\n"
+"{\n"
+"  uint x = get_global_id(0), y = get_global_id(1);\n"
+"  packed[y*get_global_size(0) + x] = grid[(y0+y)*pitch + x0+x];\n"
+"}\n"
+"kernel void unpack(global uint *grid, uint pitch, uint x0, uint y0,\n"
+"                   global const uint *packed)\n"
+"{\n"
+"  uint x = get_global_id(0), y = get_global_id(1);\n"
+"  grid[(y0+y)*pitch + x0+x] = packed[y*get_global_size(0) + x];\n"
+"}\n";
+
+const unsigned HALO = 4;   // ghost cell depth
+const cl_uint  MARKER = 0x80000000;
+
+typedef cl::KernelFunctor<cl::Buffer, cl_uint, cl_uint, cl_uint, cl::Buffer> PackFunctor;
+
+struct Region
+{
+  const char *name;
+  size_t x0, y0, w, h;   // in words
+};
+
+struct RectContext
+{
+  cl::CommandQueue queue;
+  cl::KernelFunctor<cl::Buffer, cl_uint> fill;
+  PackFunctor pack, unpack;
+
+  size_t pitch, rows;         // grid shape in words
+  cl::Buffer grid;            // pitch x rows
+  cl::Buffer d_packed;        // region, contiguous
+  std::vector<cl_uint> packed;
+  std::vector<cl_uint> mirror; // host copy of the rows a region spans
+};
+
+cl::array<cl::size_type, 3> origin(size_t x, size_t y)
+{
+  cl::array<cl::size_type, 3> o = {{ x*4, y, 0 }};
+  return o;
+}
+
+cl::array<cl::size_type, 3> extent(const Region& r)
+{
+  cl::array<cl::size_type, 3> e = {{ r.w*4, r.h, 1 }};
+  return e;
+}
+
+// Mean time in microseconds over the benchmark iterations, after a warm-up.
+// setup runs untimed before every repetition.
+double timeMethod(RectContext& c, std::function<void()> setup,
+                  std::function<void()> method)
+{
+  util::Timer timer;
+  uint64_t total = 0;
+  for (unsigned i = 0; i <= iterations; i++)
+  {
+    setup();
+    c.queue.finish();
+
+    uint64_t start = timer.getTimeNanoseconds();
+    method();
+    c.queue.finish();
+    if (i > 0)
+      total += timer.getTimeNanoseconds() - start;
+  }
+  return total * 1e-3 / iterations;
+}
+
+// Grid values are their own index, so a region read back can be checked
+void resetGrid(RectContext& c)
+{
+  c.fill(cl::EnqueueArgs(c.queue, cl::NDRange(c.pitch*c.rows)), c.grid, 0);
+}
+
+bool checkRead(RectContext& c, const Region& r)
+{
+  for (size_t y = 0; y < r.h; y++)
+    for (size_t x = 0; x < r.w; x++)
+      if (c.packed[y*r.w + x] != (r.y0+y)*c.pitch + r.x0+x)
+        return false;
+  return true;
+}
+
+bool checkWrite(RectContext& c, const Region& r)
+{
+  std::vector<cl_uint> result(r.w * r.h);
+  c.queue.enqueueReadBufferRect(c.grid, CL_TRUE, origin(r.x0, r.y0), origin(0, 0),
+                                extent(r), c.pitch*4, 0, r.w*4, 0, &result[0]);
+  for (size_t i = 0; i < result.size(); i++)
+    if (result[i] != (MARKER | (cl_uint)i))
+      return false;
+  return true;
+}
+
+void printRow(const char *direction, const Region& r, size_t pitch,
+              const double times[4], const bool pass[4])
+{
+  const char *methods[] = { "rect", "device-pack", "copy-rect", "host-pack" };
+  int best = -1;
+  for (int m = 0; m < 4; m++)
+    if (pass[m] && (best < 0 || times[m] < times[best]))
+      best = m;
+
+  std::cout << std::left << std::setw(5) << direction << std::setw(8) << r.name
+            << std::right << std::setw(7) << pitch*4
+            << std::setw(7) << r.w << "x" << std::left << std::setw(6) << r.h
+            << std::right;
+  for (int m = 0; m < 4; m++)
+  {
+    if (pass[m])
+      std::cout << std::setw(12) << times[m];
+    else
+      std::cout << std::setw(12) << "FAILED";
+  }
+  std::cout << "   " << (best < 0 ? "-" : methods[best]) << std::endl;
+}
+
+void runRegion(RectContext& c, const Region& r)
+{
+  size_t bytes = r.w * r.h * 4;
+  c.packed.resize(r.w * r.h);
+  c.mirror.resize(r.h * c.pitch);
+  double times[4];
+  bool   pass[4];
+
+  // Device to host
+  std::function<void()> reset = [&]() { resetGrid(c); };
+
+  times[0] = timeMethod(c, reset, [&]() {
+    c.queue.enqueueReadBufferRect(c.grid, CL_TRUE, origin(r.x0, r.y0), origin(0, 0),
+                                  extent(r), c.pitch*4, 0, r.w*4, 0, &c.packed[0]);
+  });
+  pass[0] = checkRead(c, r);
+
+  times[1] = timeMethod(c, reset, [&]() {
+    c.pack(cl::EnqueueArgs(c.queue, cl::NDRange(r.w, r.h)),
+           c.grid, (cl_uint)c.pitch, (cl_uint)r.x0, (cl_uint)r.y0, c.d_packed);
+    c.queue.enqueueReadBuffer(c.d_packed, CL_TRUE, 0, bytes, &c.packed[0]);
+  });
+  pass[1] = checkRead(c, r);
+
+  times[2] = timeMethod(c, reset, [&]() {
+    c.queue.enqueueCopyBufferRect(c.grid, c.d_packed, origin(r.x0, r.y0), origin(0, 0),
+                                  extent(r), c.pitch*4, 0, r.w*4, 0);
+    c.queue.enqueueReadBuffer(c.d_packed, CL_TRUE, 0, bytes, &c.packed[0]);
+  });
+  pass[2] = checkRead(c, r);
+
+  times[3] = timeMethod(c, reset, [&]() {
+    c.queue.enqueueReadBuffer(c.grid, CL_TRUE, r.y0*c.pitch*4, r.h*c.pitch*4,
+                              &c.mirror[0]);
+    for (size_t y = 0; y < r.h; y++)
+      memcpy(&c.packed[y*r.w], &c.mirror[y*c.pitch + r.x0], r.w*4);
+  });
+  pass[3] = checkRead(c, r);
+
+  printRow("D2H", r, c.pitch, times, pass);
+
+
+  // Host to device, from a packed halo
+  for (size_t i = 0; i < c.packed.size(); i++)
+    c.packed[i] = MARKER | (cl_uint)i;
+
+  times[0] = timeMethod(c, reset, [&]() {
+    c.queue.enqueueWriteBufferRect(c.grid, CL_TRUE, origin(r.x0, r.y0), origin(0, 0),
+                                   extent(r), c.pitch*4, 0, r.w*4, 0, &c.packed[0]);
+  });
+  pass[0] = checkWrite(c, r);
+
+  times[1] = timeMethod(c, reset, [&]() {
+    c.queue.enqueueWriteBuffer(c.d_packed, CL_FALSE, 0, bytes, &c.packed[0]);
+    c.unpack(cl::EnqueueArgs(c.queue, cl::NDRange(r.w, r.h)),
+             c.grid, (cl_uint)c.pitch, (cl_uint)r.x0, (cl_uint)r.y0, c.d_packed);
+  });
+  pass[1] = checkWrite(c, r);
+
+  times[2] = timeMethod(c, reset, [&]() {
+    c.queue.enqueueWriteBuffer(c.d_packed, CL_FALSE, 0, bytes, &c.packed[0]);
+    c.queue.enqueueCopyBufferRect(c.d_packed, c.grid, origin(0, 0), origin(r.x0, r.y0),
+                                  extent(r), r.w*4, 0, c.pitch*4, 0);
+  });
+  pass[2] = checkWrite(c, r);
+
+  // Assumes the host keeps its own copy of the rows around the halo, so
+  // it can unpack into them and send whole rows
+  times[3] = timeMethod(c, [&]() {
+    resetGrid(c);
+    c.queue.enqueueReadBuffer(c.grid, CL_TRUE, r.y0*c.pitch*4, r.h*c.pitch*4,
+                              &c.mirror[0]);
+  }, [&]() {
+    for (size_t y = 0; y < r.h; y++)
+      memcpy(&c.mirror[y*c.pitch + r.x0], &c.packed[y*r.w], r.w*4);
+    c.queue.enqueueWriteBuffer(c.grid, CL_TRUE, r.y0*c.pitch*4, r.h*c.pitch*4,
+                               &c.mirror[0]);
+  });
+  pass[3] = checkWrite(c, r);
+
+  printRow("H2D", r, c.pitch, times, pass);
+}
+
+} // namespace
+
+void runRect(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  cl::Program fillProgram(context, kernel_source, true);
+  cl::Program rectProgram(context, rect_source, true);
+
+  RectContext c = { queue,
+                    cl::KernelFunctor<cl::Buffer, cl_uint>(fillProgram, "fill"),
+                    PackFunctor(rectProgram, "pack"),
+                    PackFunctor(rectProgram, "unpack") };
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Dir  Region   Pitch   Size (words)        rect"
+               " device-pack   copy-rect   host-pack   Fastest" << std::endl
+            << "                     (bytes)                (us)"
+               "        (us)        (us)        (us)" << std::endl
+            << "--------------------------------------------------"
+               "----------------------------------------------" << std::endl;
+
+  const size_t pitches[] = { 256, 1024, 4096 };
+  for (unsigned p = 0; p < 3; p++)
+  {
+    c.pitch = pitches[p];
+    c.rows  = (bufferSize/4) / c.pitch;
+    if (c.rows < 2*HALO)
+      continue;
+
+    c.grid     = cl::Buffer(context, CL_MEM_READ_WRITE, c.pitch * c.rows * 4);
+    c.d_packed = cl::Buffer(context, CL_MEM_READ_WRITE, c.pitch * c.rows * 4);
+
+    size_t panel = std::min((size_t)256, std::min(c.pitch, c.rows) / 2);
+    Region regions[] = {
+      { "rows",    0,             0,          c.pitch, HALO   },
+      { "columns", 0,             0,          HALO,    c.rows },
+      { "panel",   c.pitch/4,     c.rows/4,   panel,   panel  },
+    };
+    for (unsigned r = 0; r < 3; r++)
+      runRegion(c, regions[r]);
+  }
+}
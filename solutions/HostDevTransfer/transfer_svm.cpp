@@ -0,0 +1,241 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// SVM mode: the fill-and-check loop run over shared virtual memory next to
+// the buffer paths. Coarse-grained SVM is accessed with map/unmap, while
+// fine-grained SVM is read by the host directly once the kernel finishes.
+//
+// The rest of the exercise targets OpenCL 1.2, so the SVM entry points are
+// called through the C API, and the mode checks at run time that the device
+// supports OpenCL 2.0.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+// Expose the OpenCL 2.0 declarations in the C headers
+#define CL_TARGET_OPENCL_VERSION 200
+
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+#include "transfer.hpp"
+
+// The macOS OpenCL framework stops at 1.2 and has no SVM entry points
+#if defined(__APPLE__)
+#define NO_SVM
+#endif
+
+namespace {
+
+const unsigned LATENCY_REPS = 100;
+
+struct Path
+{
+  const char *name;
+
+  // Run the fill kernel with a value
+  std::function<void(cl_uint)> fill;
+
+  // Make the first bytes of the data readable on the host, and release them
+  std::function<cl_uint*(size_t)> acquire;
+  std::function<void(cl_uint*)>   release;
+};
+
+// Access covers making the data visible and reading all of it on the host,
+// since for fine-grained SVM reading it is the transfer
+void runPath(cl::CommandQueue& queue, Path& path)
+{
+  util::Timer timer;
+  bool pass = true;
+  uint64_t accessTime = 0;
+
+  for (cl_uint i = 0; i <= iterations; i++)
+  {
+    path.fill(i);
+    queue.finish();
+
+    uint64_t start = timer.getTimeNanoseconds();
+    cl_uint *data = path.acquire(bufferSize);
+    pass &= checkOutput(data, i);
+    path.release(data);
+    uint64_t end = timer.getTimeNanoseconds();
+
+    // The first iteration is a warm-up
+    if (i > 0)
+      accessTime += end - start;
+  }
+
+  // Latency of getting at one freshly written word
+  uint64_t latency = 0;
+  for (cl_uint i = 0; i < LATENCY_REPS; i++)
+  {
+    path.fill(i);
+    queue.finish();
+
+    uint64_t start = timer.getTimeNanoseconds();
+    cl_uint *data = path.acquire(sizeof(cl_uint));
+    pass &= (data[0] == i*42);
+    path.release(data);
+    latency += timer.getTimeNanoseconds() - start;
+  }
+
+  double seconds   = accessTime * 1e-9 / iterations;
+  double bandwidth = bufferSize / seconds * 1e-9;
+  std::cout << std::left << std::setw(13) << path.name << std::right;
+  if (pass)
+  {
+    std::cout << std::setw(10) << seconds*1e3 << " ms"
+              << std::setw(10) << bandwidth << " GB/s"
+              << std::setw(10) << latency*1e-3 / LATENCY_REPS << " us"
+              << std::endl;
+  }
+  else
+  {
+    std::cout << std::setw(10) << "-" << " ms"
+              << std::setw(10) << "-" << " GB/s"
+              << std::setw(10) << "-" << " us"
+              << "   FAILED" << std::endl;
+  }
+}
+
+#if !defined(NO_SVM)
+void check(cl_int err, const char *name)
+{
+  if (err != CL_SUCCESS)
+    throw cl::Error(err, name);
+}
+
+void runSVMPath(cl::Context& context, cl::CommandQueue& queue, cl::Kernel& fill,
+                const char *name, cl_svm_mem_flags flags)
+{
+  void *svm = clSVMAlloc(context(), flags, bufferSize, 0);
+  if (!svm)
+  {
+    std::cout << std::left << std::setw(13) << name << std::right
+              << "   allocation failed" << std::endl;
+    return;
+  }
+
+  bool fine = (flags & CL_MEM_SVM_FINE_GRAIN_BUFFER) != 0;
+  Path path;
+  path.name = name;
+  path.fill = [&](cl_uint value) {
+    check(clSetKernelArgSVMPointer(fill(), 0, svm), "clSetKernelArgSVMPointer");
+    fill.setArg(1, value);
+    queue.enqueueNDRangeKernel(fill, cl::NullRange, cl::NDRange(bufferSize/4));
+  };
+  path.acquire = [&](size_t size) {
+    // Fine-grained allocations are coherent once the kernel has finished
+    if (!fine)
+      check(clEnqueueSVMMap(queue(), CL_TRUE, CL_MAP_READ, svm, size,
+                            0, NULL, NULL), "clEnqueueSVMMap");
+    return (cl_uint*)svm;
+  };
+  path.release = [&](cl_uint *ptr) {
+    if (!fine)
+    {
+      check(clEnqueueSVMUnmap(queue(), ptr, 0, NULL, NULL), "clEnqueueSVMUnmap");
+      queue.finish();
+    }
+  };
+
+  try
+  {
+    runPath(queue, path);
+  }
+  catch (...)
+  {
+    queue.finish();
+    clSVMFree(context(), svm);
+    throw;
+  }
+  queue.finish();
+  clSVMFree(context(), svm);
+}
+#endif
+
+} // namespace
+
+void runSVM(cl::Context& context, cl::Device& device, cl::CommandQueue& queue)
+{
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Path             Access       Bandwidth      Latency" << std::endl
+            << "----------------------------------------------------" << std::endl;
+
+  // Buffer paths, for comparison
+  {
+    cl::Program program(context, kernel_source, true);
+    cl::KernelFunctor<cl::Buffer, cl_uint> fill(program, "fill");
+
+    cl::Buffer d_buffer(context, CL_MEM_READ_WRITE, bufferSize);
+    std::vector<cl_uint> h_buffer(bufferSize/4);
+    Path read;
+    read.name    = "Buffer read";
+    read.fill    = [&](cl_uint value) {
+      fill(cl::EnqueueArgs(queue, cl::NDRange(bufferSize/4)), d_buffer, value);
+    };
+    read.acquire = [&](size_t size) {
+      queue.enqueueReadBuffer(d_buffer, CL_TRUE, 0, size, &h_buffer[0]);
+      return &h_buffer[0];
+    };
+    read.release = [](cl_uint*) {};
+    runPath(queue, read);
+
+    cl::Buffer d_mapped(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bufferSize);
+    Path map;
+    map.name    = "Buffer map";
+    map.fill    = [&](cl_uint value) {
+      fill(cl::EnqueueArgs(queue, cl::NDRange(bufferSize/4)), d_mapped, value);
+    };
+    map.acquire = [&](size_t size) {
+      return (cl_uint*)queue.enqueueMapBuffer(d_mapped, CL_TRUE, CL_MAP_READ, 0, size);
+    };
+    map.release = [&](cl_uint *ptr) {
+      queue.enqueueUnmapMemObject(d_mapped, ptr);
+      queue.finish();
+    };
+    runPath(queue, map);
+  }
+
+#if defined(NO_SVM)
+  std::cout << std::endl << "SVM is not available on this platform" << std::endl;
+#else
+  // CL_DEVICE_VERSION is "OpenCL <major>.<minor> <vendor info>"
+  std::istringstream version(device.getInfo<CL_DEVICE_VERSION>().substr(7));
+  unsigned major = 0;
+  version >> major;
+  if (major < 2)
+  {
+    std::cout << std::endl << "SVM requires an OpenCL 2.0 device" << std::endl;
+    return;
+  }
+
+  cl_device_svm_capabilities caps = 0;
+  check(clGetDeviceInfo(device(), CL_DEVICE_SVM_CAPABILITIES,
+                        sizeof(caps), &caps, NULL), "clGetDeviceInfo");
+
+  // SVM pointers only reach the kernel as arguments, which needs no
+  // OpenCL C 2.0 features; OpenCL 3.0 devices need not support CL2.0
+  cl::Program program(context, kernel_source);
+  program.build(std::vector<cl::Device>(1, device));
+  cl::Kernel fill(program, "fill");
+
+  if (caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER)
+    runSVMPath(context, queue, fill, "SVM coarse", CL_MEM_READ_WRITE);
+
+  if (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+    runSVMPath(context, queue, fill, "SVM fine", CL_MEM_READ_WRITE | CL_MEM_SVM_FINE_GRAIN_BUFFER);
+  else
+    std::cout << std::left << std::setw(13) << "SVM fine" << std::right
+              << "   not supported by this device" << std::endl;
+#endif
+}
@@ -0,0 +1,165 @@
+//
+// OpenCL host<->device transfer exercise
+//
+// Threads mode: T host threads, each with its own command queue, pinned
+// host buffer and device buffer, write to the device at the same time.
+// The aggregate bandwidth and how evenly it is shared between the threads
+// are reported as T and the chunk size vary, to show where the driver or
+// the bus saturates.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <thread>
+
+#include "transfer.hpp"
+
+namespace {
+
+const unsigned MAX_THREADS = 16;
+
+struct Producer
+{
+  cl::CommandQueue queue;
+  cl::Buffer       d_buffer;
+  cl::Buffer       d_pinned;
+  void            *h_pinned;
+
+  uint64_t start, end;   // nanoseconds on the shared timer
+  std::string error;
+};
+
+// Each thread queues its chunks back to back and waits for them at the end,
+// like a producer that never has to wait for the device to consume
+void produce(Producer& p, size_t chunk, unsigned count,
+             util::Timer& timer, std::atomic<bool>& go)
+{
+  while (!go)
+    std::this_thread::yield();
+
+  try
+  {
+    p.start = timer.getTimeNanoseconds();
+    for (unsigned i = 0; i < count; i++)
+      p.queue.enqueueWriteBuffer(p.d_buffer, CL_FALSE, 0, chunk, p.h_pinned);
+    p.queue.finish();
+    p.end = timer.getTimeNanoseconds();
+  }
+  catch (cl::Error& err)
+  {
+    p.error = err.what();
+  }
+}
+
+void runConfiguration(cl::Context& context, cl::Device& device,
+                      unsigned numThreads, size_t chunk)
+{
+  // Same total volume for every thread count, so rows are comparable
+  size_t   total = (size_t)bufferSize * iterations;
+  unsigned count = (unsigned)std::max((size_t)4, total / (chunk * numThreads));
+
+  std::vector<Producer> producers(numThreads);
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    Producer& p = producers[t];
+    p.queue    = cl::CommandQueue(context, device);
+    p.d_buffer = cl::Buffer(context, CL_MEM_READ_WRITE, chunk);
+    p.d_pinned = cl::Buffer(context, CL_MEM_ALLOC_HOST_PTR, chunk);
+    p.h_pinned = p.queue.enqueueMapBuffer(p.d_pinned, CL_TRUE,
+                                          CL_MAP_READ | CL_MAP_WRITE, 0, chunk);
+    memset(p.h_pinned, t, chunk);
+
+    // Warm up the path before timing
+    p.queue.enqueueWriteBuffer(p.d_buffer, CL_TRUE, 0, chunk, p.h_pinned);
+  }
+
+  util::Timer timer;
+  std::atomic<bool> go(false);
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < numThreads; t++)
+    threads.push_back(std::thread(produce, std::ref(producers[t]), chunk, count,
+                                  std::ref(timer), std::ref(go)));
+  go = true;
+  for (unsigned t = 0; t < numThreads; t++)
+    threads[t].join();
+
+  uint64_t first = UINT64_MAX, last = 0;
+  double sum = 0.0, sumSq = 0.0, slowest = 1e30, fastest = 0.0;
+  bool failed = false;
+  for (unsigned t = 0; t < numThreads; t++)
+  {
+    Producer& p = producers[t];
+    p.queue.enqueueUnmapMemObject(p.d_pinned, p.h_pinned);
+    p.queue.finish();
+
+    // A failed thread has no meaningful end time, so leave it out entirely
+    if (!p.error.empty())
+    {
+      std::cout << "Thread " << t << " failed: " << p.error << std::endl;
+      failed = true;
+      continue;
+    }
+    first = std::min(first, p.start);
+    last  = std::max(last, p.end);
+
+    double bw = (double)chunk * count / std::max((uint64_t)1, p.end - p.start);
+    sum     += bw;
+    sumSq   += bw * bw;
+    slowest  = std::min(slowest, bw);
+    fastest  = std::max(fastest, bw);
+  }
+
+  std::cout << std::setw(7) << numThreads
+            << std::setw(10) << chunk / 1024;
+  if (failed)
+  {
+    std::cout << "   FAILED" << std::endl;
+    return;
+  }
+
+  // Jain's index: 1 when every thread gets the same share, 1/T when one
+  // thread gets it all
+  double aggregate = (double)chunk * count * numThreads / (last - first);
+  double jain      = sum * sum / (numThreads * sumSq);
+
+  std::cout << std::setw(13) << aggregate
+            << std::setw(12) << slowest
+            << std::setw(12) << fastest
+            << std::setw(10) << jain
+            << std::endl;
+}
+
+} // namespace
+
+void runThreads(cl::Context& context, cl::Device& device, cl::CommandQueue&)
+{
+  unsigned maxThreads = std::min(MAX_THREADS,
+                                 std::max(1u, std::thread::hardware_concurrency()));
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Threads  Chunk    Aggregate     Slowest     Fastest  Fairness" << std::endl
+            << "          (KB)       (GB/s)      (GB/s)      (GB/s)    (Jain)" << std::endl
+            << "-------------------------------------------------------------" << std::endl;
+
+  const size_t chunks[] = { 64*1024, 1024*1024, 16*1024*1024 };
+  for (unsigned c = 0; c < 3; c++)
+  {
+    if (chunks[c] > bufferSize && c > 0)
+      break;
+    for (unsigned t = 1; t <= maxThreads; t *= 2)
+      runConfiguration(context, device, t, std::min(chunks[c], (size_t)bufferSize));
+    std::cout << std::endl;
+  }
+}
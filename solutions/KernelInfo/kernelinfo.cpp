@@ -0,0 +1,378 @@
+//
+// OpenCL kernel resource usage report
+//
+// Builds every kernel source in the solutions with the options the
+// solution builds it with, and reports what each kernel needs from each
+// device: private memory per work-item, local memory per work-group, the
+// preferred work-group size multiple and the largest work-group size the
+// kernel can be launched with. Kernels whose needs are likely to limit
+// occupancy are flagged, for example a large private array spilling to
+// off-chip memory, or local memory that leaves room for only one
+// work-group per compute unit.
+//
+// The build options and launch sizes below are the defaults of each
+// solution, so they need updating if those change.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <device_picker.hpp>
+#include <util.hpp>
+
+void parseArguments(int argc, char *argv[]);
+
+// Parameters, with default values.
+unsigned    deviceIndex   = DEVICE_ALL;
+std::string sourceDir     =    "..";
+
+// Private memory per work-item above which spilling is likely
+const size_t PRIVATE_LIMIT = 256;
+
+// A __local pointer argument and the size the solution gives it
+struct LocalArg
+{
+  const char *kernel;
+  cl_uint     index;
+  size_t      bytes;          // Fixed size, or
+  size_t      bytesPerItem;   // size per work-item of the largest work-group
+};
+
+struct ProgramSpec
+{
+  std::string           label;
+  std::string           file;
+  std::string           options;
+  size_t                launchSize;   // Work-items per group, 0 if left to the runtime
+  std::vector<LocalArg> locals;
+};
+
+ProgramSpec spec(const std::string& label, const std::string& file,
+                 const std::string& options, size_t launchSize)
+{
+  ProgramSpec s;
+  s.label      = label;
+  s.file       = file;
+  s.options    = options;
+  s.launchSize = launchSize;
+  return s;
+}
+
+std::string nbodyOptions(float softening, float delta, unsigned wgsize,
+                         bool singlePrecisionConstant, bool useLocal)
+{
+  std::stringstream options;
+  options.setf(std::ios::fixed, std::ios::floatfield);
+  options << " -cl-fast-relaxed-math";
+  if (singlePrecisionConstant)
+    options << " -cl-single-precision-constant";
+  options << " -Dsoftening=" << softening << "f";
+  options << " -Ddelta=" << delta << "f";
+  options << " -DWGSIZE=" << wgsize;
+  if (useLocal)
+    options << " -DUSE_LOCAL";
+  return options.str();
+}
+
+std::vector<ProgramSpec> programSpecs()
+{
+  std::vector<ProgramSpec> specs;
+
+  specs.push_back(spec("VAdd_Chain", "VAdd_Chain/vadd_chain.cl", "", 0));
+  specs.push_back(spec("VAdd_Stream", "VAdd_Stream/vadd_stream.cl", "", 0));
+
+  // Work-groups as large as the kernel allows, with a float of local
+  // memory per work-item
+  ProgramSpec pi = spec("Pi", "Pi/pi_ocl.cl", "", 0);
+  LocalArg piSums = { "pi", 2, 0, sizeof(float) };
+  pi.locals.push_back(piSums);
+  specs.push_back(pi);
+
+  // ORDER and BLOCKSIZE from matmul.hpp and the MatMul Makefile
+  const size_t order = 1024, blockSize = 8;
+  specs.push_back(spec("MatMul C_elem", "MatMul/C_elem.cl", "", 0));
+  specs.push_back(spec("MatMul C_row", "MatMul/C_row.cl", "", 0));
+  specs.push_back(spec("MatMul C_row_priv", "MatMul/C_row_priv.cl", "", order/16));
+  ProgramSpec bloc = spec("MatMul C_row_priv_bloc", "MatMul/C_row_priv_bloc.cl", "",
+                          order/16);
+  LocalArg bwrk = { "mmul", 4, sizeof(float) * order, 0 };
+  bloc.locals.push_back(bwrk);
+  specs.push_back(bloc);
+  ProgramSpec block = spec("MatMul C_block_form", "MatMul/C_block_form.cl",
+                           "-DBLKSZ=8", blockSize*blockSize);
+  LocalArg awrkBlock = { "mmul", 4, sizeof(float) * blockSize*blockSize, 0 };
+  LocalArg bwrkBlock = { "mmul", 5, sizeof(float) * blockSize*blockSize, 0 };
+  block.locals.push_back(awrkBlock);
+  block.locals.push_back(bwrkBlock);
+  specs.push_back(block);
+
+  std::string bilateral =
+    " -cl-fast-relaxed-math -cl-single-precision-constant"
+    " -DRADIUS=2 -DSIGMA_DOMAIN=3.000000 -DSIGMA_RANGE=0.200000";
+  specs.push_back(spec("Bilateral images", "Bilateral/bilateral_images.cl", bilateral, 0));
+  specs.push_back(spec("Bilateral meta", "Bilateral/bilateral_meta.cl", bilateral, 0));
+  specs.push_back(spec("Bilateral opt", "Bilateral/bilateral_opt.cl", bilateral, 0));
+
+  for (int useLocal = 0; useLocal < 2; useLocal++)
+  {
+    const char *suffix = useLocal ? " (local)" : "";
+    specs.push_back(spec(std::string("NBody") + suffix, "NBody/kernel.cl",
+                         nbodyOptions(0.05f, 0.0002f, 64, false, useLocal), 64));
+    specs.push_back(spec(std::string("NBody-GL") + suffix, "NBody-GL/kernel.cl",
+                         nbodyOptions(10.f, 0.1f, 64, true, useLocal), 64));
+    specs.push_back(spec(std::string("NBody-GL-VBO") + suffix, "NBody-GL-VBO/kernel.cl",
+                         nbodyOptions(0.05f, 0.0001f, 16, true, useLocal), 16));
+  }
+
+  return specs;
+}
+
+// Reasons the kernel may not keep the device busy, or may not launch
+std::string occupancyFlags(const cl::Device& device, const ProgramSpec& spec,
+                           size_t privateMem, size_t localMem,
+                           size_t preferredMultiple, size_t maxWorkGroup)
+{
+  std::vector<std::string> flags;
+  std::ostringstream flag;
+
+  if (privateMem > PRIVATE_LIMIT)
+  {
+    flag << privateMem << " B private per work-item, likely spilled";
+    flags.push_back(flag.str());
+    flag.str("");
+  }
+
+  cl_ulong deviceLocal = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+  if (localMem > 0 && localMem * 2 > deviceLocal)
+  {
+    flag << "local memory fits " << (localMem > deviceLocal ? 0 : 1)
+         << " work-group per compute unit";
+    flags.push_back(flag.str());
+    flag.str("");
+  }
+
+  if (maxWorkGroup < device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>())
+  {
+    flag << "work-group size limited to " << maxWorkGroup;
+    flags.push_back(flag.str());
+    flag.str("");
+  }
+
+  if (spec.launchSize > maxWorkGroup)
+  {
+    flag << "launched with " << spec.launchSize << ", launch fails";
+    flags.push_back(flag.str());
+    flag.str("");
+  }
+  else if (spec.launchSize && spec.launchSize % preferredMultiple)
+  {
+    flag << "launched with " << spec.launchSize << ", not a multiple of "
+         << preferredMultiple;
+    flags.push_back(flag.str());
+    flag.str("");
+  }
+
+  std::string result;
+  for (size_t i = 0; i < flags.size(); i++)
+    result += (i ? "; " : "") + flags[i];
+  return result;
+}
+
+void reportDevice(const cl::Device& device, const std::vector<ProgramSpec>& specs)
+{
+  std::cout << std::endl << "Device: " << getDeviceName(device) << std::endl
+            << "  Local memory " << device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 1024
+            << " KB, max work-group size "
+            << device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>() << std::endl << std::endl;
+  std::cout << "Program                     Kernel          Private    Local  Multiple"
+               "   Max WG  Launch  Flags" << std::endl
+            << "                                                (B)      (B)" << std::endl
+            << std::string(110, '-') << std::endl;
+
+  cl::Context context(device);
+  for (size_t p = 0; p < specs.size(); p++)
+  {
+    const ProgramSpec& spec = specs[p];
+    std::cout << std::left << std::setw(28) << spec.label << std::right;
+
+    cl::Program program(context, util::loadProgram(sourceDir + "/" + spec.file));
+    std::vector<cl::Kernel> kernels;
+    try
+    {
+      program.build(std::vector<cl::Device>(1, device), spec.options.c_str());
+      program.createKernels(&kernels);
+    }
+    catch (cl::Error& err)
+    {
+      std::cout << "build failed (" << err_code(err.err()) << ")" << std::endl;
+      continue;
+    }
+
+    for (size_t k = 0; k < kernels.size(); k++)
+    {
+      cl::Kernel& kernel = kernels[k];
+      std::string name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+      size_t maxWorkGroup = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+
+      // Give __local arguments the sizes the solution uses, so that the
+      // local memory reported includes them
+      for (size_t l = 0; l < spec.locals.size(); l++)
+      {
+        const LocalArg& arg = spec.locals[l];
+        if (name != arg.kernel)
+          continue;
+        size_t bytes = arg.bytes ? arg.bytes : arg.bytesPerItem * maxWorkGroup;
+        kernel.setArg(arg.index, cl::Local(bytes));
+      }
+
+      size_t privateMem   = kernel.getWorkGroupInfo<CL_KERNEL_PRIVATE_MEM_SIZE>(device);
+      size_t localMem     = kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+      size_t multiple     =
+        kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device);
+
+      if (k > 0)
+        std::cout << std::setw(28) << "";
+      std::cout << std::left << std::setw(14) << name << std::right
+                << std::setw(9) << privateMem
+                << std::setw(9) << localMem
+                << std::setw(10) << multiple
+                << std::setw(9) << maxWorkGroup
+                << std::setw(8);
+      if (spec.launchSize)
+        std::cout << spec.launchSize;
+      else
+        std::cout << "auto";
+      std::cout << "  " << occupancyFlags(device, spec, privateMem, localMem,
+                                          multiple, maxWorkGroup)
+                << std::endl;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parseArguments(argc, argv);
+
+    // Get list of devices
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+
+    // Check device index in range
+    std::vector<cl::Device> selected = getSelectedDevices(devices, deviceIndex);
+    if (selected.empty())
+    {
+      std::cout << "Invalid device index (try '--list')" << std::endl;
+      return 1;
+    }
+
+    std::vector<ProgramSpec> specs = programSpecs();
+    for (unsigned d = 0; d < selected.size(); d++)
+      reportDevice(selected[d], specs);
+    std::cout << std::endl;
+  }
+  catch (cl::Error err)
+  {
+    std::cout << "Exception:" << std::endl
+              << "ERROR: "
+              << err.what()
+              << "("
+              << err_code(err.err())
+              << ")"
+              << std::endl;
+  }
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+  system("pause");
+#endif
+
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--list"))
+    {
+      // Get list of devices
+      std::vector<cl::Device> devices;
+      getDeviceList(devices);
+
+      // Print device names
+      if (devices.size() == 0)
+      {
+        std::cout << "No devices found." << std::endl;
+      }
+      else
+      {
+        std::cout << std::endl;
+        std::cout << "Devices:" << std::endl;
+        for (unsigned i = 0; i < devices.size(); i++)
+        {
+          std::cout << i << ": " << getDeviceName(devices[i]) << std::endl;
+        }
+        std::cout << std::endl;
+      }
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex))
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--sources"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid sources directory" << std::endl;
+        exit(1);
+      }
+      sourceDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./kernelinfo [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --list               List available devices" << std::endl;
+      std::cout << "      --device     INDEX   Report device at INDEX, 'auto' or 'all'"
+                   " (default all)" << std::endl;
+      std::cout << "      --sources    DIR     Directory holding the solutions" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}
@@ -0,0 +1,332 @@
+//
+// OpenCL kernel launch latency and throughput benchmark
+//
+// Measures the cost of launching a kernel that does no work, so that it can
+// be compared with the run time of short kernels such as the 1024 element
+// vadd to decide when batching or fusing kernels is worthwhile.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <device_picker.hpp>
+#include <util.hpp>
+#include <bench.hpp>
+
+void parseArguments(int argc, char *argv[]);
+
+// Benchmark parameters, with default values.
+unsigned deviceIndex   =      0;
+unsigned iterations    =   1000;
+unsigned items         =   1024; // Global size of each launch
+
+const char *kernel_source =
+"kernel void empty(global uint *data)"
+"{"
+"}";
+
+// Print a result recorded from samples in milliseconds, in microseconds
+void printRow(const char *name, const util::BenchResult& r)
+{
+  std::cout << "  " << std::left << std::setw(24) << name << std::right
+            << std::setw(10) << r.median*1e3
+            << std::setw(10) << r.min*1e3
+            << std::setw(10) << r.max*1e3 << " us" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parseArguments(argc, argv);
+
+    // Get list of devices
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+
+    // Check device index in range
+    if (deviceIndex >= devices.size())
+    {
+      std::cout << "Invalid device index (try '--list')" << std::endl;
+      return 1;
+    }
+
+    cl::Device device = devices[deviceIndex];
+
+    std::string name = getDeviceName(device);
+    std::cout << std::endl << "Using OpenCL device: " << name << std::endl
+              << "Iterations  = " << iterations << std::endl
+              << "Global size = " << items << std::endl
+              << std::endl;
+
+    cl::Context context(device);
+    cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+    cl::Program program(context, kernel_source, true);
+    cl::KernelFunctor<cl::Buffer> empty(program, "empty");
+    cl::Buffer d_data(context, CL_MEM_READ_WRITE, sizeof(cl_uint));
+
+    cl::NDRange global(items);
+    util::Timer timer;
+
+    util::Benchmark bench("launch", device);
+    bench.param("iterations", iterations);
+    bench.param("items", items);
+
+    // Warm up
+    for (unsigned i = 0; i < 16; i++)
+      empty(cl::EnqueueArgs(queue, global), d_data);
+    queue.finish();
+
+    std::cout << std::fixed << std::setprecision(2);
+
+
+    // Latency of a single launch, split into its stages
+    {
+      std::vector<double> queuedToSubmit, submitToStart, startToEnd, host;
+      for (unsigned i = 0; i < iterations; i++)
+      {
+        uint64_t start = timer.getTimeNanoseconds();
+        cl::Event event = empty(cl::EnqueueArgs(queue, global), d_data);
+        event.wait();
+        uint64_t end = timer.getTimeNanoseconds();
+
+        cl_ulong queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+        cl_ulong submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+        cl_ulong begin  = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        cl_ulong finish = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        queuedToSubmit.push_back((submit - queued) * 1e-6);
+        submitToStart.push_back((begin - submit) * 1e-6);
+        startToEnd.push_back((finish - begin) * 1e-6);
+        host.push_back((end - start) * 1e-6);
+      }
+
+      std::cout << "Empty kernel latency          median       min       max" << std::endl
+                << "----------------------------------------------------------" << std::endl;
+      printRow("Queued -> submit",
+               bench.record("queued_to_submit", queuedToSubmit, 0, "", "device"));
+      printRow("Submit -> start",
+               bench.record("submit_to_start", submitToStart, 0, "", "device"));
+      printRow("Start -> end",
+               bench.record("start_to_end", startToEnd, 0, "", "device"));
+      printRow("Host round trip", bench.record("round_trip", host));
+      std::cout << std::endl;
+    }
+
+
+    // Throughput of back-to-back launches with different numbers in flight
+    {
+      std::cout << "Back-to-back launches     depth    launches/s   us/launch" << std::endl
+                << "----------------------------------------------------------" << std::endl;
+      for (unsigned depth = 1; depth <= 256; depth *= 4)
+      {
+        unsigned batches = std::max(1u, iterations / depth);
+        double launches  = (double)batches * depth;
+        std::ostringstream region;
+        region << "depth_" << depth;
+        util::BenchResult r = bench.time(region.str(), [&]()
+        {
+          for (unsigned b = 0; b < batches; b++)
+          {
+            for (unsigned i = 0; i < depth; i++)
+              empty(cl::EnqueueArgs(queue, global), d_data);
+            queue.finish();
+          }
+        }, launches, "launches/s");
+
+        std::cout << "  " << std::setw(28) << depth
+                  << std::setw(14) << r.rate
+                  << std::setw(12) << r.median * 1e3 / launches
+                  << std::endl;
+      }
+      std::cout << std::endl;
+    }
+
+
+    // Cost of the different ways of waiting for a launch to complete
+    {
+      std::vector<double> finish, wait, read;
+      cl_uint value;
+      for (unsigned i = 0; i < iterations; i++)
+      {
+        uint64_t t0 = timer.getTimeNanoseconds();
+        empty(cl::EnqueueArgs(queue, global), d_data);
+        queue.finish();
+        uint64_t t1 = timer.getTimeNanoseconds();
+        cl::Event event = empty(cl::EnqueueArgs(queue, global), d_data);
+        event.wait();
+        uint64_t t2 = timer.getTimeNanoseconds();
+        empty(cl::EnqueueArgs(queue, global), d_data);
+        queue.enqueueReadBuffer(d_data, CL_TRUE, 0, sizeof(value), &value);
+        uint64_t t3 = timer.getTimeNanoseconds();
+
+        finish.push_back((t1 - t0) * 1e-6);
+        wait.push_back((t2 - t1) * 1e-6);
+        read.push_back((t3 - t2) * 1e-6);
+      }
+
+      std::cout << "Synchronization               median       min       max" << std::endl
+                << "----------------------------------------------------------" << std::endl;
+      printRow("clFinish", bench.record("finish", finish));
+      printRow("clWaitForEvents", bench.record("wait_for_events", wait));
+      printRow("Blocking read (4 bytes)", bench.record("blocking_read", read));
+      std::cout << std::endl;
+    }
+
+
+    // Host-side enqueue cost of cl::KernelFunctor against the C API
+    {
+      cl::Kernel kernel = empty.getKernel();
+      kernel.setArg(0, d_data);
+      size_t globalSize = items;
+
+      std::vector<double> functor, raw;
+      for (unsigned i = 0; i < iterations; i++)
+      {
+        uint64_t t0 = timer.getTimeNanoseconds();
+        empty(cl::EnqueueArgs(queue, global), d_data);
+        uint64_t t1 = timer.getTimeNanoseconds();
+        queue.finish();
+
+        uint64_t t2 = timer.getTimeNanoseconds();
+        cl_int err = clEnqueueNDRangeKernel(queue(), kernel(), 1, NULL,
+                                            &globalSize, NULL, 0, NULL, NULL);
+        uint64_t t3 = timer.getTimeNanoseconds();
+        if (err != CL_SUCCESS)
+          throw cl::Error(err, "clEnqueueNDRangeKernel");
+        queue.finish();
+
+        functor.push_back((t1 - t0) * 1e-6);
+        raw.push_back((t3 - t2) * 1e-6);
+      }
+
+      util::BenchResult f = bench.record("enqueue_functor", functor);
+      util::BenchResult r = bench.record("enqueue_raw", raw);
+      std::cout << "Enqueue call                  median       min       max" << std::endl
+                << "----------------------------------------------------------" << std::endl;
+      printRow("cl::KernelFunctor", f);
+      printRow("clEnqueueNDRangeKernel", r);
+      std::cout << "  " << std::left << std::setw(24) << "Functor overhead" << std::right
+                << std::setw(10) << (f.median - r.median)*1e3 << " us" << std::endl;
+      std::cout << std::endl;
+    }
+
+    bench.write();
+  }
+  catch (cl::BuildError error)
+  {
+    std::string log = error.getBuildLog()[0].second;
+    std::cerr << std::endl << "Build failed:" << std::endl << log << std::endl;
+  }
+  catch (cl::Error err)
+  {
+    std::cout << "Exception:" << std::endl
+              << "ERROR: "
+              << err.what()
+              << "("
+              << err_code(err.err())
+              << ")"
+              << std::endl;
+  }
+  std::cout << std::endl;
+
+#if defined(_WIN32)
+  system("pause");
+#endif
+
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--list"))
+    {
+      // Get list of devices
+      std::vector<cl::Device> devices;
+      getDeviceList(devices);
+
+      // Print device names
+      if (devices.size() == 0)
+      {
+        std::cout << "No devices found." << std::endl;
+      }
+      else
+      {
+        std::cout << std::endl;
+        std::cout << "Devices:" << std::endl;
+        for (unsigned i = 0; i < devices.size(); i++)
+        {
+          std::cout << i << ": " << getDeviceName(devices[i]) << std::endl;
+        }
+        std::cout << std::endl;
+      }
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_MEMORY) ||
+          deviceIndex == DEVICE_ALL)
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--iterations") || !strcmp(argv[i], "-i"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &iterations) || iterations == 0)
+      {
+        std::cout << "Invalid number of iterations" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--items"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &items) || items == 0)
+      {
+        std::cout << "Invalid global size" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./launch [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --list               List available devices" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
+      std::cout << "  -i  --iterations ITRS    Number of launches per measurement" << std::endl;
+      std::cout << "      --items      N       Global size of each launch" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}
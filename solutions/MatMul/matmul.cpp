@@ -18,6 +18,10 @@
 //           Modified by Tom Deakin and Simon McIntosh-Smith, October 2012
 //           Updated to C++ Wrapper v1.2.6 by Tom Deakin, August 2013
 //           Modified to assume square matricies by Tom Deakin, October 2014
+//           Programs built through the binary cache (program_cache.hpp),
+//           reporting the build time of a cold or warm start
+//           Multiplications timed by the benchmark harness (bench.hpp)
+//           Device matrices taken from a sub-allocating pool (buffer_pool.hpp)
 //
 //------------------------------------------------------------------------------
 
@@ -25,9 +29,30 @@
 #include "matrix_lib.hpp"
 #include <util.hpp>
 #include "device_picker.hpp"
+#include <program_cache.hpp>
+#include <bench.hpp>
+#include <buffer_pool.hpp>
 
 #include <sstream>
 
+// Build a program from file through the binary cache, adding its build
+// time to build_time
+cl::Program buildProgram(const cl::Context& context, const cl::Device& device,
+                         const char *file, const std::string& options,
+                         util::Timer& timer, double& build_time)
+{
+    bool cached;
+    double start = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
+    cl::Program program = util::buildProgram(context, device,
+                                             util::loadProgram(file), options, &cached);
+    double time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start;
+    build_time += time;
+
+    printf(" %s built in %.1f ms (%s)\n", file, time * 1000.0,
+           cached ? "binary" : "from source");
+    return program;
+}
+
 int main(int argc, char *argv[])
 {
 
@@ -35,8 +60,8 @@ int main(int argc, char *argv[])
     int size;      // Number of elements in each matrix
 
 
-    double start_time;      // Starting time
     double run_time;        // Timing data
+    double build_time = 0;  // Total time spent building programs
     util::Timer timer;      // timing
 
     N = ORDER;
@@ -80,6 +105,11 @@ int main(int argc, char *argv[])
         cl::Context context(chosen_device);
         cl::CommandQueue queue(context, device);
 
+        util::Benchmark bench("matmul", device);
+        bench.param("order", N);
+        bench.param("blocksize", BLOCKSIZE);
+        double mflop = 2.0 * N * N * N / 1000000.0;
+
 //--------------------------------------------------------------------------------
 // Run sequential matmul
 //--------------------------------------------------------------------------------
@@ -87,16 +117,12 @@ int main(int argc, char *argv[])
         initmat(N, h_A, h_B, h_C);
 
         printf("\n===== Sequential, matrix mult (dot prod), order %d on host CPU ======\n",ORDER);
-        for(int i = 0; i < COUNT; i++)
+        zero_mat(N, h_C);
+        run_time = bench.time("sequential", [&]
         {
-            zero_mat(N, h_C);
-            start_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
-
             seq_mat_mul_sdot(N, h_A, h_B, h_C);
-
-            run_time  = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start_time;
-            results(N, h_C, run_time);
-        }
+        }, mflop, "MFLOPS").median / 1000.0;
+        results(N, h_C, run_time);
 
 //--------------------------------------------------------------------------------
 // Setup the buffers, initialize matrices, and write them into global memory
@@ -105,31 +131,58 @@ int main(int argc, char *argv[])
         //  Reset A, B and C matrices (just to play it safe)
         initmat(N, h_A, h_B, h_C);
 
-        d_a = cl::Buffer(context, h_A.begin(), h_A.end(), true);
+        // A and B live for the whole run; each variant takes C from the pool
+        // and gives it back, so only the first one allocates it
+        util::BufferPool pool(context, device);
 
-        d_b = cl::Buffer(context, h_B.begin(), h_B.end(), true);
+        d_a = pool.acquire(sizeof(float) * size);
+        queue.enqueueWriteBuffer(d_a, CL_TRUE, 0, sizeof(float) * size, &h_A[0]);
 
-        d_c = cl::Buffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * size);
+        d_b = pool.acquire(sizeof(float) * size);
+        queue.enqueueWriteBuffer(d_b, CL_TRUE, 0, sizeof(float) * size, &h_B[0]);
 
 //--------------------------------------------------------------------------------
-// OpenCL matrix multiplication ... Naive
+// Build the compute programs, through the binary cache
 //--------------------------------------------------------------------------------
 
-        // Create the compute program from the source buffer
-        cl::Program program(context, util::loadProgram("C_elem.cl"), true);
+        // Built up front, so their cost is reported separately from the
+        // multiplications
+        printf("\n===== Building programs ======\n");
+        std::stringstream options;
+        options << "-DBLKSZ=" << BLOCKSIZE;
+        cl::Program elem_program = buildProgram(context, device, "C_elem.cl", "",
+                                                timer, build_time);
+        cl::Program row_program = buildProgram(context, device, "C_row.cl", "",
+                                               timer, build_time);
+        cl::Program row_priv_program = buildProgram(context, device, "C_row_priv.cl", "",
+                                                    timer, build_time);
+        cl::Program row_priv_bloc_program = buildProgram(context, device, "C_row_priv_bloc.cl", "",
+                                                         timer, build_time);
+        cl::Program block_program = buildProgram(context, device, "C_block_form.cl",
+                                                 options.str(), timer, build_time);
+
+        const util::ProgramCacheStats& stats = util::programCacheStats();
+        printf(" %.1f ms in total: %u precompiled, %u cached, %u from source\n",
+               build_time * 1000.0, stats.precompiled, stats.hits, stats.misses);
+        if (stats.rejected)
+            printf(" %u binaries were rejected and rebuilt\n", stats.rejected);
+        printf(" (%s start; set OPENCL_PROGRAM_CACHE=0 to build from source)\n",
+               stats.misses ? "cold" : "warm");
+
+//--------------------------------------------------------------------------------
+// OpenCL matrix multiplication ... Naive
+//--------------------------------------------------------------------------------
 
         // Create the compute kernel from the program
-        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer> naive_mmul(program, "mmul");
+        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer> naive_mmul(elem_program, "mmul");
 
         printf("\n===== OpenCL, matrix mult, C(i,j) per work item, order %d ======\n",N);
 
-        // Do the multiplication COUNT times
-        for (int i = 0; i < COUNT; i++)
-        {
-            zero_mat(N, h_C);
-
-            start_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
+        d_c = pool.acquire(sizeof(float) * size);
+        zero_mat(N, h_C);
 
+        run_time = bench.time("naive", [&]
+        {
             // Execute the kernel over the entire range of C matrix elements ... computing
             // a dot product for each element of the product matrix.  The local work
             // group size is set to NULL ... so I'm telling the OpenCL runtime to
@@ -139,101 +192,83 @@ int main(int argc, char *argv[])
                     N, d_a, d_b, d_c);
 
             queue.finish();
+        }, mflop, "MFLOPS").median / 1000.0;
 
-            run_time  = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start_time;
-
-            cl::copy(queue, d_c, h_C.begin(), h_C.end());
+        cl::copy(queue, d_c, h_C.begin(), h_C.end());
 
-            results(N, h_C, run_time);
+        results(N, h_C, run_time);
 
-        } // end for loop
+        pool.release(d_c);
 
 //--------------------------------------------------------------------------------
 // OpenCL matrix multiplication ... C row per work item
 //--------------------------------------------------------------------------------
 
-        // Create the compute program from the source buffer
-        program = cl::Program(context, util::loadProgram("C_row.cl"), true);
-
         // Create the compute kernel from the program
-        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer> crow_mmul(program, "mmul");
+        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer> crow_mmul(row_program, "mmul");
 
         printf("\n===== OpenCL, matrix mult, C row per work item, order %d ======\n",N);
 
-        // Do the multiplication COUNT times
-        for (int i = 0; i < COUNT; i++)
-        {
-            zero_mat(N, h_C);
-
-            start_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
+        d_c = pool.acquire(sizeof(float) * size);
+        zero_mat(N, h_C);
 
+        run_time = bench.time("row", [&]
+        {
             cl::NDRange global(N);
             crow_mmul(cl::EnqueueArgs(queue, global),
                     N, d_a, d_b, d_c);
 
             queue.finish();
+        }, mflop, "MFLOPS").median / 1000.0;
 
-            run_time  = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start_time;
-
-            cl::copy(queue, d_c, h_C.begin(), h_C.end());
+        cl::copy(queue, d_c, h_C.begin(), h_C.end());
 
-            results(N, h_C, run_time);
+        results(N, h_C, run_time);
 
-        } // end for loop
+        pool.release(d_c);
 
 //--------------------------------------------------------------------------------
 // OpenCL matrix multiplication ... C row per work item, A row in pivate memory
 //--------------------------------------------------------------------------------
 
-        // Create the compute program from the source buffer
-        program = cl::Program(context, util::loadProgram("C_row_priv.cl"), true);
-
         // Create the compute kernel from the program
-        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer> arowpriv_mmul(program, "mmul");
+        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer> arowpriv_mmul(row_priv_program, "mmul");
 
         printf("\n===== OpenCL, matrix mult, C row, A row in priv mem, order %d ======\n",N);
 
-        // Do the multiplication COUNT times
-        for (int i = 0; i < COUNT; i++)
-        {
-            zero_mat(N, h_C);
-
-            start_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
+        d_c = pool.acquire(sizeof(float) * size);
+        zero_mat(N, h_C);
 
+        run_time = bench.time("row_priv", [&]
+        {
             cl::NDRange global(N);
             cl::NDRange local(ORDER / 16);
             arowpriv_mmul(cl::EnqueueArgs(queue, global, local),
                     N, d_a, d_b, d_c);
 
             queue.finish();
+        }, mflop, "MFLOPS").median / 1000.0;
 
-            run_time  = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start_time;
-
-            cl::copy(queue, d_c, h_C.begin(), h_C.end());
+        cl::copy(queue, d_c, h_C.begin(), h_C.end());
 
-            results(N, h_C, run_time);
+        results(N, h_C, run_time);
 
-        } // end for loop
+        pool.release(d_c);
 
 //--------------------------------------------------------------------------------
 // OpenCL matrix multiplication ... C row per work item, A row pivate, B col local
 //--------------------------------------------------------------------------------
 
-        // Create the compute program from the source buffer
-        program = cl::Program(context, util::loadProgram("C_row_priv_bloc.cl"), true);
-
         // Create the compute kernel from the program
-        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg> browloc_mmul(program, "mmul");
+        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg> browloc_mmul(row_priv_bloc_program, "mmul");
 
         printf("\n===== OpenCL, mat mult, C row, priv A, B cols loc, order %d ======\n",N);
 
-        // Do the multiplication COUNT times
-        for (int i = 0; i < COUNT; i++)
-        {
-            zero_mat(N, h_C);
-
-            start_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
+        d_c = pool.acquire(sizeof(float) * size);
+        zero_mat(N, h_C);
 
+        run_time = bench.time("row_priv_bloc", [&]
+        {
             cl::NDRange global(N);
             cl::NDRange local(ORDER / 16);
 
@@ -243,38 +278,28 @@ int main(int argc, char *argv[])
                     N, d_a, d_b, d_c, localmem);
 
             queue.finish();
+        }, mflop, "MFLOPS").median / 1000.0;
 
-            run_time  = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start_time;
-
-            cl::copy(queue, d_c, h_C.begin(), h_C.end());
+        cl::copy(queue, d_c, h_C.begin(), h_C.end());
 
-            results(N, h_C, run_time);
+        results(N, h_C, run_time);
 
-        } // end for loop
+        pool.release(d_c);
 
 //--------------------------------------------------------------------------------
 // OpenCL matrix multiplication ... blocked
 //--------------------------------------------------------------------------------
 
-        // Create the compute program from the source buffer
-        program = cl::Program(context, util::loadProgram("C_block_form.cl"));
-        std::stringstream options;
-        options << "-DBLKSZ=" << BLOCKSIZE;
-        program.build(options.str().c_str());
-
-
         // Create the compute kernel from the program
-        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg, cl::LocalSpaceArg> block_mmul(program, "mmul");
+        cl::KernelFunctor<int, cl::Buffer, cl::Buffer, cl::Buffer, cl::LocalSpaceArg, cl::LocalSpaceArg> block_mmul(block_program, "mmul");
 
         printf("\n===== Parallel matrix mult (blocked %dx%d), order %d on device ======\n",BLOCKSIZE,BLOCKSIZE,ORDER);
 
-        // Do the multiplication COUNT times
-        for (int i = 0; i < COUNT; i++)
-        {
-            zero_mat(N, h_C);
-
-            start_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0;
+        d_c = pool.acquire(sizeof(float) * size);
+        zero_mat(N, h_C);
 
+        run_time = bench.time("block", [&]
+        {
             // Work-group computes a block of C.  This size is also set
             // in a #define inside the kernel function.  Note this blocksize
             // must evenly divide the matrix order
@@ -296,14 +321,25 @@ int main(int argc, char *argv[])
                 B_block);
 
             queue.finish();
+        }, mflop, "MFLOPS").median / 1000.0;
+
+        cl::copy(queue, d_c, h_C.begin(), h_C.end());
 
-            run_time = static_cast<double>(timer.getTimeNanoseconds()) / 1000000000.0 - start_time;
+        results(N, h_C, run_time);
 
-            cl::copy(queue, d_c, h_C.begin(), h_C.end());
+        pool.release(d_c);
 
-            results(N, h_C, run_time);
+        const util::BufferPoolStats& pooled = pool.getStats();
+        printf("\n===== Buffer pool ======\n");
+        printf(" %lu acquires, %lu reused, %lu driver allocations"
+               " (%lu arenas, %lu sub-buffers, %lu dedicated)\n",
+               (unsigned long)pooled.acquires, (unsigned long)pooled.reuses,
+               (unsigned long)pooled.driverAllocations(), (unsigned long)pooled.arenas,
+               (unsigned long)pooled.subBuffers, (unsigned long)pooled.dedicated);
+        printf(" %.1f MB reserved, %.1f MB peak in use\n",
+               pooled.arenaBytes / 1048576.0, pooled.peakBytesInUse / 1048576.0);
 
-        } // end for loop
+        bench.write();
     }
     catch (cl::BuildError error)
     {
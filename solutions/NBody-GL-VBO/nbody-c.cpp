@@ -606,7 +606,8 @@ void parseArguments(int argc, char *argv[])
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], &deviceIndex))
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_COMPUTE) ||
+          deviceIndex == DEVICE_ALL)
       {
         printf("Invalid device index\n");
         exit(1);
@@ -683,7 +684,7 @@ void parseArguments(int argc, char *argv[])
       printf("Options:\n");
       printf("  -h  --help               Print the message\n");
       printf("      --list               List available devices\n");
-      printf("      --device     INDEX   Select device at INDEX\n");
+      printf("      --device     INDEX   Select device at INDEX, or 'auto'\n");
       printf("  -n  --numbodies  N       Run simulation with N bodies\n");
       printf("  -d  --delta      DELTA   Time difference between iterations\n");
       printf("  -s  --softening  SOFT    Force softening factor\n");
@@ -49,6 +49,7 @@
 #include "util.hpp"
 #include "err_code.h"
 #include "device_picker.hpp"
+#include "bench.hpp"
 
 #define GLM_FORCE_RADIANS
 #include "glm/glm.hpp"
@@ -94,7 +95,6 @@ int main(int argc, char *argv[])
   try
   {
     util::Timer timer;
-    uint64_t startTime, endTime;
 
     parseArguments(argc, argv);
 
@@ -257,12 +257,21 @@ int main(int argc, char *argv[])
     unsigned INDEX_IN  = 0;
     unsigned INDEX_OUT = 1;
     std::cout << "Running simulation..." << std::endl;
-    startTime = timer.getTimeMicroseconds();
+    util::Benchmark bench("nbody_gl_vbo", device);
+    bench.param("bodies", numBodies);
+    bench.param("wgsize", wgsize);
+    bench.param("local", useLocal);
+
+    // The simulation runs until the window is closed, so each frame is a
+    // sample rather than timing the whole run repeatedly
+    std::vector<double> frameTimes;
     cl::NDRange global(numBodies);
     cl::NDRange local(wgsize);
     size_t i;
     for (i = 0; ; i++)
     {
+      uint64_t frameStart = timer.getTimeNanoseconds();
+
       // ***********************
       // Acquire buffers from GL
       // ***********************
@@ -307,6 +316,7 @@ int main(int argc, char *argv[])
 
       // Update window
       SDL_GL_SwapWindow(window);
+      frameTimes.push_back((timer.getTimeNanoseconds() - frameStart) * 1e-6);
 
       // Check for user input
       if (handleSDLEvents())
@@ -320,12 +330,16 @@ int main(int argc, char *argv[])
       INDEX_OUT = temp;
     }
 
-    endTime = timer.getTimeMicroseconds();
-    std::cout << "OpenCL took " << ((endTime-startTime)*1e-3) << "ms"
+    const util::BenchResult& result = bench.record("frame", frameTimes, 1, "frames/s");
+    double totalTime = 0;
+    for (size_t f = 0; f < frameTimes.size(); f++)
+      totalTime += frameTimes[f];
+    std::cout << "OpenCL took " << totalTime << "ms"
               << std::endl << std::endl;
 
-    std::cout << "Average FPS was " << (i / ((endTime-startTime)*1e-6))
+    std::cout << "Median FPS was " << result.rate
               << std::endl << std::endl;
+    bench.write();
 
     releaseGraphics();
   }
@@ -557,7 +571,8 @@ void parseArguments(int argc, char *argv[])
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], &deviceIndex))
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_COMPUTE) ||
+          deviceIndex == DEVICE_ALL)
       {
         std::cout << "Invalid device index" << std::endl;
         exit(1);
@@ -614,7 +629,7 @@ void parseArguments(int argc, char *argv[])
       std::cout << "Options:" << std::endl;
       std::cout << "  -h  --help               Print the message" << std::endl;
       std::cout << "      --list               List available devices" << std::endl;
-      std::cout << "      --device     INDEX   Select device at INDEX" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
       std::cout << "  -n  --numbodies  N       Run simulation with N bodies" << std::endl;
       std::cout << "  -d  --delta      DELTA   Time difference between iterations" << std::endl;
       std::cout << "  -s  --softening  SOFT    Force softening factor" << std::endl;
@@ -44,6 +44,7 @@
 #include "util.hpp"
 #include "err_code.h"
 #include "device_picker.hpp"
+#include "bench.hpp"
 
 #ifndef M_PI
   #define M_PI 3.14159265358979323846f
@@ -85,7 +86,6 @@ int main(int argc, char *argv[])
   try
   {
     util::Timer timer;
-    uint64_t startTime, endTime;
 
     parseArguments(argc, argv);
 
@@ -225,13 +225,22 @@ int main(int argc, char *argv[])
 
     // Run simulation
     std::cout << "Running simulation..." << std::endl;
-    startTime = timer.getTimeMicroseconds();
+    util::Benchmark bench("nbody_gl", device);
+    bench.param("bodies", numBodies);
+    bench.param("wgsize", wgsize);
+    bench.param("local", useLocal);
+
+    // The simulation runs until the window is closed, so each frame is a
+    // sample rather than timing the whole run repeatedly
+    std::vector<double> frameTimes;
     cl::NDRange global(numBodies);
     cl::NDRange local(wgsize);
     cl::NDRange textureSize(windowWidth, windowHeight);
     size_t i;
     for (i = 0; ; i++)
     {
+      uint64_t frameStart = timer.getTimeNanoseconds();
+
       nbodyKernel(cl::EnqueueArgs(queue, global, local),
                   d_positionsIn, d_positionsOut, d_velocities,
                   numBodies);
@@ -268,6 +277,7 @@ int main(int argc, char *argv[])
 
       // Update window
       SDL_GL_SwapWindow(window);
+      frameTimes.push_back((timer.getTimeNanoseconds() - frameStart) * 1e-6);
 
       // Check for user input
       if (handleSDLEvents())
@@ -281,12 +291,16 @@ int main(int argc, char *argv[])
       d_positionsOut  = temp;
     }
 
-    endTime = timer.getTimeMicroseconds();
-    std::cout << "OpenCL took " << ((endTime-startTime)*1e-3) << "ms"
+    const util::BenchResult& result = bench.record("frame", frameTimes, 1, "frames/s");
+    double totalTime = 0;
+    for (size_t f = 0; f < frameTimes.size(); f++)
+      totalTime += frameTimes[f];
+    std::cout << "OpenCL took " << totalTime << "ms"
               << std::endl << std::endl;
 
-    std::cout << "Average FPS was " << (i / ((endTime-startTime)*1e-6))
+    std::cout << "Median FPS was " << result.rate
               << std::endl << std::endl;
+    bench.write();
 
     releaseGraphics();
   }
@@ -417,7 +431,8 @@ void parseArguments(int argc, char *argv[])
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], &deviceIndex))
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_COMPUTE) ||
+          deviceIndex == DEVICE_ALL)
       {
         std::cout << "Invalid device index" << std::endl;
         exit(1);
@@ -474,7 +489,7 @@ void parseArguments(int argc, char *argv[])
       std::cout << "Options:" << std::endl;
       std::cout << "  -h  --help               Print the message" << std::endl;
       std::cout << "      --list               List available devices" << std::endl;
-      std::cout << "      --device     INDEX   Select device at INDEX" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
       std::cout << "  -n  --numbodies  N       Run simulation with N bodies" << std::endl;
       std::cout << "  -d  --delta      DELTA   Time difference between iterations" << std::endl;
       std::cout << "  -s  --softening  SOFT    Force softening factor" << std::endl;
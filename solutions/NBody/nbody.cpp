@@ -29,6 +29,9 @@
 #include "util.hpp"
 #include "err_code.h"
 #include "device_picker.hpp"
+#include "program_cache.hpp"
+#include "profiling_queue.hpp"
+#include "bench.hpp"
 
 #ifndef M_PI
   #define M_PI 3.14159265358979323846f
@@ -49,6 +52,7 @@ float    sphereRadius  =    0.8f;
 float    tolerance     =      0.01f;
 unsigned wgsize        =     64;
 bool     useLocal      =     false;
+std::string traceFile;                   // No trace if empty
 
 int main(int argc, char *argv[])
 {
@@ -58,6 +62,8 @@ int main(int argc, char *argv[])
     util::Timer timer;
 
     parseArguments(argc, argv);
+    if (!traceFile.empty())
+      util::TraceRecorder::get().enable();
 
     // Initialize host data
     std::vector<float> h_initialPositions(4*numBodies);
@@ -91,9 +97,7 @@ int main(int argc, char *argv[])
     std::cout << std::endl << "Using OpenCL device: " << name << std::endl;
 
     cl::Context context(device);
-    cl::CommandQueue queue(context);
-
-    cl::Program program(context, util::loadProgram("kernel.cl"));
+    util::ProfilingQueue queue(context, device, "nbody");
 
     std::stringstream options;
     options.setf(std::ios::fixed, std::ios::floatfield);
@@ -103,10 +107,10 @@ int main(int argc, char *argv[])
     options << " -DWGSIZE=" << wgsize;
     if (useLocal)
       options << " -DUSE_LOCAL";
-    program.build(options.str().c_str());
+    cl::Program program = util::buildProgram(context, device, util::loadProgram("kernel.cl"),
+                                             options.str());
 
-    cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl_uint>
-      nbodyKernel(program, "nbody");
+    cl::Kernel nbodyKernel(program, "nbody");
 
     // Initialize device buffers
     cl::Buffer d_positions0, d_positions1, d_velocities;
@@ -120,46 +124,55 @@ int main(int argc, char *argv[])
     d_velocities = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
                               4*numBodies*sizeof(float));
 
-    cl::copy(queue, h_initialPositions.begin(), h_initialPositions.end(),
-             d_positions0);
-    cl::copy(queue, h_initialVelocities.begin(), h_initialVelocities.end(),
-             d_velocities);
-
-    cl::Buffer d_positionsIn  = d_positions0;
-    cl::Buffer d_positionsOut = d_positions1;
-
     std::cout << "OpenCL initialization complete." << std::endl << std::endl;
 
+    util::Benchmark bench("nbody", device);
+    bench.param("bodies", numBodies);
+    bench.param("iterations", iterations);
+    bench.param("wgsize", wgsize);
+    bench.param("local", useLocal);
 
-    // Run simulation
+
+    // Run simulation, from the initial state each time it is timed
     std::cout << "Running simulation..." << std::endl;
-    startTime = timer.getTimeMicroseconds();
+    uint64_t traceStart = util::timerNow();
     cl::NDRange global(numBodies);
     cl::NDRange local(wgsize);
-    for (unsigned i = 0; i < iterations; i++)
+    long interactions = (long)iterations * (long)numBodies * (long)numBodies;
+    // Host time, including the initial writes and the final read
+    const util::BenchResult& result = bench.time("simulation", [&]()
     {
-      nbodyKernel(cl::EnqueueArgs(queue, global, local),
-                  d_positionsIn, d_positionsOut, d_velocities,
-                  numBodies);
-
-      // Swap position buffers
-      cl::Buffer temp = d_positionsIn;
-      d_positionsIn   = d_positionsOut;
-      d_positionsOut  = temp;
-    }
+      queue.enqueueWriteBuffer(d_positions0, CL_TRUE, 0, 4*numBodies*sizeof(float),
+                               &h_initialPositions[0], NULL, NULL, "write positions");
+      queue.enqueueWriteBuffer(d_velocities, CL_TRUE, 0, 4*numBodies*sizeof(float),
+                               &h_initialVelocities[0], NULL, NULL, "write velocities");
+
+      cl::Buffer d_positionsIn  = d_positions0;
+      cl::Buffer d_positionsOut = d_positions1;
+      for (unsigned i = 0; i < iterations; i++)
+      {
+        nbodyKernel.setArg(0, d_positionsIn);
+        nbodyKernel.setArg(1, d_positionsOut);
+        nbodyKernel.setArg(2, d_velocities);
+        nbodyKernel.setArg(3, numBodies);
+        queue.enqueueNDRangeKernel(nbodyKernel, cl::NullRange, global, local);
+
+        // Swap position buffers
+        cl::Buffer temp = d_positionsIn;
+        d_positionsIn   = d_positionsOut;
+        d_positionsOut  = temp;
+      }
 
-    // Read final positions
-    cl::copy(queue, d_positionsIn, h_positions.begin(), h_positions.end());
+      // Read final positions
+      queue.enqueueReadBuffer(d_positionsIn, CL_TRUE, 0, 4*numBodies*sizeof(float),
+                              &h_positions[0], NULL, NULL, "read positions");
+    }, interactions * 1e-9, "billion interactions/s");
+    util::TraceRecorder::get().addHost("simulation", traceStart, util::timerNow());
 
-    endTime = timer.getTimeMicroseconds();
-    uint64_t microseconds = (endTime-startTime);
     std::cout << std::setprecision(2) << std::fixed;
-    std::cout << "OpenCL took " << (microseconds*1e-3) << "ms"
+    std::cout << "OpenCL took " << result.median << "ms"
               << std::endl;
-
-    long interactions = (long)iterations * (long)numBodies * (long)numBodies;
-    double giPerSec = interactions/(double)(microseconds*1e-6) * 1e-9;
-    std::cout << giPerSec
+    std::cout << result.rate
               << " billion interactions/second" << std::endl;
 
     std::cout << std::endl;
@@ -169,7 +182,10 @@ int main(int argc, char *argv[])
     std::cout << "Running reference..." << std::endl;
     startTime = timer.getTimeMicroseconds();
     std::vector<float> h_reference(4*numBodies);
-    runReference(h_initialPositions, h_initialVelocities, h_reference);
+    {
+      util::TraceScope scope("reference");
+      runReference(h_initialPositions, h_initialVelocities, h_reference);
+    }
     endTime = timer.getTimeMicroseconds();
     std::cout << "Reference took " << ((endTime-startTime)*1e-3) << "ms"
               << std::endl << std::endl;
@@ -215,6 +231,15 @@ int main(int argc, char *argv[])
       std::cout << "Verification passed." << std::endl;
     }
     std::cout << std::endl;
+    bench.write();
+
+    if (!traceFile.empty())
+    {
+      if (util::writeChromeTrace(traceFile))
+        std::cout << "Wrote trace to " << traceFile << std::endl << std::endl;
+      else
+        std::cout << "Cannot write trace to " << traceFile << std::endl << std::endl;
+    }
   }
   catch (cl::BuildError error)
   {
@@ -275,7 +300,8 @@ void parseArguments(int argc, char *argv[])
     }
     else if (!strcmp(argv[i], "--device"))
     {
-      if (++i >= argc || !parseUInt(argv[i], &deviceIndex))
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_COMPUTE) ||
+          deviceIndex == DEVICE_ALL)
       {
         std::cout << "Invalid device index" << std::endl;
         exit(1);
@@ -325,6 +351,15 @@ void parseArguments(int argc, char *argv[])
     {
       useLocal = true;
     }
+    else if (!strcmp(argv[i], "--trace"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid trace file" << std::endl;
+        exit(1);
+      }
+      traceFile = argv[i];
+    }
     else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
     {
       std::cout << std::endl;
@@ -332,13 +367,14 @@ void parseArguments(int argc, char *argv[])
       std::cout << "Options:" << std::endl;
       std::cout << "  -h  --help               Print the message" << std::endl;
       std::cout << "      --list               List available devices" << std::endl;
-      std::cout << "      --device     INDEX   Select device at INDEX" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
       std::cout << "  -n  --numbodies  N       Run simulation with N bodies" << std::endl;
       std::cout << "  -d  --delta      DELTA   Time difference between iterations" << std::endl;
       std::cout << "  -s  --softening  SOFT    Force softening factor" << std::endl;
       std::cout << "  -i  --iterations ITRS    Run simulation for ITRS iterations" << std::endl;
       std::cout << "      --local              Enable use of local memory" << std::endl;
       std::cout << "      --wgsize     WGSIZE  Set work-group size to WGSIZE" << std::endl;
+      std::cout << "      --trace      FILE    Write a Chrome trace of the run" << std::endl;
       std::cout << std::endl;
       exit(0);
     }
@@ -362,8 +398,10 @@ void runReference(const std::vector<float>& initialPositions,
   std::vector<float>& positionsIn = positions0;
   std::vector<float>& positionsOut = positions1;
 
+  static const int region = util::timerRegion("reference step");
   for (unsigned itr = 0; itr < iterations; itr++)
   {
+    util::ScopedTimer timer(region);
     for (unsigned i = 0; i < numBodies; i++)
     {
       float ix = positionsIn[i*4 + 0];
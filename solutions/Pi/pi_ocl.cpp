@@ -27,6 +27,8 @@
 
 #include <device_picker.hpp>
 #include <util.hpp>
+#include <program_cache.hpp>
+#include <bench.hpp>
 
 #define INSTEPS (512*512*512)
 #define ITERS (262144)
@@ -70,7 +72,7 @@ int main(int argc, char *argv[])
         cl::CommandQueue queue(context, device);
 
         // Create the program object
-        cl::Program program(context, util::loadProgram("pi_ocl.cl"), true);
+        cl::Program program = util::buildProgram(context, device, util::loadProgram("pi_ocl.cl"));
 
         cl::KernelFunctor<int, float, cl::LocalSpaceArg, cl::Buffer> pi(program, "pi");
 
@@ -102,33 +104,38 @@ int main(int argc, char *argv[])
 
         d_partial_sums = cl::Buffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * nwork_groups);
 
-        util::Timer timer;
-
-        // Execute the kernel over the entire range of our 1d input data set
-        // using the maximum number of work group items for this device
-        pi(
-            cl::EnqueueArgs(
-                    queue,
-                    cl::NDRange(nsteps / niters),
-                    cl::NDRange(work_group_size)),
-                    niters,
-                    step_size,
-                    cl::Local(sizeof(float) * work_group_size),
-                    d_partial_sums);
-
-        cl::copy(queue, d_partial_sums, h_psum.begin(), h_psum.end());
-
-        // complete the sum and compute final integral value
-        pi_res = 0.0f;
-        for (unsigned int i = 0; i< nwork_groups; i++) {
-                pi_res += h_psum[i];
-        }
-        pi_res = pi_res * step_size;
+        util::Benchmark bench("pi", device);
+        bench.param("steps", nsteps);
+        bench.param("work_group_size", work_group_size);
 
-        //rtime = wtime() - rtime;
-        double rtime = static_cast<double>(timer.getTimeMilliseconds()) / 1000.;
+        const util::BenchResult& result = bench.time("pi", [&]
+        {
+            // Execute the kernel over the entire range of our 1d input data set
+            // using the maximum number of work group items for this device
+            pi(
+                cl::EnqueueArgs(
+                        queue,
+                        cl::NDRange(nsteps / niters),
+                        cl::NDRange(work_group_size)),
+                        niters,
+                        step_size,
+                        cl::Local(sizeof(float) * work_group_size),
+                        d_partial_sums);
+
+            cl::copy(queue, d_partial_sums, h_psum.begin(), h_psum.end());
+
+            // complete the sum and compute final integral value
+            pi_res = 0.0f;
+            for (unsigned int i = 0; i< nwork_groups; i++) {
+                    pi_res += h_psum[i];
+            }
+            pi_res = pi_res * step_size;
+        });
+
+        double rtime = result.median / 1000.;
         printf("\nThe calculation ran in %lf seconds\n", rtime);
         printf(" pi = %f for %d steps\n", pi_res, nsteps);
+        bench.write();
 
     }
     catch (cl::BuildError error)
@@ -0,0 +1,375 @@
+//
+// OpenCL ahead-of-time program compilation
+//
+// Builds every program listed in programs.txt for the selected devices and
+// writes the binaries, with a manifest, to a directory the solutions load
+// them from at startup (see program_cache.hpp). `make precompile` in the
+// solutions directory runs this for every device.
+//
+// With --bench, the startup cost of each solution's programs is timed both
+// ways: compiled from source, and created from the precompiled binary.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <device_picker.hpp>
+#include <program_cache.hpp>
+#include <util.hpp>
+
+void parseArguments(int argc, char *argv[]);
+
+// Parameters, with default values.
+std::vector<unsigned> deviceIndices;   // All devices if empty
+std::string programsFile  = "programs.txt";
+std::string sourceDir     = "..";
+std::string outputDir     = "../precompiled";
+bool        bench         = false;
+unsigned    repeats       = 3;         // Builds timed per program with --bench
+
+struct ProgramEntry
+{
+  std::string file;
+  std::string options;
+};
+
+std::vector<ProgramEntry> readPrograms(const std::string& path)
+{
+  std::ifstream in(path.c_str());
+  if (!in.is_open())
+  {
+    std::cout << "Cannot open file: " << path << std::endl;
+    exit(1);
+  }
+
+  std::vector<ProgramEntry> programs;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#')
+      continue;
+    line = line.substr(start, line.find_last_not_of(" \t\r") + 1 - start);
+
+    ProgramEntry entry;
+    size_t space = line.find_first_of(" \t");
+    entry.file    = line.substr(0, space);
+    entry.options = space == std::string::npos ? "" : line.substr(space + 1);
+    programs.push_back(entry);
+  }
+  return programs;
+}
+
+// Solution a program belongs to, from its path
+std::string solutionName(const std::string& file)
+{
+  return file.substr(0, file.find('/'));
+}
+
+double elapsedMs(util::Timer& timer, uint64_t start)
+{
+  return (timer.getTimeNanoseconds() - start) * 1e-6;
+}
+
+// Best time to build from source and from the binary, in milliseconds
+void benchProgram(const cl::Context& context, const cl::Device& device,
+                  const std::string& source, const std::string& options,
+                  const std::vector<unsigned char>& binary,
+                  double& sourceMs, double& binaryMs)
+{
+  util::Timer timer;
+  sourceMs = binaryMs = 1e30;
+  for (unsigned r = 0; r < repeats; r++)
+  {
+    uint64_t start = timer.getTimeNanoseconds();
+    cl::Program fromSource(context, source);
+    fromSource.build(std::vector<cl::Device>(1, device), options.c_str());
+    sourceMs = std::min(sourceMs, elapsedMs(timer, start));
+
+    start = timer.getTimeNanoseconds();
+    cl::Program fromBinary;
+    if (!util::buildProgramFromBinary(context, device, binary, options, fromBinary))
+    {
+      binaryMs = 0;
+      return;
+    }
+    binaryMs = std::min(binaryMs, elapsedMs(timer, start));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parseArguments(argc, argv);
+
+    std::vector<ProgramEntry> programs = readPrograms(programsFile);
+
+    // Get list of devices
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+
+    if (std::find(deviceIndices.begin(), deviceIndices.end(), DEVICE_ALL) !=
+        deviceIndices.end())
+      deviceIndices.clear();
+    if (deviceIndices.empty())
+    {
+      for (unsigned d = 0; d < devices.size(); d++)
+        deviceIndices.push_back(d);
+    }
+
+    // Check device indices in range
+    for (unsigned i = 0; i < deviceIndices.size(); i++)
+    {
+      if (deviceIndices[i] >= devices.size())
+      {
+        std::cout << "Invalid device index (try '--list')" << std::endl;
+        return 1;
+      }
+    }
+
+    if (!util::makeDirectory(outputDir))
+    {
+      std::cout << "Cannot create directory: " << outputDir << std::endl;
+      return 1;
+    }
+
+    // Add to an existing manifest, so devices can be precompiled separately
+    std::string manifestPath = util::precompiledPath(outputDir, "manifest.txt");
+    std::map<std::string, std::string> manifest;
+    util::readCacheEntries(manifestPath, manifest);
+
+    unsigned failures = 0;
+    for (unsigned i = 0; i < deviceIndices.size(); i++)
+    {
+      cl::Device device = devices[deviceIndices[i]];
+      cl::Context context(device);
+      std::cout << std::endl << "Device: " << getDeviceName(device) << std::endl;
+
+      std::cout << std::fixed << std::setprecision(1);
+      if (bench)
+        std::cout << "Program                          Source (ms)  Binary (ms)  Speedup"
+                  << std::endl;
+      else
+        std::cout << "Program                          Build (ms)    Size (KB)"
+                  << std::endl;
+      std::cout << std::string(68, '-') << std::endl;
+
+      std::map<std::string, double> solutionSource, solutionBinary;
+      for (size_t p = 0; p < programs.size(); p++)
+      {
+        const ProgramEntry& entry = programs[p];
+        std::string label = entry.file + (entry.options.find("USE_LOCAL") !=
+                                          std::string::npos ? " (local)" : "");
+        std::cout << std::left << std::setw(33) << label << std::right;
+
+        std::string source = util::loadProgram(sourceDir + "/" + entry.file);
+        util::Timer timer;
+        uint64_t start = timer.getTimeNanoseconds();
+        cl::Program program(context, source);
+        try
+        {
+          program.build(std::vector<cl::Device>(1, device), entry.options.c_str());
+        }
+        catch (cl::BuildError& error)
+        {
+          std::cout << "build failed" << std::endl
+                    << error.getBuildLog()[0].second << std::endl;
+          failures++;
+          continue;
+        }
+        double buildMs = elapsedMs(timer, start);
+
+        std::vector<unsigned char> binary = util::programBinary(program);
+        std::string key  = util::programCacheKey(device, source, entry.options);
+        std::string file = key + ".bin";
+        if (!util::writeBinaryFile(util::precompiledPath(outputDir, file), binary))
+        {
+          std::cout << "cannot write " << file << std::endl;
+          failures++;
+          continue;
+        }
+        manifest[key] = file + " " + entry.file +
+                        (entry.options.empty() ? "" : " " + entry.options);
+
+        if (!bench)
+        {
+          std::cout << std::setw(11) << buildMs
+                    << std::setw(13) << binary.size() / 1024.0 << std::endl;
+          continue;
+        }
+
+        double sourceMs, binaryMs;
+        benchProgram(context, device, source, entry.options, binary, sourceMs, binaryMs);
+        if (binaryMs == 0)
+        {
+          std::cout << std::setw(12) << sourceMs << "  binary rejected" << std::endl;
+          failures++;
+          continue;
+        }
+        std::cout << std::setw(12) << sourceMs
+                  << std::setw(13) << binaryMs
+                  << std::setw(8) << sourceMs / binaryMs << "x" << std::endl;
+        solutionSource[solutionName(entry.file)] += sourceMs;
+        solutionBinary[solutionName(entry.file)] += binaryMs;
+      }
+
+      // Startup cost of each solution's programs, as the solution sees it
+      if (bench)
+      {
+        std::cout << std::endl << "Startup by solution" << std::endl;
+        std::map<std::string, double>::iterator it;
+        for (it = solutionSource.begin(); it != solutionSource.end(); ++it)
+        {
+          std::cout << "  " << std::left << std::setw(31) << it->first << std::right
+                    << std::setw(12) << it->second
+                    << std::setw(13) << solutionBinary[it->first]
+                    << std::setw(8) << it->second / solutionBinary[it->first] << "x"
+                    << std::endl;
+        }
+      }
+    }
+
+    if (!util::writeCacheEntries(manifestPath, manifest))
+    {
+      std::cout << "Cannot write " << manifestPath << std::endl;
+      return 1;
+    }
+    std::cout << std::endl << "Wrote " << manifest.size() << " binaries to "
+              << outputDir << std::endl;
+    if (failures)
+    {
+      std::cout << failures << " programs could not be precompiled" << std::endl;
+      return 1;
+    }
+  }
+  catch (cl::Error err)
+  {
+    std::cout << "Exception:" << std::endl
+              << "ERROR: "
+              << err.what()
+              << "("
+              << err_code(err.err())
+              << ")"
+              << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--list"))
+    {
+      // Get list of devices
+      std::vector<cl::Device> devices;
+      getDeviceList(devices);
+
+      // Print device names
+      if (devices.size() == 0)
+      {
+        std::cout << "No devices found." << std::endl;
+      }
+      else
+      {
+        std::cout << std::endl;
+        std::cout << "Devices:" << std::endl;
+        for (unsigned i = 0; i < devices.size(); i++)
+        {
+          std::cout << i << ": " << getDeviceName(devices[i]) << std::endl;
+        }
+        std::cout << std::endl;
+      }
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      cl_uint index;
+      if (++i >= argc || !parseDeviceIndex(argv[i], &index))
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+      deviceIndices.push_back(index);
+    }
+    else if (!strcmp(argv[i], "--programs"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid programs file" << std::endl;
+        exit(1);
+      }
+      programsFile = argv[i];
+    }
+    else if (!strcmp(argv[i], "--sources"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid sources directory" << std::endl;
+        exit(1);
+      }
+      sourceDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--output") || !strcmp(argv[i], "-o"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid output directory" << std::endl;
+        exit(1);
+      }
+      outputDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--bench"))
+    {
+      bench = true;
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./precompile [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --list               List available devices" << std::endl;
+      std::cout << "      --device     INDEX   Precompile for device at INDEX, 'auto'"
+                   " or 'all' (repeatable, default all)" << std::endl;
+      std::cout << "      --programs   FILE    List of programs to build" << std::endl;
+      std::cout << "      --sources    DIR     Directory holding the solutions" << std::endl;
+      std::cout << "  -o  --output     DIR     Directory for binaries and manifest" << std::endl;
+      std::cout << "      --bench              Compare startup from source and binary" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}
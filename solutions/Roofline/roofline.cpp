@@ -0,0 +1,838 @@
+//
+// OpenCL roofline report
+//
+// Runs the kernels from the other solutions (MatMul, NBody, Bilateral and
+// Pi) with the build options those programs use, and places each variant
+// on a roofline built from the device profile measured by DeviceInfo (see
+// device_probe.hpp; the device is probed here if it has no profile yet).
+//
+// FLOP counts are declared per kernel as the operations written in the
+// source. Two byte counts are given for each kernel:
+//
+//   compulsory   every input read once and every output written once
+//   requested    every global load and store the kernel issues, as if
+//                nothing were cached
+//
+// The kernel is placed at its compulsory intensity, which is what bounds
+// the algorithm; the requested intensity shows how far caching has to
+// close the gap. Results are not checked here, the exercises do that.
+//
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <device_picker.hpp>
+#include <device_probe.hpp>
+#include <util.hpp>
+
+void parseArguments(int argc, char *argv[]);
+
+// Parameters, with default values.
+unsigned    deviceIndex   =      0;
+unsigned    iterations    =      5;    // Timed runs of each kernel; the best is kept
+unsigned    order         =   1024;    // MatMul, as ORDER in matmul.hpp
+unsigned    blockSize     =      8;    // MatMul, as BLOCKSIZE in the MatMul Makefile
+unsigned    numBodies     =   4096;    // NBody
+unsigned    wgsize        =     64;    // NBody
+unsigned    width         =   1024;    // Bilateral
+unsigned    height        =   1024;    // Bilateral
+unsigned    radius        =      2;    // Bilateral
+std::string sourceDir     =    "..";
+std::string csvFile;
+std::string svgFile;
+
+struct Result
+{
+  std::string name;
+  double      flops;
+  double      bytesCompulsory;
+  double      bytesRequested;
+  double      seconds;
+  std::string error;           // Empty if the kernel ran
+
+  double gflops() const { return flops / seconds * 1e-9; }
+  double intensity() const { return flops / bytesCompulsory; }
+  double requestedIntensity() const { return flops / bytesRequested; }
+};
+
+struct Roof
+{
+  double peakGflops;
+  double bandwidthGBs;
+
+  double ridge() const { return peakGflops / bandwidthGBs; }
+  double at(double intensity) const
+  {
+    return std::min(peakGflops, intensity * bandwidthGBs);
+  }
+};
+
+cl::Program buildProgram(const cl::Context& context, const cl::Device& device,
+                         const std::string& file, const std::string& options)
+{
+  cl::Program program(context, util::loadProgram(sourceDir + "/" + file));
+  try
+  {
+    program.build(std::vector<cl::Device>(1, device), options.c_str());
+  }
+  catch (cl::BuildError& error)
+  {
+    std::cerr << std::endl << "Build of " << file << " failed:" << std::endl
+              << error.getBuildLog()[0].second << std::endl;
+    throw;
+  }
+  return program;
+}
+
+// Best of a number of timed runs after a warm-up, in seconds
+double timeKernel(cl::CommandQueue& queue, cl::Kernel& kernel,
+                  const cl::NDRange& global, const cl::NDRange& local)
+{
+  double best = 1e30;
+  for (unsigned i = 0; i <= iterations; i++)
+  {
+    cl::Event event;
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local, NULL, &event);
+    event.wait();
+    double t = (event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-9;
+    if (i > 0)
+      best = std::min(best, t);
+  }
+  return best;
+}
+
+// Run one variant, recording a failure instead of stopping the report
+template <typename F>
+void runVariant(std::vector<Result>& results, Result result, F run)
+{
+  try
+  {
+    result.seconds = run();
+  }
+  catch (cl::Error& err)
+  {
+    std::ostringstream error;
+    error << err.what() << " (" << err_code(err.err()) << ")";
+    result.error = error.str();
+  }
+  results.push_back(result);
+}
+
+void runMatMul(const cl::Context& context, const cl::Device& device,
+               cl::CommandQueue& queue, std::vector<Result>& results)
+{
+  double N = order;
+  size_t bytes = sizeof(float) * order * order;
+  std::vector<float> h_A(order*order, 3.0f), h_B(order*order, 5.0f);
+  cl::Buffer d_a(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &h_A[0]);
+  cl::Buffer d_b(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &h_B[0]);
+  cl::Buffer d_c(context, CL_MEM_WRITE_ONLY, bytes);
+
+  // One multiply-add per inner product term
+  Result r;
+  r.flops           = 2*N*N*N;
+  r.bytesCompulsory = 4 * 3*N*N;
+  r.seconds         = 0;
+
+  // Work-group size matmul.cpp uses for the row kernels
+  size_t rowLocal  = order / 16;
+  double rowGroups = N / rowLocal;
+
+  r.name           = "matmul C_elem";
+  r.bytesRequested = 4 * (2*N*N*N + N*N);
+  runVariant(results, r, [&]() {
+    cl::Program program = buildProgram(context, device, "MatMul/C_elem.cl", "");
+    cl::Kernel kernel(program, "mmul");
+    kernel.setArg(0, (cl_int)order);
+    kernel.setArg(1, d_a); kernel.setArg(2, d_b); kernel.setArg(3, d_c);
+    return timeKernel(queue, kernel, cl::NDRange(order, order), cl::NullRange);
+  });
+
+  r.name           = "matmul C_row";
+  r.bytesRequested = 4 * (2*N*N*N + N*N);
+  runVariant(results, r, [&]() {
+    cl::Program program = buildProgram(context, device, "MatMul/C_row.cl", "");
+    cl::Kernel kernel(program, "mmul");
+    kernel.setArg(0, (cl_int)order);
+    kernel.setArg(1, d_a); kernel.setArg(2, d_b); kernel.setArg(3, d_c);
+    return timeKernel(queue, kernel, cl::NDRange(order), cl::NullRange);
+  });
+
+  // A row read once into private memory
+  r.name           = "matmul C_row_priv";
+  r.bytesRequested = 4 * (N*N + N*N*N + N*N);
+  runVariant(results, r, [&]() {
+    cl::Program program = buildProgram(context, device, "MatMul/C_row_priv.cl", "");
+    cl::Kernel kernel(program, "mmul");
+    kernel.setArg(0, (cl_int)order);
+    kernel.setArg(1, d_a); kernel.setArg(2, d_b); kernel.setArg(3, d_c);
+    return timeKernel(queue, kernel, cl::NDRange(order), cl::NDRange(rowLocal));
+  });
+
+  // B read once per work-group into local memory
+  r.name           = "matmul C_row_priv_bloc";
+  r.bytesRequested = 4 * (N*N + rowGroups*N*N + N*N);
+  runVariant(results, r, [&]() {
+    cl::Program program = buildProgram(context, device, "MatMul/C_row_priv_bloc.cl", "");
+    cl::Kernel kernel(program, "mmul");
+    kernel.setArg(0, (cl_int)order);
+    kernel.setArg(1, d_a); kernel.setArg(2, d_b); kernel.setArg(3, d_c);
+    kernel.setArg(4, cl::Local(sizeof(float) * order));
+    return timeKernel(queue, kernel, cl::NDRange(order), cl::NDRange(rowLocal));
+  });
+
+  // Each block of A and B read once per block of C that uses it
+  std::ostringstream name;
+  name << "matmul C_block_form " << blockSize << "x" << blockSize;
+  r.name           = name.str();
+  r.bytesRequested = 4 * (2*N*N*N/blockSize + N*N);
+  runVariant(results, r, [&]() {
+    std::ostringstream options;
+    options << "-DBLKSZ=" << blockSize;
+    cl::Program program = buildProgram(context, device, "MatMul/C_block_form.cl",
+                                       options.str());
+    cl::Kernel kernel(program, "mmul");
+    kernel.setArg(0, (cl_int)order);
+    kernel.setArg(1, d_a); kernel.setArg(2, d_b); kernel.setArg(3, d_c);
+    kernel.setArg(4, cl::Local(sizeof(float) * blockSize*blockSize));
+    kernel.setArg(5, cl::Local(sizeof(float) * blockSize*blockSize));
+    return timeKernel(queue, kernel, cl::NDRange(order, order),
+                      cl::NDRange(blockSize, blockSize));
+  });
+}
+
+void runNBody(const cl::Context& context, const cl::Device& device,
+              cl::CommandQueue& queue, std::vector<Result>& results)
+{
+  double N = numBodies;
+  size_t bytes = 4 * sizeof(float) * numBodies;
+
+  // Bodies on the surface of a sphere, as in nbody.cpp
+  std::vector<float> h_positions(4*numBodies);
+  for (unsigned i = 0; i < numBodies; i++)
+  {
+    float longitude      = 2.f * 3.14159265f * (rand() / (float)RAND_MAX);
+    float latitude       = acos((2.f * (rand() / (float)RAND_MAX)) - 1);
+    h_positions[i*4 + 0] = 0.8f * sin(latitude) * cos(longitude);
+    h_positions[i*4 + 1] = 0.8f * sin(latitude) * sin(longitude);
+    h_positions[i*4 + 2] = 0.8f * cos(latitude);
+    h_positions[i*4 + 3] = 1;
+  }
+  cl::Buffer d_positionsIn(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                           bytes, &h_positions[0]);
+  cl::Buffer d_positionsOut(context, CL_MEM_READ_WRITE, bytes);
+  cl::Buffer d_velocities(context, CL_MEM_READ_WRITE, bytes);
+  queue.enqueueFillBuffer(d_velocities, 0.0f, 0, bytes);
+
+  // 20 FLOPs per interaction, the usual convention for this force
+  // calculation (counting the reciprocal square root as one)
+  Result r;
+  r.flops           = 20*N*N;
+  r.bytesCompulsory = 16 * 4*N;   // positions in and out, velocities in and out
+  r.seconds         = 0;
+
+  for (int useLocal = 0; useLocal < 2; useLocal++)
+  {
+    r.name           = useLocal ? "nbody local" : "nbody global";
+    r.bytesRequested = useLocal ? 16 * (N/wgsize*N + 3*N) : 16 * (N*N + 3*N);
+    runVariant(results, r, [&]() {
+      std::ostringstream options;
+      options.setf(std::ios::fixed, std::ios::floatfield);
+      options << " -cl-fast-relaxed-math";
+      options << " -Dsoftening=" << 0.05f << "f";
+      options << " -Ddelta=" << 0.0002f << "f";
+      options << " -DWGSIZE=" << wgsize;
+      if (useLocal)
+        options << " -DUSE_LOCAL";
+      cl::Program program = buildProgram(context, device, "NBody/kernel.cl",
+                                         options.str());
+      cl::Kernel kernel(program, "nbody");
+      kernel.setArg(0, d_positionsIn);
+      kernel.setArg(1, d_positionsOut);
+      kernel.setArg(2, d_velocities);
+      kernel.setArg(3, (cl_uint)numBodies);
+      return timeKernel(queue, kernel, cl::NDRange(numBodies), cl::NDRange(wgsize));
+    });
+  }
+}
+
+void runBilateral(const cl::Context& context, const cl::Device& device,
+                  cl::CommandQueue& queue, std::vector<Result>& results)
+{
+  double pixels = (double)width * height;
+  double taps   = (2.0*radius + 1) * (2.0*radius + 1);
+  size_t bytes  = 4 * width * height;
+
+  std::vector<cl_uchar> h_image(bytes);
+  for (size_t i = 0; i < bytes; i++)
+    h_image[i] = rand() & 0xFF;
+
+  std::ostringstream options;
+  options.setf(std::ios::fixed);
+  options << " -cl-fast-relaxed-math";
+  options << " -cl-single-precision-constant";
+  options << " -DRADIUS=" << radius;
+  options << " -DSIGMA_DOMAIN=" << 3.f;
+  options << " -DSIGMA_RANGE=" << 0.2f;
+
+  // 33 FLOPs per tap as written: the scale to [0,1], the domain and range
+  // weights (sqrt and exp counted as one each) and the weighted sums
+  Result r;
+  r.flops           = 33 * taps * pixels;
+  r.bytesCompulsory = 8 * pixels;
+  r.bytesRequested  = 4 * (taps + 1) * pixels;
+  r.seconds         = 0;
+
+  cl::Buffer d_input(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, &h_image[0]);
+  cl::Buffer d_output(context, CL_MEM_WRITE_ONLY, bytes);
+
+  // Rows and columns swapped in the work-item index
+  r.name = "bilateral meta";
+  runVariant(results, r, [&]() {
+    cl::Program program = buildProgram(context, device, "Bilateral/bilateral_meta.cl",
+                                       options.str());
+    cl::Kernel kernel(program, "bilateral");
+    kernel.setArg(0, d_input);
+    kernel.setArg(1, d_output);
+    return timeKernel(queue, kernel, cl::NDRange(height, width), cl::NullRange);
+  });
+
+  r.name = "bilateral opt";
+  runVariant(results, r, [&]() {
+    cl::Program program = buildProgram(context, device, "Bilateral/bilateral_opt.cl",
+                                       options.str());
+    cl::Kernel kernel(program, "bilateral");
+    kernel.setArg(0, d_input);
+    kernel.setArg(1, d_output);
+    return timeKernel(queue, kernel, cl::NDRange(width, height), cl::NullRange);
+  });
+
+  r.name = "bilateral images";
+  if (!device.getInfo<CL_DEVICE_IMAGE_SUPPORT>())
+  {
+    r.error = "device does not support images";
+    results.push_back(r);
+    return;
+  }
+  runVariant(results, r, [&]() {
+    cl::ImageFormat format(CL_RGBA, CL_UNORM_INT8);
+    cl::Image2D input(context, CL_MEM_READ_ONLY, format, width, height);
+    cl::Image2D output(context, CL_MEM_WRITE_ONLY, format, width, height);
+    cl::array<cl::size_type, 3> origin = {0, 0, 0};
+    cl::array<cl::size_type, 3> region = {width, height, 1};
+    queue.enqueueWriteImage(input, CL_TRUE, origin, region, 0, 0, &h_image[0]);
+
+    cl::Program program = buildProgram(context, device, "Bilateral/bilateral_images.cl",
+                                       options.str());
+    cl::Kernel kernel(program, "bilateral");
+    kernel.setArg(0, input);
+    kernel.setArg(1, output);
+    return timeKernel(queue, kernel, cl::NDRange(width, height), cl::NullRange);
+  });
+}
+
+void runPi(const cl::Context& context, const cl::Device& device,
+           cl::CommandQueue& queue, std::vector<Result>& results)
+{
+  Result r;
+  r.name    = "pi";
+  r.seconds = 0;
+
+  // Not runVariant, as the counts depend on the work-group size the
+  // kernel is built with
+  try
+  {
+    cl::Program program = buildProgram(context, device, "Pi/pi_ocl.cl", "");
+    cl::Kernel kernel(program, "pi");
+
+    // Decomposition from pi_ocl.cpp
+    const int in_nsteps = 512*512*512;
+    const int niters    = 262144;
+    size_t work_group_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    size_t nwork_groups    = in_nsteps / (work_group_size*niters);
+    if (nwork_groups < 1)
+    {
+      nwork_groups    = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+      work_group_size = in_nsteps / (nwork_groups*niters);
+    }
+    size_t nsteps = work_group_size * niters * nwork_groups;
+
+    // Per step: the midpoint (add, multiply), 4/(1+x*x) (multiply, add,
+    // divide) and the accumulation
+    r.flops           = 6.0 * nsteps;
+    r.bytesCompulsory = 4.0 * nwork_groups;
+    r.bytesRequested  = 4.0 * nwork_groups;
+
+    cl::Buffer d_partial_sums(context, CL_MEM_WRITE_ONLY, sizeof(float) * nwork_groups);
+    kernel.setArg(0, niters);
+    kernel.setArg(1, 1.0f / (float)nsteps);
+    kernel.setArg(2, cl::Local(sizeof(float) * work_group_size));
+    kernel.setArg(3, d_partial_sums);
+    r.seconds = timeKernel(queue, kernel, cl::NDRange(nsteps / niters),
+                           cl::NDRange(work_group_size));
+  }
+  catch (cl::Error& err)
+  {
+    std::ostringstream error;
+    error << err.what() << " (" << err_code(err.err()) << ")";
+    r.error = error.str();
+  }
+  results.push_back(r);
+}
+
+void printReport(const std::vector<Result>& results, const Roof& roof)
+{
+  std::cout << std::fixed;
+  std::cout << std::endl
+            << "Kernel                        GFLOP/s   Intensity   Requested"
+               "       GB/s   Roof GFLOP/s   % roof  Bound" << std::endl
+            << "                                       (FLOP/B)    (FLOP/B)"
+               "  requested" << std::endl
+            << std::string(110, '-') << std::endl;
+
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result& r = results[i];
+    std::cout << std::left << std::setw(28) << r.name << std::right;
+    if (!r.error.empty())
+    {
+      std::cout << "  not run: " << r.error << std::endl;
+      continue;
+    }
+    double ai      = r.intensity();
+    double ceiling = roof.at(ai);
+    std::cout << std::setprecision(2)
+              << std::setw(11) << r.gflops()
+              << std::setw(12) << ai
+              << std::setw(12) << r.requestedIntensity()
+              << std::setw(11) << r.bytesRequested / r.seconds * 1e-9
+              << std::setw(15) << ceiling
+              << std::setprecision(1)
+              << std::setw(9) << 100 * r.gflops() / ceiling
+              << "  " << (ai < roof.ridge() ? "memory" : "compute")
+              << std::endl;
+  }
+  std::cout << std::endl
+            << "Requested GB/s above the measured bandwidth means caches are"
+               " serving part of the traffic." << std::endl;
+}
+
+void writeCSV(const std::vector<Result>& results, const Roof& roof,
+              const std::string& path)
+{
+  std::ofstream out(path.c_str());
+  out << "kernel,seconds,flops,bytes_compulsory,bytes_requested,gflops,"
+         "intensity,requested_intensity,roof_gflops,percent_of_roof,bound"
+      << std::endl;
+  out << std::setprecision(6);
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result& r = results[i];
+    if (!r.error.empty())
+      continue;
+    double ceiling = roof.at(r.intensity());
+    out << r.name << "," << r.seconds << "," << r.flops << ","
+        << r.bytesCompulsory << "," << r.bytesRequested << ","
+        << r.gflops() << "," << r.intensity() << "," << r.requestedIntensity() << ","
+        << ceiling << "," << 100 * r.gflops() / ceiling << ","
+        << (r.intensity() < roof.ridge() ? "memory" : "compute") << std::endl;
+  }
+  if (!out.good())
+    std::cout << "Cannot write " << path << std::endl;
+}
+
+// Log-log plot: intensity in powers of two across, GFLOP/s in powers of ten up
+void writeSVG(const std::vector<Result>& results, const Roof& roof,
+              const std::string& title, const std::string& path)
+{
+  const double W = 900, H = 600;
+  const double left = 80, right = 220, top = 50, bottom = 60;
+  const double plotW = W - left - right, plotH = H - top - bottom;
+  const char *colors[] = {
+    "#1f77b4", "#ff7f0e", "#2ca02c", "#d62728", "#9467bd",
+    "#8c564b", "#e377c2", "#7f7f7f", "#bcbd22", "#17becf"
+  };
+
+  // Axis ranges cover the ridge point and every kernel
+  double xmin = roof.ridge() / 64, xmax = roof.ridge() * 16;
+  double ymin = roof.peakGflops / 1000, ymax = roof.peakGflops * 2;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result& r = results[i];
+    if (!r.error.empty())
+      continue;
+    xmin = std::min(xmin, r.requestedIntensity() / 2);
+    xmax = std::max(xmax, r.intensity() * 2);
+    ymin = std::min(ymin, r.gflops() / 2);
+  }
+  int x0 = (int)std::floor(std::log2(xmin)), x1 = (int)std::ceil(std::log2(xmax));
+  int y0 = (int)std::floor(std::log10(ymin)), y1 = (int)std::ceil(std::log10(ymax));
+
+  auto X = [&](double ai) {
+    return left + (std::log2(ai) - x0) / (x1 - x0) * plotW;
+  };
+  auto Y = [&](double gflops) {
+    return top + plotH - (std::log10(gflops) - y0) / (y1 - y0) * plotH;
+  };
+
+  std::ofstream out(path.c_str());
+  out << std::fixed << std::setprecision(1);
+  out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << W
+      << "\" height=\"" << H << "\" font-family=\"sans-serif\" font-size=\"12\">"
+      << std::endl;
+  out << "<rect width=\"100%\" height=\"100%\" fill=\"white\"/>" << std::endl;
+  out << "<text x=\"" << left << "\" y=\"25\" font-size=\"16\">Roofline: "
+      << title << "</text>" << std::endl;
+
+  // Grid and tick labels, thinned out on wide ranges
+  int xstep = std::max(1, (x1 - x0) / 12);
+  for (int e = x0; e <= x1; e += xstep)
+  {
+    double x = X(std::pow(2.0, e));
+    out << "<line x1=\"" << x << "\" y1=\"" << top << "\" x2=\"" << x << "\" y2=\""
+        << top + plotH << "\" stroke=\"#e0e0e0\"/>" << std::endl;
+    out << "<text x=\"" << x << "\" y=\"" << top + plotH + 18
+        << "\" text-anchor=\"middle\">2<tspan dy=\"-5\" font-size=\"9\">" << e
+        << "</tspan></text>" << std::endl;
+  }
+  for (int e = y0; e <= y1; e++)
+  {
+    double y = Y(std::pow(10.0, e));
+    out << "<line x1=\"" << left << "\" y1=\"" << y << "\" x2=\"" << left + plotW
+        << "\" y2=\"" << y << "\" stroke=\"#e0e0e0\"/>" << std::endl;
+    out << "<text x=\"" << left - 8 << "\" y=\"" << y + 4
+        << "\" text-anchor=\"end\">10<tspan dy=\"-5\" font-size=\"9\">" << e
+        << "</tspan></text>" << std::endl;
+  }
+  out << "<rect x=\"" << left << "\" y=\"" << top << "\" width=\"" << plotW
+      << "\" height=\"" << plotH << "\" fill=\"none\" stroke=\"black\"/>" << std::endl;
+  out << "<text x=\"" << left + plotW/2 << "\" y=\"" << H - 15
+      << "\" text-anchor=\"middle\">Arithmetic intensity (FLOP/byte)</text>" << std::endl;
+  out << "<text transform=\"translate(20," << top + plotH/2
+      << ") rotate(-90)\" text-anchor=\"middle\">GFLOP/s</text>" << std::endl;
+
+  // Bandwidth slope up to the ridge point, then the compute ceiling
+  double xa = std::pow(2.0, x0), xb = std::pow(2.0, x1);
+  out << "<polyline fill=\"none\" stroke=\"black\" stroke-width=\"2\" points=\""
+      << X(xa) << "," << Y(roof.at(xa)) << " "
+      << X(roof.ridge()) << "," << Y(roof.peakGflops) << " "
+      << X(xb) << "," << Y(roof.peakGflops) << "\"/>" << std::endl;
+  out << "<line x1=\"" << X(roof.ridge()) << "\" y1=\"" << Y(roof.peakGflops)
+      << "\" x2=\"" << X(roof.ridge()) << "\" y2=\"" << top + plotH
+      << "\" stroke=\"black\" stroke-dasharray=\"4,4\"/>" << std::endl;
+  out << "<text x=\"" << X(xb) - 4 << "\" y=\"" << Y(roof.peakGflops) - 6
+      << "\" text-anchor=\"end\">" << roof.peakGflops << " GFLOP/s</text>" << std::endl;
+  out << "<text x=\"" << X(xa) + 4 << "\" y=\"" << Y(roof.at(xa)) - 6 << "\">"
+      << roof.bandwidthGBs << " GB/s</text>" << std::endl;
+
+  // Filled marker at the compulsory intensity, hollow at the requested one
+  unsigned n = 0;
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const Result& r = results[i];
+    if (!r.error.empty())
+      continue;
+    const char *color = colors[n % 10];
+    double y = Y(r.gflops());
+    out << "<line x1=\"" << X(r.requestedIntensity()) << "\" y1=\"" << y
+        << "\" x2=\"" << X(r.intensity()) << "\" y2=\"" << y << "\" stroke=\""
+        << color << "\" stroke-dasharray=\"2,2\"/>" << std::endl;
+    out << "<circle cx=\"" << X(r.requestedIntensity()) << "\" cy=\"" << y
+        << "\" r=\"4\" fill=\"white\" stroke=\"" << color << "\"/>" << std::endl;
+    out << "<circle cx=\"" << X(r.intensity()) << "\" cy=\"" << y
+        << "\" r=\"5\" fill=\"" << color << "\"/>" << std::endl;
+
+    double ly = top + 10 + 18*n;
+    out << "<circle cx=\"" << left + plotW + 20 << "\" cy=\"" << ly
+        << "\" r=\"5\" fill=\"" << color << "\"/>" << std::endl;
+    out << "<text x=\"" << left + plotW + 30 << "\" y=\"" << ly + 4 << "\">"
+        << r.name << "</text>" << std::endl;
+    n++;
+  }
+  out << "</svg>" << std::endl;
+
+  if (!out.good())
+    std::cout << "Cannot write " << path << std::endl;
+}
+
+// With several devices, FILE.ext is written as FILE-INDEX.ext for each one
+std::string devicePath(const std::string& path, unsigned index, bool several)
+{
+  if (!several)
+    return path;
+  size_t slash = path.find_last_of("/\\");
+  size_t dot   = path.rfind('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = path.size();
+  std::ostringstream name;
+  name << path.substr(0, dot) << "-" << index << path.substr(dot);
+  return name.str();
+}
+
+void runDevice(const cl::Device& device, unsigned index, bool several)
+{
+  std::string name = getDeviceName(device);
+  std::cout << std::endl << "Using OpenCL device: " << name << std::endl;
+
+  util::DeviceProfile profile = util::loadDeviceProfile(device);
+  Roof roof;
+  roof.peakGflops   = profile.fp32Gflops;
+  roof.bandwidthGBs = profile.globalBandwidthGBs;
+  std::cout << std::fixed << std::setprecision(1)
+            << "Peak FP32          = " << roof.peakGflops << " GFLOP/s" << std::endl
+            << "Global bandwidth   = " << roof.bandwidthGBs << " GB/s" << std::endl
+            << "Ridge point        = " << std::setprecision(2) << roof.ridge()
+            << " FLOP/byte" << std::endl;
+
+  cl::Context context(device);
+  cl::CommandQueue queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+  std::vector<Result> results;
+  runMatMul(context, device, queue, results);
+  runNBody(context, device, queue, results);
+  runBilateral(context, device, queue, results);
+  runPi(context, device, queue, results);
+
+  printReport(results, roof);
+  if (!csvFile.empty())
+    writeCSV(results, roof, devicePath(csvFile, index, several));
+  if (!svgFile.empty())
+    writeSVG(results, roof, name, devicePath(svgFile, index, several));
+}
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parseArguments(argc, argv);
+
+    // Get list of devices
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+
+    // Check device index in range
+    std::vector<cl::Device> selected = getSelectedDevices(devices, deviceIndex);
+    if (selected.empty())
+    {
+      std::cout << "Invalid device index (try '--list')" << std::endl;
+      return 1;
+    }
+
+    bool several = deviceIndex == DEVICE_ALL && devices.size() > 1;
+    for (unsigned d = 0; d < selected.size(); d++)
+      runDevice(selected[d], deviceIndex == DEVICE_ALL ? d : deviceIndex, several);
+  }
+  catch (cl::Error err)
+  {
+    std::cout << "Exception:" << std::endl
+              << "ERROR: "
+              << err.what()
+              << "("
+              << err_code(err.err())
+              << ")"
+              << std::endl;
+  }
+
+#if defined(_WIN32) && !defined(__MINGW32__)
+  system("pause");
+#endif
+
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--list"))
+    {
+      // Get list of devices
+      std::vector<cl::Device> devices;
+      getDeviceList(devices);
+
+      // Print device names
+      if (devices.size() == 0)
+      {
+        std::cout << "No devices found." << std::endl;
+      }
+      else
+      {
+        std::cout << std::endl;
+        std::cout << "Devices:" << std::endl;
+        for (unsigned i = 0; i < devices.size(); i++)
+        {
+          std::cout << i << ": " << getDeviceName(devices[i]) << std::endl;
+        }
+        std::cout << std::endl;
+      }
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_COMPUTE))
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--iterations") || !strcmp(argv[i], "-i"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &iterations) || iterations == 0)
+      {
+        std::cout << "Invalid number of iterations" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--order"))
+    {
+      // The row kernels hold a row of A in float[1024] and use order/16
+      // work-items per group
+      if (++i >= argc || !parseUInt(argv[i], &order) ||
+          order == 0 || order > 1024 || order % 16)
+      {
+        std::cout << "Invalid matrix order (multiple of 16, at most 1024)" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--block"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &blockSize) || blockSize == 0)
+      {
+        std::cout << "Invalid block size" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--bodies"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &numBodies) || numBodies == 0)
+      {
+        std::cout << "Invalid number of bodies" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--wgsize"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &wgsize) || wgsize == 0)
+      {
+        std::cout << "Invalid work-group size" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--width"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &width) || width == 0)
+      {
+        std::cout << "Invalid image width" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--height"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &height) || height == 0)
+      {
+        std::cout << "Invalid image height" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--radius"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &radius))
+      {
+        std::cout << "Invalid radius" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--sources"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid sources directory" << std::endl;
+        exit(1);
+      }
+      sourceDir = argv[i];
+    }
+    else if (!strcmp(argv[i], "--csv"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid CSV file" << std::endl;
+        exit(1);
+      }
+      csvFile = argv[i];
+    }
+    else if (!strcmp(argv[i], "--svg"))
+    {
+      if (++i >= argc)
+      {
+        std::cout << "Invalid SVG file" << std::endl;
+        exit(1);
+      }
+      svgFile = argv[i];
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./roofline [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --list               List available devices" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, 'auto' or 'all'" << std::endl;
+      std::cout << "  -i  --iterations ITRS    Timed runs of each kernel" << std::endl;
+      std::cout << "      --order      N       MatMul matrix order" << std::endl;
+      std::cout << "      --block      B       MatMul block size" << std::endl;
+      std::cout << "      --bodies     N       NBody number of bodies" << std::endl;
+      std::cout << "      --wgsize     WGSIZE  NBody work-group size" << std::endl;
+      std::cout << "      --width      W       Bilateral image width" << std::endl;
+      std::cout << "      --height     H       Bilateral image height" << std::endl;
+      std::cout << "      --radius     RADIUS  Bilateral filter radius" << std::endl;
+      std::cout << "      --sources    DIR     Directory holding the solutions" << std::endl;
+      std::cout << "      --csv        FILE    Write the results as CSV" << std::endl;
+      std::cout << "      --svg        FILE    Draw the roofline as SVG" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+
+  if (numBodies % wgsize)
+  {
+    std::cout << "Number of bodies must be a multiple of the work-group size" << std::endl;
+    exit(1);
+  }
+  if (order % blockSize)
+  {
+    std::cout << "Block size must divide the matrix order" << std::endl;
+    exit(1);
+  }
+}
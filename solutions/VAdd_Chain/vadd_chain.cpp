@@ -31,7 +31,10 @@
 #define CL_HPP_MINIMUM_OPENCL_VERSION 120
 #include <CL/cl2.hpp>
 
+#include <device_vector.hpp>
 #include <util.hpp>
+#include <program_cache.hpp>
+#include <bench.hpp>
 
 
 // pick up device type from compiler command line or from the default type
@@ -48,33 +51,6 @@
 
 int main(void)
 {
-    std::vector<float> h_a(LENGTH);                     // a vector
-    std::vector<float> h_b(LENGTH);                     // b vector
-    std::vector<float> h_c(LENGTH);                     // c vector
-    std::vector<float> h_d(LENGTH, (float)0xdeadbeef);  // d vector (result)
-    std::vector<float> h_e(LENGTH);                     // e vector
-    std::vector<float> h_f(LENGTH);                     // f vector
-    std::vector<float> h_g(LENGTH, (float)0xdeadbeef);  // g vector (result)
-
-    cl::Buffer d_a;                       // device memory used for the input  a vector
-    cl::Buffer d_b;                       // device memory used for the input  b vector
-    cl::Buffer d_c;                       // device memory used for the input  c vector
-    cl::Buffer d_d;                       // device memory used for the input/output d vector
-    cl::Buffer d_e;                       // device memory used for the input  e vector
-    cl::Buffer d_f;                       // device memory used for the input  f vector
-    cl::Buffer d_g;                       // device memory used for the output g vector
-
-    // Fill input vectors with random float values
-    int count = LENGTH;
-    for(int i = 0; i < count; i++)
-    {
-        h_a[i]  = rand() / (float)RAND_MAX;
-        h_b[i]  = rand() / (float)RAND_MAX;
-        h_c[i]  = rand() / (float)RAND_MAX;
-        h_e[i]  = rand() / (float)RAND_MAX;
-        h_f[i]  = rand() / (float)RAND_MAX;
-    }
-
     try
     {
     	// Create a context
@@ -85,7 +61,7 @@ int main(void)
                   << device.getInfo<CL_DEVICE_NAME>() << std::endl;
 
         // Load in kernel source, creating a program object for the context
-        cl::Program program(context, util::loadProgram("vadd_chain.cl"), true);
+        cl::Program program = util::buildProgram(context, device, util::loadProgram("vadd_chain.cl"));
 
         // Get the command queue
         cl::CommandQueue queue(context);
@@ -94,54 +70,97 @@ int main(void)
 
         cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, int> vadd(program, "vadd");
 
-        d_a   = cl::Buffer(context, h_a.begin(), h_a.end(), true);
-        d_b   = cl::Buffer(context, h_b.begin(), h_b.end(), true);
-        d_c   = cl::Buffer(context, h_c.begin(), h_c.end(), true);
-        d_e   = cl::Buffer(context, h_e.begin(), h_e.end(), true);
-        d_f   = cl::Buffer(context, h_f.begin(), h_f.end(), true);
-
-        d_d  = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * LENGTH);
-        d_g  = cl::Buffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * LENGTH);
-
-        vadd(
-            cl::EnqueueArgs(
-                queue,
-                cl::NDRange(count)),
-            d_a,
-            d_b,
-            d_c,
-            d_d,
-            count);
-
-        vadd(
-            cl::EnqueueArgs(
-                queue,
-                cl::NDRange(count)),
-            d_d,
-            d_e,
-            d_f,
-            d_g,
-            count);
-
-        cl::copy(queue, d_g, h_g.begin(), h_g.end());
+        // Vectors with a host and a device copy, which only transfer data
+        // when the side being accessed is out of date
+        util::DeviceVector<float> a(context, queue, LENGTH);  // a vector
+        util::DeviceVector<float> b(context, queue, LENGTH);  // b vector
+        util::DeviceVector<float> c(context, queue, LENGTH);  // c vector
+        util::DeviceVector<float> d(context, queue, LENGTH);  // d vector (intermediate, device only)
+        util::DeviceVector<float> e(context, queue, LENGTH);  // e vector
+        util::DeviceVector<float> f(context, queue, LENGTH);  // f vector
+        util::DeviceVector<float> g(context, queue, LENGTH);  // g vector (result)
+
+        // Fill input vectors with random float values
+        int count = LENGTH;
+        float *h_a = a.hostDiscard();
+        float *h_b = b.hostDiscard();
+        float *h_c = c.hostDiscard();
+        float *h_e = e.hostDiscard();
+        float *h_f = f.hostDiscard();
+        for(int i = 0; i < count; i++)
+        {
+            h_a[i]  = rand() / (float)RAND_MAX;
+            h_b[i]  = rand() / (float)RAND_MAX;
+            h_c[i]  = rand() / (float)RAND_MAX;
+            h_e[i]  = rand() / (float)RAND_MAX;
+            h_f[i]  = rand() / (float)RAND_MAX;
+        }
+
+        util::Benchmark bench("vadd_chain", device);
+        bench.param("length", count);
+
+        // Three vectors in and one out for each of the two kernels
+        double chainBytes = 8.0 * count * sizeof(float);
+        const float *h_g = NULL;
+        util::BenchResult result = bench.time("chain", [&]()
+        {
+            vadd(
+                cl::EnqueueArgs(
+                    queue,
+                    cl::NDRange(count)),
+                a.deviceRead(),
+                b.deviceRead(),
+                c.deviceRead(),
+                d.deviceDiscard(),
+                count);
+
+            // d is already on the device, so only e and f are transferred here
+            vadd(
+                cl::EnqueueArgs(
+                    queue,
+                    cl::NDRange(count)),
+                d.deviceRead(),
+                e.deviceRead(),
+                f.deviceRead(),
+                g.deviceDiscard(),
+                count);
+
+            // The inputs are still valid on the host, so only g is read back
+            h_g = g.hostRead();
+        }, chainBytes*1e-9, "GB/s");
+        printf("\nThe kernels ran in %lf seconds\n", result.median*1e-3);
+
+        const float *r_a = a.hostRead();
+        const float *r_b = b.hostRead();
+        const float *r_c = c.hostRead();
+        const float *r_e = e.hostRead();
+        const float *r_f = f.hostRead();
 
         // Test the results
         int correct = 0;
         float tmp;
         for(int i = 0; i < count; i++)
         {
-            tmp = h_a[i] + h_b[i] + h_c[i] + h_e[i] + h_f[i]; // assign element i of a+b+c+e+f to tmp
+            tmp = r_a[i] + r_b[i] + r_c[i] + r_e[i] + r_f[i]; // assign element i of a+b+c+e+f to tmp
             tmp -= h_g[i];                                    // compute deviation of expected and output result
             if(tmp*tmp < TOL*TOL)                             // correct if square deviation is less than tolerance squared
                 correct++;
             else {
-                printf(" tmp %f h_a %f h_b %f h_c %f h_e %f h_f %f h_g %f\n",tmp, h_a[i], h_b[i], h_c[i], h_e[i], h_f[i], h_g[i]);
+                printf(" tmp %f h_a %f h_b %f h_c %f h_e %f h_f %f h_g %f\n",tmp, r_a[i], r_b[i], r_c[i], r_e[i], r_f[i], h_g[i]);
             }
         }
 
         // summarize results
         printf("G = A+B+C+E+F:  %d out of %d results were correct.\n", correct, count);
 
+        const util::TransferCounters& moved = util::deviceVectorTotals();
+        printf("Transfers: %lu, %lu bytes to device, %lu bytes to host, %lu bytes mapped\n",
+               (unsigned long)moved.transfers,
+               (unsigned long)moved.bytesToDevice,
+               (unsigned long)moved.bytesToHost,
+               (unsigned long)moved.bytesMapped);
+        bench.write();
+
     }
     catch (cl::BuildError error)
     {
@@ -0,0 +1,269 @@
+//------------------------------------------------------------------------------
+//
+// Name:       vadd_stream.cpp
+//
+// Purpose:    Elementwise addition of three vectors, d = a + b + c, for
+//             vectors that do not fit in device memory.
+//
+//             The vectors are streamed through a small ring of device
+//             buffers in chunks, with the upload, compute and download of
+//             different chunks overlapping on separate command queues.
+//
+//------------------------------------------------------------------------------
+
+/*
+ *
+ * This code is released under the "attribution CC BY" creative commons license.
+ * In other words, you can use it in any way you see fit, including commercially,
+ * but please retain an attribution for the original authors:
+ * the High Performance Computing Group at the University of Bristol.
+ * Contributors include Simon McIntosh-Smith, James Price, Tom Deakin and Mike O'Connor.
+ *
+ */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+#define CL_HPP_ENABLE_EXCEPTIONS
+#define CL_HPP_TARGET_OPENCL_VERSION 120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+#include <CL/cl2.hpp>
+
+#include <bench.hpp>
+#include <device_picker.hpp>
+#include <stream_executor.hpp>
+#include <util.hpp>
+#include <program_cache.hpp>
+
+#define TOL (0.001) // tolerance used in floating point comparisons
+
+void parseArguments(int argc, char *argv[]);
+
+// Parameters, with default values.
+unsigned deviceIndex   =      0;
+unsigned length        =     64; // Vector length in millions of elements
+unsigned chunkSize     =      0; // Chunk size in MB, 0 picks one from the device
+unsigned depth         =      3; // Number of chunks in flight
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    parseArguments(argc, argv);
+
+    // Get list of devices
+    std::vector<cl::Device> devices;
+    getDeviceList(devices);
+
+    // Check device index in range
+    if (deviceIndex >= devices.size())
+    {
+      std::cout << "Invalid device index (try '--list')" << std::endl;
+      return 1;
+    }
+
+    cl::Device device = devices[deviceIndex];
+
+    std::string name = getDeviceName(device);
+    std::cout << std::endl << "Using OpenCL device: " << name << std::endl;
+
+    size_t count = (size_t)length * 1000 * 1000;
+
+    // Fill input vectors with random float values
+    std::vector<float> h_a(count);
+    std::vector<float> h_b(count);
+    std::vector<float> h_c(count);
+    std::vector<float> h_d(count, (float)0xdeadbeef);
+    for (size_t i = 0; i < count; i++)
+    {
+      h_a[i] = rand() / (float)RAND_MAX;
+      h_b[i] = rand() / (float)RAND_MAX;
+      h_c[i] = rand() / (float)RAND_MAX;
+    }
+
+    cl::Context context(device);
+    cl::Program program = util::buildProgram(context, device, util::loadProgram("vadd_stream.cl"));
+    cl::KernelFunctor<cl::Buffer, cl::Buffer, cl::Buffer, cl::Buffer, cl_uint>
+      vadd(program, "vadd");
+
+    size_t chunkElements = chunkSize ?
+      (size_t)chunkSize*1024*1024 / sizeof(float) :
+      util::StreamExecutor<float>::defaultChunkElements(device, 4, depth);
+
+    util::StreamExecutor<float> stream(context, device, 3, 1, chunkElements, depth);
+
+    double vectorBytes = count * sizeof(float);
+    std::cout << "Vector size = " << vectorBytes*1e-6 << " MB ("
+              << 4*vectorBytes*1e-6 << " MB total)" << std::endl
+              << "Chunk size  = " << chunkElements*sizeof(float)*1e-6 << " MB"
+              << std::endl
+              << "Ring depth  = " << stream.getDepth() << std::endl
+              << "Max alloc   = "
+              << device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>()*1e-6 << " MB"
+              << std::endl << std::endl;
+
+    std::vector<const float*> inputs;
+    inputs.push_back(&h_a[0]);
+    inputs.push_back(&h_b[0]);
+    inputs.push_back(&h_c[0]);
+    std::vector<float*> outputs(1, &h_d[0]);
+
+    util::Benchmark bench("vadd_stream", device);
+    bench.param("length", count);
+    bench.param("chunk_bytes", chunkElements*sizeof(float));
+    bench.param("depth", stream.getDepth());
+
+    bench.time("stream", [&]()
+    {
+      stream.run(inputs, outputs, count,
+        [&vadd](cl::CommandQueue& queue,
+                const std::vector<cl::Buffer>& in,
+                const std::vector<cl::Buffer>& out,
+                size_t n,
+                const std::vector<cl::Event>& wait,
+                cl::Event& done)
+        {
+          done = vadd(cl::EnqueueArgs(queue, wait, cl::NDRange(n)),
+                      in[0], in[1], in[2], out[0], (cl_uint)n);
+        });
+    }, 4*vectorBytes*1e-9, "GB/s");
+
+    // Test the results
+    size_t correct = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      float tmp = h_a[i] + h_b[i] + h_c[i] - h_d[i];
+      if (tmp*tmp < TOL*TOL)
+        correct++;
+    }
+
+    const util::StreamStats& stats = stream.getStats();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Chunks             " << std::setw(10) << stats.chunks << std::endl
+              << "Wall time          " << std::setw(10) << stats.wallSeconds*1e3 << " ms" << std::endl
+              << "Upload busy        " << std::setw(10) << stats.uploadSeconds*1e3 << " ms" << std::endl
+              << "Compute busy       " << std::setw(10) << stats.computeSeconds*1e3 << " ms" << std::endl
+              << "Download busy      " << std::setw(10) << stats.downloadSeconds*1e3 << " ms" << std::endl
+              << "Peak upload        " << std::setw(10) << stats.peakUploadBandwidth*1e-9 << " GB/s" << std::endl
+              << "Peak download      " << std::setw(10) << stats.peakDownloadBandwidth*1e-9 << " GB/s" << std::endl
+              << "Effective          " << std::setw(10)
+              << (stats.bytesUploaded + stats.bytesDownloaded) / stats.wallSeconds * 1e-9 << " GB/s" << std::endl
+              << "Fraction of peak   " << std::setw(10) << stats.peakFraction()*100 << " %" << std::endl
+              << "Transfer hidden    " << std::setw(10) << stats.hiddenFraction()*100 << " %" << std::endl
+              << std::endl;
+
+    std::cout << "D = A+B+C:  " << correct << " out of " << count
+              << " results were correct." << std::endl;
+    bench.write();
+  }
+  catch (cl::BuildError error)
+  {
+    std::string log = error.getBuildLog()[0].second;
+    std::cerr << std::endl << "Build failed:" << std::endl << log << std::endl;
+  }
+  catch (cl::Error err)
+  {
+    std::cout << "Exception:" << std::endl
+              << "ERROR: "
+              << err.what()
+              << "("
+              << err_code(err.err())
+              << ")"
+              << std::endl;
+  }
+  std::cout << std::endl;
+
+#if defined(_WIN32)
+  system("pause");
+#endif
+
+  return 0;
+}
+
+void parseArguments(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--list"))
+    {
+      // Get list of devices
+      std::vector<cl::Device> devices;
+      getDeviceList(devices);
+
+      // Print device names
+      if (devices.size() == 0)
+      {
+        std::cout << "No devices found." << std::endl;
+      }
+      else
+      {
+        std::cout << std::endl;
+        std::cout << "Devices:" << std::endl;
+        for (unsigned i = 0; i < devices.size(); i++)
+        {
+          std::cout << i << ": " << getDeviceName(devices[i]) << std::endl;
+        }
+        std::cout << std::endl;
+      }
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--device"))
+    {
+      if (++i >= argc || !parseDeviceIndex(argv[i], &deviceIndex, WORKLOAD_MEMORY) ||
+          deviceIndex == DEVICE_ALL)
+      {
+        std::cout << "Invalid device index" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--length") || !strcmp(argv[i], "-n"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &length) || length == 0)
+      {
+        std::cout << "Invalid vector length" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--chunk") || !strcmp(argv[i], "-c"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &chunkSize))
+      {
+        std::cout << "Invalid chunk size" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--depth"))
+    {
+      if (++i >= argc || !parseUInt(argv[i], &depth) || depth == 0)
+      {
+        std::cout << "Invalid ring depth" << std::endl;
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h"))
+    {
+      std::cout << std::endl;
+      std::cout << "Usage: ./vadd_stream [OPTIONS]" << std::endl << std::endl;
+      std::cout << "Options:" << std::endl;
+      std::cout << "  -h  --help               Print the message" << std::endl;
+      std::cout << "      --list               List available devices" << std::endl;
+      std::cout << "      --device     INDEX   Select device at INDEX, or 'auto'" << std::endl;
+      std::cout << "  -n  --length     N       Vector length in millions of elements" << std::endl;
+      std::cout << "  -c  --chunk      C       Chunk size in MB (default: from device limits)" << std::endl;
+      std::cout << "      --depth      D       Number of chunks in flight" << std::endl;
+      std::cout << std::endl;
+      exit(0);
+    }
+    else
+    {
+      std::cout << "Unrecognized argument '" << argv[i] << "' (try '--help')"
+                << std::endl;
+      exit(1);
+    }
+  }
+}